@@ -0,0 +1,302 @@
+//
+//  Corpus.cpp
+//  jsonbench
+//
+
+#include <stdio.h>
+#include "Corpus.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Random Numbers															*/
+/*																			*/
+/****************************************************************************/
+
+/*	Corpus::Corpus
+ *
+ *		Start the generator from a seed
+ */
+
+Corpus::Corpus(uint64_t seed)
+{
+	state = seed;
+}
+
+/*	Corpus::next
+ *
+ *		splitmix64. We don't use <random>, whose distributions are allowed to
+ *	differ between standard libraries.
+ */
+
+uint64_t Corpus::next()
+{
+	uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/*	Corpus::name
+ *
+ *		Name of a shape, as used on the command line and in the results
+ */
+
+const char *Corpus::name(CorpusShape shape)
+{
+	static const char *names[CorpusShapeCount] = {
+		"numbers", "strings", "nested", "wide", "ndjson", "malformed"
+	};
+	return names[shape];
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Values																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	Corpus::number
+ *
+ *		A number: small and large integers, negative numbers, decimals with
+ *	a few digits or with all seventeen, and exponents.
+ */
+
+void Corpus::number(std::string &out)
+{
+	char buf[64];
+	
+	switch (below(6)) {
+		case 0:
+			snprintf(buf,sizeof(buf),"%u",below(100));
+			break;
+		case 1:
+			snprintf(buf,sizeof(buf),"%lld",(long long)(next() >> 1) * ((next() & 1) ? -1 : 1));
+			break;
+		case 2:
+			snprintf(buf,sizeof(buf),"%d.%02u",(int)below(20000) - 10000,below(100));
+			break;
+		case 3:
+			snprintf(buf,sizeof(buf),"%.17g",(double)(next() >> 11) / (double)(1ULL << 53) * 1000);
+			break;
+		case 4:
+			snprintf(buf,sizeof(buf),"%.6e",(double)(next() >> 11) / (double)(1ULL << 40) * ((next() & 1) ? 1e-200 : 1e200));
+			break;
+		default:
+			snprintf(buf,sizeof(buf),"%u",below(4000000000U));
+			break;
+	}
+	out.append(buf);
+}
+
+/*	Corpus::string
+ *
+ *		A quoted string of about len bytes. With escapes, about one byte in
+ *	eight is an escape or a multibyte UTF-8 character.
+ */
+
+void Corpus::string(std::string &out, size_t len, bool escapes)
+{
+	static const char *escapeList[] = {
+		"\\n", "\\t", "\\\"", "\\\\", "\\/", "\\u00e9", "\\u2603", "\\ud83d\\ude00",
+		"\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80"
+	};
+	
+	out.push_back('"');
+	for (size_t i = 0; i < len; ++i) {
+		uint32_t r = below(64);
+		if (escapes && (r < 8)) {
+			out.append(escapeList[below(sizeof(escapeList) / sizeof(escapeList[0]))]);
+		} else if (r < 14) {
+			out.push_back(' ');
+		} else {
+			out.push_back((char)('a' + below(26)));
+		}
+	}
+	out.push_back('"');
+}
+
+/*	Corpus::word
+ *
+ *		A short identifier, as used for keys
+ */
+
+void Corpus::word(std::string &out)
+{
+	static const char *words[] = {
+		"id", "name", "type", "value", "created", "updated", "status", "owner",
+		"tags", "count", "price", "enabled", "parent", "children", "url", "data"
+	};
+	out.append(words[below(sizeof(words) / sizeof(words[0]))]);
+}
+
+/*	Corpus::record
+ *
+ *		A small object such as a service would log
+ */
+
+void Corpus::record(std::string &out, long id)
+{
+	char buf[64];
+	
+	snprintf(buf,sizeof(buf),"{\"id\": %ld, \"level\": \"",id);
+	out.append(buf);
+	out.append((below(10) == 0) ? "error" : "info");
+	out.append("\", \"message\": ");
+	string(out,8 + below(40),below(4) == 0);
+	out.append(", \"latency\": ");
+	number(out);
+	out.append(", \"ok\": ");
+	out.append(below(2) ? "true" : "false");
+	out.append(", \"tags\": [");
+	for (uint32_t i = 0, n = below(4); i < n; ++i) {
+		if (i) out.append(", ");
+		string(out,3 + below(6),false);
+	}
+	out.append("], \"user\": {\"name\": ");
+	string(out,5 + below(10),false);
+	out.append(", \"");
+	word(out);
+	out.append("\": null}}");
+}
+
+/*	Corpus::nested
+ *
+ *		Arrays and objects nested to the given depth, with a value at the
+ *	bottom
+ */
+
+void Corpus::nested(std::string &out, int depth)
+{
+	for (int i = 0; i < depth; ++i) {
+		if (i & 1) {
+			out.append("{\"");
+			word(out);
+			out.append("\": ");
+		} else {
+			out.push_back('[');
+		}
+	}
+	number(out);
+	for (int i = depth; i-- > 0; ) {
+		out.push_back((i & 1) ? '}' : ']');
+	}
+}
+
+/*	Corpus::wide
+ *
+ *		An object with the given number of distinct keys
+ */
+
+void Corpus::wide(std::string &out, int members)
+{
+	char buf[64];
+	
+	out.push_back('{');
+	for (int i = 0; i < members; ++i) {
+		if (i) out.append(",\n ");
+		snprintf(buf,sizeof(buf),"\"field_%d_%u\": ",i,below(1000));
+		out.append(buf);
+		switch (below(4)) {
+			case 0:
+				string(out,4 + below(12),false);
+				break;
+			case 1:
+				out.append(below(2) ? "true" : "null");
+				break;
+			default:
+				number(out);
+				break;
+		}
+	}
+	out.push_back('}');
+}
+
+/*	Corpus::damage
+ *
+ *		A record with the kind of damage hand edited or truncated JSON has:
+ *	missing and trailing commas, missing colons, unquoted keys and wrong
+ *	closing brackets. The parser repairs all of these with warnings.
+ */
+
+void Corpus::damage(std::string &out)
+{
+	std::string rec;
+	record(rec,(long)below(1000000));
+	
+	for (size_t i = 0; i < rec.size(); ++i) {
+		char c = rec[i];
+		uint32_t r = below(100);
+		
+		if ((c == ',') && (r < 15)) continue;						/* missing comma */
+		if ((c == ':') && (r < 10)) continue;						/* missing colon */
+		if ((c == ']') && (r < 20)) {
+			out.append((r < 10) ? ", ]" : "}");						/* trailing comma, wrong close */
+			continue;
+		}
+		if ((c == '"') && (r < 10) && (i + 1 < rec.size()) && (rec[i + 1] >= 'a') && (rec[i + 1] <= 'z')) {
+			size_t end = rec.find('"',i + 1);						/* unquote a word */
+			if ((end != std::string::npos) && (end + 1 < rec.size()) && (rec[end + 1] == ':')) {
+				out.append(rec,i + 1,end - i - 1);
+				i = end;
+				continue;
+			}
+		}
+		out.push_back(c);
+	}
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Corpus																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	Corpus::generate
+ *
+ *		Generate at least size bytes of the shape. Everything but NDJSON is a
+ *	single top level array.
+ */
+
+std::string Corpus::generate(CorpusShape shape, size_t size)
+{
+	std::string out;
+	long id = 0;
+	
+	out.reserve(size + 64*1024);
+	if (shape != CorpusLines) out.append("[\n");
+	
+	while (out.size() < size) {
+		if ((id > 0) && (shape != CorpusLines)) out.append(",\n");
+		
+		switch (shape) {
+			case CorpusNumbers:
+				out.push_back('[');
+				for (int i = 0; i < 16; ++i) {
+					if (i) out.append(", ");
+					number(out);
+				}
+				out.push_back(']');
+				break;
+			case CorpusStrings:
+				string(out,16 + below(240),true);
+				break;
+			case CorpusNested:
+				nested(out,16 + below(1000));
+				break;
+			case CorpusWide:
+				wide(out,1000 + below(4000));
+				break;
+			case CorpusLines:
+				record(out,id);
+				out.push_back('\n');
+				break;
+			default:
+				damage(out);
+				break;
+		}
+		++id;
+	}
+	
+	if (shape != CorpusLines) out.append("\n]\n");
+	return out;
+}
@@ -0,0 +1,73 @@
+//
+//  Corpus.h
+//  jsonbench
+//
+
+#ifndef Corpus_h
+#define Corpus_h
+
+#include <stdint.h>
+#include <string>
+
+/****************************************************************************/
+/*																			*/
+/*	Synthetic Corpus														*/
+/*																			*/
+/****************************************************************************/
+
+/*	CorpusShape
+ *
+ *		The kinds of input we generate, each stressing a different part of
+ *	the parser and formatter.
+ */
+
+enum CorpusShape {
+	CorpusNumbers,					/* integers and reals of every size */
+	CorpusStrings,					/* long strings, escapes and UTF-8 */
+	CorpusNested,					/* deeply nested arrays and objects */
+	CorpusWide,						/* objects with thousands of members */
+	CorpusLines,					/* NDJSON log records */
+	CorpusMalformed,				/* missing and wrong punctuation */
+	
+	CorpusShapeCount
+};
+
+/*	Corpus
+ *
+ *		Deterministic generator for benchmark input. The same seed and size
+ *	always give the same bytes, on any platform, so results can be compared
+ *	between releases.
+ */
+
+class Corpus
+{
+	public:
+						Corpus(uint64_t seed = 1);
+		
+		std::string		generate(CorpusShape shape, size_t size);
+		
+		static const char *name(CorpusShape shape);
+		static bool		isLines(CorpusShape shape)
+							{
+								return (shape == CorpusLines);
+							}
+		
+	private:
+		uint64_t		state;
+		
+		uint64_t		next();
+		uint32_t		below(uint32_t n)
+							{
+								return (uint32_t)(next() % n);
+							}
+		
+		void			number(std::string &out);
+		void			string(std::string &out, size_t len, bool escapes);
+		void			word(std::string &out);
+		void			record(std::string &out, long id);
+		void			nested(std::string &out, int depth);
+		void			wide(std::string &out, int members);
+		void			damage(std::string &out);
+};
+
+#endif /* Corpus_h */
@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+#  golden.sh
+#  prettyjson
+#
+#  Regression check: runs prettyjson on each NAME.json (or NAME.ndjson)
+#  in bench/golden, with the options in NAME.args if there is one, and
+#  compares what it writes with NAME.out and NAME.err (a missing file
+#  means no output). A nonzero exit status is added to the end of what
+#  was written to stderr. A case which needs more than one run is a
+#  script, NAME.sh, run in bench/golden with the path of prettyjson as
+#  its argument and a scratch directory in $SCRATCH.
+#
+#  With --update the expected output is written instead, to be reviewed
+#  with git diff.
+#
+#  usage: golden.sh [--update] [path to prettyjson]
+#
+
+update=0
+if [ "$1" = "--update" ]; then
+	update=1
+	shift
+fi
+
+dir=$(cd "$(dirname "$0")/golden" && pwd)
+tool=$(cd "$(dirname "${1:-build/prettyjson}")" && pwd)/$(basename "${1:-build/prettyjson}")
+tmp=${TMPDIR:-/tmp}/golden.$$
+failed=0
+count=0
+
+trap 'rm -rf "$tmp.out" "$tmp.err" "$tmp.d"' EXIT
+
+for input in "$dir"/*.json "$dir"/*.ndjson "$dir"/*.sh; do
+	[ -f "$input" ] || continue
+	name=${input%.*}
+	
+	if [ "${input##*.}" = sh ]; then
+		rm -rf "$tmp.d"
+		mkdir "$tmp.d"
+		(cd "$dir" && SCRATCH="$tmp.d" sh "$input" "$tool") > "$tmp.out" 2> "$tmp.err"
+	else
+		args=
+		if [ -f "$name.args" ]; then
+			args=$(cat "$name.args")
+		fi
+		"$tool" $args "$input" > "$tmp.out" 2> "$tmp.err"
+	fi
+	status=$?
+	if [ $status != 0 ]; then
+		echo "exit status $status" >> "$tmp.err"
+	fi
+	count=$((count + 1))
+	
+	for stream in out err; do
+		expected="$name.$stream"
+		if [ $update = 1 ]; then
+			if [ -s "$tmp.$stream" ]; then
+				cp "$tmp.$stream" "$expected"
+			else
+				rm -f "$expected"
+			fi
+		elif [ -f "$expected" ]; then
+			if ! cmp -s "$expected" "$tmp.$stream"; then
+				echo "FAIL $(basename "$name") ($stream):"
+				diff "$expected" "$tmp.$stream" | head -20
+				failed=$((failed + 1))
+			fi
+		elif [ -s "$tmp.$stream" ]; then
+			echo "FAIL $(basename "$name") ($stream): unexpected output"
+			head -20 "$tmp.$stream"
+			failed=$((failed + 1))
+		fi
+	done
+done
+
+if [ $update = 1 ]; then
+	echo "updated $count cases"
+	exit 0
+fi
+if [ $failed != 0 ]; then
+	echo "$failed of $count cases failed"
+	exit 1
+fi
+echo "all $count cases passed"
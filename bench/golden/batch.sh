@@ -0,0 +1,23 @@
+# --batch checks or formats every .json file under the paths given, and
+# reports those which needed repair or failed. A file which would be
+# written where an earlier one was, such as the same name under two
+# directories mirrored into one, is reported as a duplicate rather than
+# overwriting it.
+cd "$SCRATCH"
+mkdir -p d1/sub d2
+echo '{ "a": 1 }' > d1/x.json
+echo '[ 1 2 ]' > d1/sub/y.json
+echo '{ "from": "d2" }' > d2/x.json
+echo '{ "z": }' > d2/z.json
+echo 'not json' > d2/notes.txt
+
+echo "--batch --out-dir out d1 d2:"
+"$1" --batch --minify --out-dir out d1 d2
+find out -type f | sort | while read f; do echo "$f: $(cat $f)"; done
+
+echo "--batch --in-place d1 d1/x.json:"
+"$1" --batch --in-place d1 d1/x.json
+cat d1/sub/y.json
+
+echo "--batch from stdin:"
+printf 'd2/x.json\nmissing.json\n' | "$1" --batch
@@ -0,0 +1,25 @@
+# --lazy --select must find the same values as selecting from a snapshot,
+# which is the DOM JSONRecordParser builds, including where the input
+# needs repair or repeats a key.
+cd "$SCRATCH"
+printf '%s' '{ "name": "valid", "list": [ 1, -2.5e3, true, null, "a\"b\\u00e9" ], "nested": { "x": [ [ 1 ], { "y": { "z": [ 2, 3 ] } } ], "e\/k": "slash" }, "empty": [ {}, [] ] }' > valid
+printf '%s' '{ a: 1 "b": [ 1 2, , 3 } "c" { "d": [ bogus, 4 ], "d": { "e": 5 } } ] "f": [ { "g": 6 }' > repaired
+printf '%s' '{ "k": 1, "m": [ 1, { "k": 2, "k": [ 3 ] } ], "k": { "k": 4 }, "m": [ 5 ], "n": nope, "n": 7 }' > duplicates
+printf '%s' '[ [ 1, [ 2, [ 3 ] ] ], { "0": "key", "1": [ "a" ] }, "x", 1e400, -0 ]' > array
+for doc in valid repaired duplicates array; do
+	"$1" --save-snapshot $doc.snap $doc > /dev/null 2>&1
+	n=0
+	for p in "" /name /list/4 /nested/x/1/y/z/1 "/nested/e~1k" /a /b /c/d /c/d/e /f/0/g \
+			/k /k/k /m/1/k/0 /n /0/1/1/0 /1/0 /1/1/0 /4 /9 /list/9 /list/-1 \
+			"/*" "/*/*" "/*/*/*" "/*/*/*/*" "/*/0" "/*/k" "/*/1/*"; do
+		"$1" --lazy --select "$p" $doc > lazy 2>&1
+		"$1" --snapshot --select "$p" $doc.snap > dom 2>&1
+		if cmp -s lazy dom; then
+			n=$((n + 1))
+		else
+			echo "$doc $p: lazy gives"; cat lazy; echo "but the DOM gives"; cat dom
+		fi
+	done
+	echo "$doc: $n pointers the same"
+done
+"$1" --minify --lazy --select "/*" duplicates
@@ -0,0 +1,13 @@
+# Unknown options, options missing their value and a second file without
+# --batch are rejected with the usage message on stderr rather than being
+# opened as input; --help prints it on stdout.
+for args in "--snapshot-out x" "--max-depth" "a.json b.json"; do
+	"$1" $args > "$SCRATCH/out" 2> "$SCRATCH/err"
+	echo "$args: exit status $?"
+	head -2 "$SCRATCH/err"
+	cat "$SCRATCH/out"
+done
+"$1" --help > "$SCRATCH/out" 2> "$SCRATCH/err"
+echo "--help: exit status $?"
+head -1 "$SCRATCH/out"
+cat "$SCRATCH/err"
@@ -0,0 +1,17 @@
+# A DOM large enough to be formatted on the work pool in several units
+# must be written exactly as the sequential formatter writes it, pretty
+# printed, minified and with --utf8.
+awk 'BEGIN {
+	printf "{ \"groups\": [\n"
+	for (i = 0; i < 3000; i++) {
+		printf "{ \"id\": %d, \"label\": \"gr\\u00fc\\u00dfe %d \\ud83d\\ude00\", \"members\": [", i, i
+		for (j = 0; j < 12; j++) printf "%s{ \"n\": %d.5, \"ok\": %s }", (j ? ", " : " "), j, (j % 2 ? "true" : "null")
+		printf " ] }%s\n", (i < 2999 ? "," : "")
+	}
+	printf "], \"count\": 3000 }\n"
+}' > "$SCRATCH/in"
+for mode in "" --minify --utf8 "--minify --utf8"; do
+	"$1" $mode "$SCRATCH/in" > "$SCRATCH/serial" 2>&1
+	"$1" --parallel -j 4 $mode "$SCRATCH/in" > "$SCRATCH/parallel" 2>&1
+	cmp -s "$SCRATCH/serial" "$SCRATCH/parallel" && echo "--parallel${mode:+ $mode}: same"
+done
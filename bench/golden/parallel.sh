@@ -0,0 +1,17 @@
+# A document large enough to be split into parts (over 4MB) is parsed in
+# parallel, with a malformed member part way through, and must give the
+# same output and diagnostics as the sequential parser.
+awk 'BEGIN {
+	printf "[\n"
+	for (i = 0; i < 60000; i++) {
+		printf "{ \"id\": %d, \"name\": \"item %d\", \"tags\": [ \"a\", \"b\" ], \"value\": %d.25, \"note\": \"%s\" },\n", i, i, i, "lorem ipsum dolor sit amet"
+		if (i == 40000) printf "{ \"id\": , \"broken\": [ 1 2 ] },\n"
+	}
+	printf "null\n]\n"
+}' > "$SCRATCH/in"
+for mode in "" --stream; do
+	"$1" $mode "$SCRATCH/in" > "$SCRATCH/serial" 2>&1
+	"$1" --parallel $mode "$SCRATCH/in" > "$SCRATCH/parallel" 2>&1
+	cmp -s "$SCRATCH/serial" "$SCRATCH/parallel" && echo "--parallel${mode:+ $mode}: same"
+done
+grep "^#" "$SCRATCH/parallel"
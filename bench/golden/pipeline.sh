@@ -0,0 +1,15 @@
+# With --pipeline the input is read and the output written on threads of
+# their own; the output must be the same as without, from a file or a
+# pipe, including where the document needs repair.
+awk 'BEGIN {
+	printf "{ \"items\": [\n"
+	for (i = 0; i < 20000; i++) printf "{ \"id\": %d, \"name\": \"item %d\", \"tags\": [ \"a\", \"b\" ] },\n", i, i
+	printf "{ \"id\": , \"last\": true } ]\n"
+}' > "$SCRATCH/in"
+for mode in "" --stream --tape --minify "--select /items/2"; do
+	"$1" $mode "$SCRATCH/in" > "$SCRATCH/plain" 2>&1
+	"$1" --pipeline $mode "$SCRATCH/in" > "$SCRATCH/file" 2>&1
+	"$1" --pipeline $mode < "$SCRATCH/in" > "$SCRATCH/pipe" 2>&1
+	cmp -s "$SCRATCH/plain" "$SCRATCH/file" && cmp -s "$SCRATCH/plain" "$SCRATCH/pipe" && echo "--pipeline${mode:+ $mode}: same"
+done
+"$1" --pipeline < "$SCRATCH/in" | grep "^#"
@@ -0,0 +1,9 @@
+# --select resolves a repeated key by the --duplicates policy, as the DOM
+# does: last by default, so the later value takes the place of the first.
+doc='{ "a": 1, "b": { "x": 1 }, "c": [ 1 ], "b": { "y": 2 }, "a": 2, "d": [ { "k": 1, "k": 3 } ] }'
+for policy in last first all; do
+	for p in /a /b/x "/*" "/d/*/k"; do
+		echo "--duplicates $policy --select $p"
+		echo "$doc" | "$1" --minify --duplicates $policy --select "$p"
+	done
+done
@@ -0,0 +1,31 @@
+# Snapshots which are truncated or corrupted are rejected when opened,
+# rather than read out of bounds or followed in a loop. Offsets assume a
+# little-endian snapshot, as the byte order check does.
+cd "$SCRATCH"
+echo '{ "a": [ 1, 2 ], "b": "x" }' > doc
+awk 'BEGIN { printf "{"; for (i = 0; i < 20; i++) printf "%s\"k%02d\": %d", (i ? ", " : ""), i, i; printf "}\n" }' > wide
+"$1" --save-snapshot good.snap doc > /dev/null
+"$1" --key-index --save-snapshot wide.snap wide > /dev/null
+
+header() {
+	od -An -t u8 -j $2 -N 8 $1 | tr -d ' '
+}
+patch() {
+	cp $1 $2
+	printf "$4" | dd of=$2 bs=1 seek=$3 conv=notrunc 2> /dev/null
+}
+
+tape=$(header good.snap 24)
+keys=$(header wide.snap 72)
+head -c 100 good.snap > truncated.snap
+patch good.snap string.snap $((tape + 8)) '\377\377\377\377'
+patch good.snap jump.snap $((tape + 16)) '\000'
+patch wide.snap key.snap $keys '\377\377\377\377'
+patch wide.snap value.snap $((keys + 8)) '\000'
+
+for snap in good truncated string jump key value; do
+	echo "$snap:"
+	"$1" --minify --snapshot --select /b $snap.snap 2>&1
+	echo "exit status $?"
+done
+"$1" --minify --snapshot --select /k07 wide.snap
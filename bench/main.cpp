@@ -0,0 +1,412 @@
+//
+//  main.cpp
+//  jsonbench
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <chrono>
+#include "JSON.h"
+#include "Corpus.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Stages																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	NullHandler
+ *
+ *		SAX handler which only counts values, to time the parser alone
+ */
+
+class NullHandler: public BasicJSONParser<NullHandler>
+{
+	public:
+		size_t			values;
+		
+						NullHandler() : values(0)
+							{
+							}
+		
+		void			null()						{ ++values; }
+		void			boolean(bool)				{ ++values; }
+		void			integer(int64_t)			{ ++values; }
+		void			real(double)				{ ++values; }
+		void			string(std::string_view)	{ ++values; }
+		void			startArray()				{ ++values; }
+		void			endArray()					{ }
+		void			startObject()				{ ++values; }
+		void			endObject()					{ }
+		void			objectKey(std::string_view)	{ }
+};
+
+/*	Input
+ *
+ *		The input for one shape: the whole buffer, and the documents in it
+ *	(one, or one per line for NDJSON).
+ */
+
+struct Input
+{
+	std::string		data;
+	std::vector<std::string_view> docs;
+	size_t			values;
+	size_t			tokens;
+	size_t			warnings;
+};
+
+/*	Stage
+ *
+ *		Best time of a stage
+ */
+
+enum Stage {
+	StageLex,
+	StageSAX,
+	StageDOM,
+	StageFormat,
+	StageEndToEnd,
+	
+	StageCount
+};
+
+static const char *GStageNames[StageCount] = {
+	"lex", "sax", "dom", "format", "end_to_end"
+};
+
+/*	Bench
+ *
+ *		State kept between runs of the stages, so that only the work being
+ *	measured is timed
+ */
+
+struct Bench
+{
+	JSONArena		arena;
+	JSONKeyTable	keys;
+	JSONArena		formatArena;		/* documents for the format stage */
+	JSONKeyTable	formatKeys;
+	std::vector<JSONNode *> formatDocs;
+	JSONMemoryWriter out;
+	size_t			sink;				/* keeps results live */
+	
+					Bench() : out(4*1024*1024), sink(0)
+						{
+						}
+};
+
+/*	RunStage
+ *
+ *		Run a stage over every document in the input once
+ */
+
+static void RunStage(Stage stage, Input &in, Bench &b)
+{
+	std::vector<std::string_view>::iterator iter;
+	
+	switch (stage) {
+		case StageLex: {
+			JSONLexer lexer(in.data.data(),in.data.size());
+			size_t n = 0;
+			while (lexer.readToken() != -1) ++n;
+			b.sink += n;
+			break;
+		}
+		case StageSAX: {
+			NullHandler h;
+			for (iter = in.docs.begin(); iter != in.docs.end(); ++iter) {
+				JSONLexer lexer(iter->data(),iter->size());
+				h.errors.clear();
+				h.parse(&lexer,true);
+			}
+			b.sink += h.values;
+			break;
+		}
+		case StageDOM:
+			b.arena.reset();
+			b.keys.clear();
+			for (iter = in.docs.begin(); iter != in.docs.end(); ++iter) {
+				JSONLexer lexer(iter->data(),iter->size());
+				JSONRecordParser parser(&b.arena,&b.keys);
+				parser.setBorrowStrings(true);
+				b.sink += (parser.parse(&lexer) != NULL);
+			}
+			break;
+		case StageFormat:
+			b.out.clear();
+			for (size_t i = 0; i < b.formatDocs.size(); ++i) {
+				if (b.formatDocs[i]) JSONFormat(b.formatDocs[i],&b.out);
+				b.out.put('\n');
+				if (b.out.size() > 64*1024*1024) b.out.clear();
+			}
+			b.sink += b.out.size();
+			break;
+		default:
+			b.out.clear();
+			b.arena.reset();
+			b.keys.clear();
+			for (iter = in.docs.begin(); iter != in.docs.end(); ++iter) {
+				JSONLexer lexer(iter->data(),iter->size());
+				JSONRecordParser parser(&b.arena,&b.keys);
+				parser.setBorrowStrings(true);
+				JSONNode *node = parser.parse(&lexer);
+				if (node) JSONFormat(node,&b.out);
+				b.out.put('\n');
+				if (b.out.size() > 64*1024*1024) b.out.clear();
+			}
+			b.sink += b.out.size();
+			break;
+	}
+}
+
+/*	TimeStage
+ *
+ *		Return the best time in seconds over the given number of runs
+ */
+
+static double TimeStage(Stage stage, Input &in, Bench &b, int iterations)
+{
+	double best = 0;
+	
+	for (int i = 0; i < iterations; ++i) {
+		std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+		RunStage(stage,in,b);
+		std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+		if ((i == 0) || (t.count() < best)) best = t.count();
+	}
+	return best;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Input																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	Prepare
+ *
+ *		Split the input into documents, count what is in it, and build the
+ *	documents the format stage formats.
+ */
+
+static void Prepare(CorpusShape shape, Input &in, Bench &b)
+{
+	const char *p = in.data.data();
+	const char *e = p + in.data.size();
+	
+	in.docs.clear();
+	if (Corpus::isLines(shape)) {
+		while (p < e) {
+			const char *nl = (const char *)memchr(p,'\n',e - p);
+			if (nl == NULL) nl = e;
+			if (nl > p) in.docs.push_back(std::string_view(p,nl - p));
+			p = nl + 1;
+		}
+	} else {
+		in.docs.push_back(std::string_view(p,e - p));
+	}
+	
+	JSONLexer lexer(in.data.data(),in.data.size());
+	in.tokens = 0;
+	while (lexer.readToken() != -1) ++in.tokens;
+	
+	in.values = 0;
+	in.warnings = 0;
+	b.formatArena.reset();
+	b.formatKeys.clear();
+	b.formatDocs.clear();
+	
+	std::vector<std::string_view>::iterator iter;
+	for (iter = in.docs.begin(); iter != in.docs.end(); ++iter) {
+		JSONLexer l1(iter->data(),iter->size());
+		NullHandler h;
+		h.parse(&l1,true);
+		in.values += h.values;
+		in.warnings += h.errors.size();
+		
+		JSONLexer l2(iter->data(),iter->size());
+		JSONRecordParser parser(&b.formatArena,&b.formatKeys);
+		parser.setBorrowStrings(true);
+		b.formatDocs.push_back(parser.parse(&l2));
+	}
+}
+
+/*	KernelName
+ *
+ *		Name of the stage 1 scanner kernel in use
+ */
+
+static const char *KernelName()
+{
+	switch (JSONScanner::kernel()) {
+		case JSONScanAVX2:
+			return "avx2";
+		case JSONScanSSE2:
+			return "sse2";
+		default:
+			return "scalar";
+	}
+}
+
+/*	MakeDirectory
+ *
+ *		Create the directory and any missing parents, as mkdir -p does.
+ *	Returns false if it could not be created.
+ */
+
+static bool MakeDirectory(const std::string &path)
+{
+	struct stat st;
+	
+	for (size_t pos = path.find('/',1); pos != std::string::npos; pos = path.find('/',pos + 1)) {
+		mkdir(path.substr(0,pos).c_str(),0777);
+	}
+	mkdir(path.c_str(),0777);
+	return (stat(path.c_str(),&st) == 0) && S_ISDIR(st.st_mode);
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Run benchmarks															*/
+/*																			*/
+/****************************************************************************/
+
+/*	Usage
+ *
+ *		Print the options
+ */
+
+static void Usage()
+{
+	fprintf(stderr,"usage: jsonbench [options]\n"
+		"  --size MB          bytes of each shape to generate (default 16)\n"
+		"  --iterations N     runs of each stage; the best is reported (default 5)\n"
+		"  --seed N           corpus seed (default 1)\n"
+		"  --shape NAME       only this shape; may be repeated\n"
+		"  --out FILE         write the results to FILE instead of stdout\n"
+		"  --write DIR        write the corpus to DIR and exit\n"
+		"shapes: numbers strings nested wide ndjson malformed\n");
+	exit(1);
+}
+
+int main(int argc, const char * argv[])
+{
+	size_t size = 16;
+	int iterations = 5;
+	uint64_t seed = 1;
+	const char *outPath = NULL;
+	const char *writeDir = NULL;
+	bool selected[CorpusShapeCount] = { false };
+	bool any = false;
+	
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i],"--size") && (i + 1 < argc)) {
+			size = strtoull(argv[++i],NULL,10);
+		} else if (!strcmp(argv[i],"--iterations") && (i + 1 < argc)) {
+			iterations = atoi(argv[++i]);
+		} else if (!strcmp(argv[i],"--seed") && (i + 1 < argc)) {
+			seed = strtoull(argv[++i],NULL,10);
+		} else if (!strcmp(argv[i],"--out") && (i + 1 < argc)) {
+			outPath = argv[++i];
+		} else if (!strcmp(argv[i],"--write") && (i + 1 < argc)) {
+			writeDir = argv[++i];
+		} else if (!strcmp(argv[i],"--shape") && (i + 1 < argc)) {
+			const char *name = argv[++i];
+			int s;
+			for (s = 0; s < CorpusShapeCount; ++s) {
+				if (!strcmp(name,Corpus::name((CorpusShape)s))) break;
+			}
+			if (s == CorpusShapeCount) Usage();
+			selected[s] = true;
+			any = true;
+		} else {
+			Usage();
+		}
+	}
+	if ((size == 0) || (iterations < 1)) Usage();
+	if (!any) {
+		for (int s = 0; s < CorpusShapeCount; ++s) selected[s] = true;
+	}
+	
+	/*
+	 *	With --write just generate the files, so other tools (or another
+	 *	release of prettyjson) can be run on the same input.
+	 */
+	
+	if (writeDir) {
+		if (!MakeDirectory(writeDir)) {
+			fprintf(stderr,"Unable to create %s: %s\n",writeDir,strerror(errno));
+			exit(1);
+		}
+		for (int s = 0; s < CorpusShapeCount; ++s) {
+			if (!selected[s]) continue;
+			
+			CorpusShape shape = (CorpusShape)s;
+			Corpus corpus(seed);
+			std::string data = corpus.generate(shape,size * 1024 * 1024);
+			
+			char path[1024];
+			snprintf(path,sizeof(path),"%s/%s.%s",writeDir,Corpus::name(shape),Corpus::isLines(shape) ? "ndjson" : "json");
+			FILE *f = fopen(path,"wb");
+			if ((f == NULL) || (fwrite(data.data(),1,data.size(),f) != data.size())) {
+				fprintf(stderr,"Unable to write %s: %s\n",path,strerror(errno));
+				exit(1);
+			}
+			fclose(f);
+		}
+		return 0;
+	}
+	
+	FILE *out = stdout;
+	if (outPath && ((out = fopen(outPath,"w")) == NULL)) {
+		fprintf(stderr,"Unable to open %s\n",outPath);
+		exit(1);
+	}
+	
+	/*
+	 *	Results are written as JSON, one object per shape with the input
+	 *	counts and the time of each stage. A summary goes to stderr.
+	 */
+	
+	Bench b;
+	bool first = true;
+	
+	fprintf(out,"{\n\t\"benchmark\": \"jsonbench\",\n\t\"version\": 1,\n\t\"scanner\": \"%s\",\n",KernelName());
+	fprintf(out,"\t\"seed\": %llu,\n\t\"iterations\": %d,\n\t\"shapes\": {",(unsigned long long)seed,iterations);
+	
+	for (int s = 0; s < CorpusShapeCount; ++s) {
+		if (!selected[s]) continue;
+		
+		CorpusShape shape = (CorpusShape)s;
+		Corpus corpus(seed);
+		Input in;
+		in.data = corpus.generate(shape,size * 1024 * 1024);
+		Prepare(shape,in,b);
+		
+		fprintf(out,"%s\n\t\t\"%s\": {\n",first ? "" : ",",Corpus::name(shape));
+		fprintf(out,"\t\t\t\"bytes\": %zu,\n\t\t\t\"documents\": %zu,\n\t\t\t\"values\": %zu,\n\t\t\t\"tokens\": %zu,\n\t\t\t\"warnings\": %zu",
+				in.data.size(),in.docs.size(),in.values,in.tokens,in.warnings);
+		fprintf(stderr,"%-10s %6.1f MB",Corpus::name(shape),in.data.size() / 1e6);
+		first = false;
+		
+		for (int st = 0; st < StageCount; ++st) {
+			double t = TimeStage((Stage)st,in,b,iterations);
+			double mbs = (t > 0) ? in.data.size() / t / 1e6 : 0;
+			double nsv = in.values ? t * 1e9 / in.values : 0;
+			
+			fprintf(out,",\n\t\t\t\"%s\": { \"seconds\": %.6f, \"mb_per_s\": %.1f, \"ns_per_value\": %.2f }",GStageNames[st],t,mbs,nsv);
+			fprintf(stderr,"  %s %.0f MB/s",GStageNames[st],mbs);
+		}
+		fprintf(out,"\n\t\t}");
+		fprintf(stderr,"\n");
+	}
+	
+	fprintf(out,"\n\t}\n}\n");
+	if (out != stdout) fclose(out);
+	
+	return (b.sink == 0);		/* never true; keeps the work from being optimized away */
+}
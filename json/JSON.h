@@ -9,10 +9,18 @@
 #define JSON_h
 
 #include <stdio.h>
+#include <string.h>
 #include <string>
 #include <vector>
-#include <map>
+#include <string_view>
 #include <stdint.h>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <functional>
+#include <unordered_set>
+#include <condition_variable>
 
 /****************************************************************************/
 /*																			*/
@@ -35,267 +43,3145 @@
 #define STRING		256
 #define TOKEN		257
 #define NUMBER		258
+#define LIMIT		259			/* a JSONLimits limit was exceeded */
+#define MORE		260			/* push input is waiting for more data */
 
 /****************************************************************************/
 /*																			*/
-/*	JSON Parser																*/
+/*	Statistics																*/
 /*																			*/
 /****************************************************************************/
 
-/*	JSONLexer
+class JSONWriter;
+class JSONDiagnostics;
+
+/*	JSONType
  *
- *		JSON Lexer engine
+ *		Type declaration
  */
+ 
+enum JSONType {
+	JSONTypeObject,
+	JSONTypeArray,
+	JSONTypeString,
+	JSONTypeNumber,
+	JSONTypeBoolean,
+	JSONTypeNull
+};
 
-class JSONLexer
-{
-	public:
-						JSONLexer(FILE *f);
-						~JSONLexer();
-	
-		int				readToken();
-		void			pushToken()
-							{
-								pushBack = true;
-							}
-						
-		
-		std::string		token;
-		uint32_t		getLine()
-							{
-								return line;
-							}
+/*	JSONPhase
+ *
+ *		The phases of a run which are timed separately
+ */
 
-	private:
-		FILE			*file;
-		uint32_t		line;
-		
-		uint8_t			pos;
-		uint8_t			stack[8];
-		
-		int				readChar();
-		void			pushChar(int ch);
-		
-		bool			pushBack;
-		int				lastToken;
+enum JSONPhase {
+	JSONPhaseOther,				/* time outside any other phase */
+	JSONPhaseRead,
+	JSONPhaseParse,
+	JSONPhaseFormat,
+	JSONPhaseWrite,
+	JSONPhaseFree,
+	
+	JSONPhaseCount
 };
 
-/*	JSONError
+/*	JSONStats
  *
- *		Encapsulates a parser error
+ *		Statistics for a run, to show where the time goes. Parsers, lexers
+ *	and writers given a JSONStats with setStats() count into it; without
+ *	one, all it costs is a test for NULL. The parser hands its JSONStats to
+ *	the lexer it reads from.
+ *
+ *		Phases nest, and time is charged to the innermost phase, so input
+ *	read by the lexer in the middle of a parse counts as reading. Lexing
+ *	and building the DOM happen token by token, and are timed together as
+ *	parsing.
+ *
+ *		A JSONStats belongs to one thread. Workers count into their own,
+ *	which are merged into the caller's; merging adds the counts but not the
+ *	times, which are the caller's own.
+ *
+ *		Heap allocations are counted by allocation() and release(), which
+ *	are called from the arena and may be called from a program's operator
+ *	new and delete. They are counted across all threads once
+ *	setCountAllocations(true) is called.
  */
 
-class JSONError
+class JSONStats
 {
 	public:
-						JSONError(long l, bool w, std::string s) : line(l), warning(w), str(s)
+						JSONStats();
+		
+		void			enter(JSONPhase phase);
+		void			leave();
+		
+		void			value(JSONType type)
 							{
+								++nodes[type];
 							}
-							
-		bool			isWarning()
+		void			depth(size_t d)
 							{
-								return warning;
+								if (d > maxDepth) maxDepth = d;
 							}
-	
-		long			getLine()
+		void			input(uint64_t b, uint64_t t)
 							{
-								return line;
+								bytesIn += b;
+								tokens += t;
 							}
-		std::string		getError()
+		void			output(uint64_t b)
 							{
-								return str;
+								bytesOut += b;
 							}
-							
-	private:
-		bool			warning;
-		long			line;
-		std::string		str;
-};
-
-/*	JSONParser
- *
- *		JSON Parser and syntax checker
- */
- 
-class JSONParser
-{
-	public:
-						JSONParser();
-		virtual			~JSONParser();
-						
-		bool			parse(JSONLexer *lexer, bool warnings);
+		void			merge(const JSONStats &s);
+		void			clear();
+		
+		void			report(JSONWriter *out, const JSONDiagnostics *errors, bool asJSON);
 		
 		/*
-		 *	SAX-like interface
+		 *	Allocation counting
 		 */
 		
-		virtual void	null() = 0;
-		virtual void	boolean(bool value) = 0;
-		virtual void	integer(int64_t value) = 0;
-		virtual void	real(double value) = 0;
-		virtual void	string(std::string &value) = 0;
+		static void		setCountAllocations(bool flag)
+							{
+								countAllocations.store(flag,std::memory_order_relaxed);
+							}
+		static void		allocation(size_t size)
+							{
+								if (countAllocations.load(std::memory_order_relaxed)) {
+									allocations.fetch_add(1,std::memory_order_relaxed);
+									allocated.fetch_add(size,std::memory_order_relaxed);
+								}
+							}
+		static void		release()
+							{
+								if (countAllocations.load(std::memory_order_relaxed)) {
+									releases.fetch_add(1,std::memory_order_relaxed);
+								}
+							}
 		
-		virtual void	startArray() = 0;
-		virtual void	endArray() = 0;
+		static uint64_t	peakRSS();
 		
-		virtual void	startObject() = 0;
-		virtual void	endObject() = 0;
-		virtual void	objectKey(std::string &value) = 0;
-
-		/*
-		 *	Found errors
-		 */
+		uint64_t		bytesIn;
+		uint64_t		bytesOut;
+		uint64_t		tokens;
+		uint64_t		nodes[JSONTypeNull + 1];	/* by JSONType */
+		size_t			maxDepth;
+		double			wall[JSONPhaseCount];		/* seconds */
+		double			cpu[JSONPhaseCount];		/* seconds, all threads */
 		
-		std::vector<JSONError> errors;
+	private:
+		void			charge();
 		
-	protected:
-		void			warn(const char *msg, ...);
-		void			error(const char *msg, ...);
+		std::vector<JSONPhase> phases;	/* entered and not yet left */
+		JSONPhase		current;
+		double			lastWall;
+		double			lastCPU;
+		
+		static std::atomic<bool> countAllocations;
+		static std::atomic<uint64_t> allocations;
+		static std::atomic<uint64_t> allocated;
+		static std::atomic<uint64_t> releases;
+};
 
-	private:
-		bool			parseObject();
-		bool			parseArray();
-		bool			parseValue();
+/*	JSONStatsPhase
+ *
+ *		Times the scope it is declared in as a phase, if stats is not NULL
+ */
+
+class JSONStatsPhase
+{
+	public:
+						JSONStatsPhase(JSONStats *s, JSONPhase phase) : stats(s)
+							{
+								if (stats) stats->enter(phase);
+							}
+						~JSONStatsPhase()
+							{
+								if (stats) stats->leave();
+							}
 		
-		JSONLexer		*lexer;
-		bool			warnings;
+	private:
+		JSONStats		*stats;
 };
 
 /****************************************************************************/
 /*																			*/
-/*	DOM Parser																*/
+/*	JSON Parser																*/
 /*																			*/
 /****************************************************************************/
 
-/*	JSONType
+/*	JSONInput
  *
- *		Type declaration
+ *		Input source for the lexer. An input source hands the lexer contiguous
+ *	blocks of bytes; a block returned by read() remains valid until the next
+ *	call to read(), or for the lifetime of the input if isPersistent() is
+ *	true. A return value of 0 indicates end of file, unless isWaiting() is
+ *	true, in which case more data may arrive later.
  */
- 
-enum JSONType {
-	JSONTypeObject,
-	JSONTypeArray,
-	JSONTypeString,
-	JSONTypeNumber,
-	JSONTypeBoolean,
-	JSONTypeNull
+
+class JSONInput
+{
+	public:
+						JSONInput();
+		virtual			~JSONInput();
+		
+		virtual size_t	read(const uint8_t **data) = 0;
+		virtual bool	isPersistent();
+		virtual bool	isWaiting();
 };
 
-/*	JSONNode
+/*	JSONOpenInput
  *
- *		Each potential value in our json object is represented by a node
+ *		Return a memory mapped input for regular files, or a block reading
+ *	input for anything else. The caller owns the returned input.
  */
 
-class JSONNode
+extern JSONInput *JSONOpenInput(int fd);
+
+/*	JSONMemoryInput
+ *
+ *		Reads from an in-memory buffer. The buffer is not copied, and must
+ *	remain valid for the lifetime of the input.
+ */
+
+class JSONMemoryInput: public JSONInput
 {
 	public:
-						JSONNode();
-		virtual			~JSONNode();
-						
-		virtual JSONType type() = 0;
+						JSONMemoryInput(const void *data, size_t length);
+						~JSONMemoryInput();
+		
+		size_t			read(const uint8_t **data);
+		bool			isPersistent();
+		
+	private:
+		const uint8_t	*buffer;
+		size_t			length;
+		bool			done;
 };
 
-class JSONObject: public JSONNode, public std::map<std::string, JSONNode *>
+/*	JSONMappedInput
+ *
+ *		Memory maps a regular file and returns its contents as a single block.
+ *	If the file cannot be mapped, isValid() returns false.
+ */
+
+class JSONMappedInput: public JSONInput
 {
 	public:
-						JSONObject();
-						~JSONObject();
-	
-		JSONType		type();
+						JSONMappedInput(int fd);
+						~JSONMappedInput();
+		
+		bool			isValid()
+							{
+								return valid;
+							}
+		size_t			read(const uint8_t **data);
+		bool			isPersistent();
+		
+	private:
+		void			*map;
+		size_t			mapLength;
+		size_t			offset;
+		bool			valid;
+		bool			done;
 };
 
-class JSONArray: public JSONNode, public std::vector<JSONNode *>
+/*	JSONReadInput
+ *
+ *		Reads from a file descriptor in large blocks using read(2). This is
+ *	used for pipes and stdin, which cannot be memory mapped.
+ */
+
+class JSONReadInput: public JSONInput
 {
 	public:
-						JSONArray();
-						~JSONArray();
-	
-		JSONType		type();
+						JSONReadInput(int fd, size_t blockSize = 1024*1024);
+						~JSONReadInput();
+		
+		size_t			read(const uint8_t **data);
+		
+	private:
+		int				fd;
+		uint8_t			*buffer;
+		size_t			blockSize;
 };
 
-class JSONString: public JSONNode, public std::string
+/*	JSONStdioInput
+ *
+ *		Reads from a stdio FILE in large blocks using fread. This honors any
+ *	data already buffered by stdio.
+ */
+
+class JSONStdioInput: public JSONInput
 {
 	public:
-						JSONString();
-						JSONString(std::string &val);
-						~JSONString();
-	
-		JSONType		type();
+						JSONStdioInput(FILE *f, size_t blockSize = 256*1024);
+						~JSONStdioInput();
+		
+		size_t			read(const uint8_t **data);
+		
+	private:
+		FILE			*file;
+		uint8_t			*buffer;
+		size_t			blockSize;
 };
 
-class JSONNumber: public JSONNode
+/*	JSONPushInput
+ *
+ *		Input pushed to us a block at a time, as it arrives from a socket.
+ *	Only the complete tokens in a block are handed to the lexer; the partial
+ *	token at the end (the start of a string, number or word) is copied and
+ *	carried over, ahead of the next block. So the lexer never stops in the
+ *	middle of a token, and it returns MORE rather than EOF until finish()
+ *	is called. A pushed block need only remain valid until it is consumed.
+ */
+
+class JSONPushInput: public JSONInput
 {
 	public:
-						JSONNumber(int64_t value);
-						JSONNumber(double value);
-						JSONNumber(bool value);
-						~JSONNumber();
-						
-		JSONType		type();
-		bool			isIntegerValue()
+						JSONPushInput();
+						~JSONPushInput();
+		
+		void			push(const uint8_t *data, size_t length);
+		void			finish();
+		size_t			pending()
 							{
-								return isInteger;
+								return carry.size();
 							}
 		
-		int64_t			intValue();
-		double			realValue();
-		bool			boolValue();
-	
+		size_t			read(const uint8_t **data);
+		bool			isWaiting();
+		
 	private:
-		bool			isBoolean;
-		bool			isInteger;
-		union {
-			bool		bvalue;
-			int64_t		ivalue;
-			double		rvalue;
-		} u;
+		void			scan(const uint8_t *p, const uint8_t *e, bool findCut);
+		
+		std::string		carry;			/* partial token at the end of the input */
+		std::string		head;			/* partial token being handed to the lexer */
+		const uint8_t	*block;
+		size_t			length;
+		int				next;			/* 0: head, 1: block, 2: nothing */
+		
+		const uint8_t	*skip;			/* byte escaped by a backslash */
+		const uint8_t	*cut;			/* end of the last complete token */
+		bool			inString;
+		bool			escaped;		/* the next block starts escaped */
+		bool			finished;
 };
 
-class JSONNull: public JSONNode
+/*	JSONScanner
+ *
+ *		Stage 1 structural scanner. This classifies 64 byte blocks of input
+ *	into bitmasks, with bit N of each mask describing byte N of the block.
+ *	SSE2 and AVX2 kernels are selected at runtime based on the processor,
+ *	with a scalar fallback elsewhere. setKernel() may be called while other
+ *	threads are scanning; each call to classify() uses one kernel throughout.
+ *
+ *		The lexer uses the masks only to step over whitespace and the bodies
+ *	of strings. Structure is still found token by token by the lexer.
+ *
+ *		plain() uses the same kernels to find the run of string text which
+ *	the writer can copy without escaping (see JSONWriter::string).
+ */
+
+enum JSONScanKernel {
+	JSONScanAuto,
+	JSONScanScalar,
+	JSONScanSSE2,
+	JSONScanAVX2
+};
+
+struct JSONBlockMasks
+{
+	uint64_t		whitespace;
+	uint64_t		structural;		/* {}[]:, */
+	uint64_t		quote;
+	uint64_t		backslash;
+	uint64_t		newline;
+};
+
+class JSONScanner
 {
 	public:
-						JSONNull();
-						~JSONNull();
+		static void		classify(const uint8_t *p, JSONBlockMasks *m);
+		static void		classify(const uint8_t *p, size_t len, JSONBlockMasks *m);
+		static size_t	plain(const uint8_t *p, size_t len);
+		
+		static JSONScanKernel kernel();
+		static JSONScanKernel setKernel(JSONScanKernel k);
+};
+
+/*	JSONNumberToken
+ *
+ *		The value of a NUMBER token, accumulated by the lexer as the digits
+ *	are scanned. The value is mantissa * 10^exponent; the mantissa holds at
+ *	most 19 significant digits, and truncated is set if nonzero digits were
+ *	dropped after those.
+ */
+
+struct JSONNumberToken
+{
+	uint64_t		mantissa;
+	int32_t			exponent;
+	int32_t			digits;			/* significant digits in mantissa */
+	bool			negative;
+	bool			isReal;			/* has a fraction or an exponent */
+	bool			truncated;
+};
+
+extern bool JSONTokenToInteger(const JSONNumberToken &num, int64_t *value);
+extern double JSONTokenToReal(const JSONNumberToken &num, const char *text);
+
+extern char *JSONWriteInteger(char *buf, int64_t value);
+extern char *JSONWriteReal(char *buf, double value);
+
+/*	JSONLimits
+ *
+ *		Limits for parsing untrusted input. A limit of 0 means no limit. The
+ *	string length limit applies to every token, so it also bounds numbers
+ *	and bare words. When a limit is exceeded the parser reports an error
+ *	and stops.
+ *
+ *		Nothing is limited by default, so valid input parses as it did before
+ *	limits were added. Nothing recurses per level of nesting either (the
+ *	parser, formatters, DOM teardown and snapshot builder all keep stacks of
+ *	their own), so maxDepth only bounds the memory untrusted input can claim.
+ */
+
+enum JSONLimit {
+	JSONLimitNone,
+	JSONLimitDepth,
+	JSONLimitString,
+	JSONLimitTokens,
+	JSONLimitBytes
+};
+
+struct JSONLimits
+{
+	size_t			maxDepth;
+	size_t			maxStringLength;
+	size_t			maxTokens;
+	size_t			maxBytes;
 	
-		JSONType		type();
+					JSONLimits() : maxDepth(0), maxStringLength(0), maxTokens(0), maxBytes(0)
+						{
+						}
 };
 
-/*	JSONRecordParser
+/*	JSONLexer
  *
- *		Parse into a JSON object
+ *		JSON Lexer engine. The text of the last token is returned by text().
+ *	A string without escapes which lies within one input block is returned
+ *	as a view of the block rather than copied into token; if the input is
+ *	persistent, isBorrowed() is true and the view stays valid for the life
+ *	of the input. Otherwise the text is only valid until the next token.
  */
 
-class JSONRecordParser: public JSONParser
+class JSONLexer
 {
 	public:
-						JSONRecordParser();
-		virtual			~JSONRecordParser();
+						JSONLexer(FILE *f);
+						JSONLexer(int fd);
+						JSONLexer(const void *data, size_t length);
+						JSONLexer(JSONInput *input);
+						~JSONLexer();
+	
+		int				readToken();
+		void			pushToken()
+							{
+								pushBack = true;
+							}
+						
 		
-		JSONNode		*parse(JSONLexer *lexer);
+		std::string		token;
+		JSONNumberToken	number;			/* value of a NUMBER token */
+		
+		std::string_view text()
+							{
+								return view.data() ? view : std::string_view(token);
+							}
+		bool			isBorrowed()
+							{
+								return borrowed;
+							}
 		
 		/*
-		 *	Interface
+		 *	Lexer limits. Once one is exceeded, readToken() returns LIMIT
+		 *	and getLimit() says which.
 		 */
 		
-		void			null();
-		void			boolean(bool value);
-		void			integer(int64_t value);
-		void			real(double value);
-		void			string(std::string &value);
-		
-		void			startArray();
-		void			endArray();
+		void			setLimits(const JSONLimits &limits);
+		JSONLimit		getLimit()
+							{
+								return limitHit;
+							}
+		
+		uint32_t		getLine()
+							{
+								return line;
+							}
+		void			setLine(uint32_t l)
+							{
+								line = l;
+							}
+		
+		/*
+		 *	Byte offset and column of the current position, for diagnostics.
+		 *	setOffset() gives the position of the start of the input within
+		 *	a larger document.
+		 */
+		
+		uint64_t		getOffset()
+							{
+								return base + bytes - (end - cur);
+							}
+		uint32_t		getColumn();
+		void			setOffset(uint64_t offset, uint32_t column)
+							{
+								base = offset;
+								blockColumn = column;
+							}
+		bool			skipTo(uint64_t offset);
+		
+		/*
+		 *	Step over the rest of the array or object whose open bracket was
+		 *	the last token, by balancing brackets outside strings, without
+		 *	reading the tokens in it. Returns false if the input ends first.
+		 */
+		
+		bool			skipValue();
+		
+		/*
+		 *	Use the stage 1 scanner to skip whitespace and string contents.
+		 *	This is on by default when a vector kernel is available.
+		 */
+		
+		void			setScanner(bool flag)
+							{
+								useScanner = flag;
+								winLen = 0;
+							}
+		
+		/*
+		 *	Input read, and tokens returned, so far. The time spent reading
+		 *	input is charged to stats.
+		 */
+		
+		uint64_t		getByteCount()
+							{
+								return bytes;
+							}
+		size_t			getTokenCount()
+							{
+								return tokens;
+							}
+		void			setStats(JSONStats *s)
+							{
+								stats = s;
+							}
+
+	private:
+		JSONInput		*input;
+		bool			ownsInput;
+		bool			persistent;
+		uint32_t		line;
+		
+		std::string_view view;			/* string text in the input block */
+		bool			borrowed;
+		
+		size_t			maxString;
+		size_t			maxTokens;
+		size_t			maxBytes;
+		size_t			tokens;
+		size_t			bytes;
+		bool			clipped;		/* block cut short at maxBytes */
+		JSONLimit		limitHit;
+		
+		const uint8_t	*cur;
+		const uint8_t	*end;
+		bool			eof;
+		
+		uint64_t		base;			/* offset of the start of the input */
+		const uint8_t	*blockStart;
+		uint32_t		blockColumn;	/* column of blockStart */
+		const uint8_t	*colScan;		/* searched for newlines up to here */
+		const uint8_t	*colLine;		/* start of the line at colScan */
+		
+		bool			useScanner;
+		const uint8_t	*winStart;
+		size_t			winLen;
+		JSONBlockMasks	win;
+		
+		JSONStats		*stats;
+		
+		void			init();
+		bool			fill();
+		void			loadWindow();
+		const uint8_t	*runEnd()
+							{
+								if (maxString == 0) return end;
+								size_t room = (token.size() < maxString) ? maxString + 1 - token.size() : 1;
+								return ((size_t)(end - cur) > room) ? cur + room : end;
+							}
+		bool			tooLong(size_t len)
+							{
+								if (maxString && (len > maxString)) {
+									limitHit = JSONLimitString;
+									return true;
+								}
+								return false;
+							}
+		void			scanDigits(bool fraction);
+		void			scanExponent();
+		int				readChar()
+							{
+								if ((cur < end) || fill()) {
+									int ret = *cur++;
+									if (ret == '\n') ++line;
+									return ret;
+								}
+								return -1;
+							}
+		int				peekChar()
+							{
+								if ((cur < end) || fill()) return *cur;
+								return -1;
+							}
+		
+		bool			pushBack;
+		int				lastToken;
+};
+
+/*	JSONErrorCode
+ *
+ *		What a diagnostic is about. Warnings come first.
+ */
+
+enum JSONErrorCode: uint16_t {
+	JSONWarnUnexpectedToken,		/* text: the token */
+	JSONWarnExpectedKey,
+	JSONWarnExpectedColon,
+	JSONWarnExpectedMemberComma,
+	JSONWarnExpectedValueComma,
+	JSONWarnCloseAfterComma,
+	JSONWarnCloseArray,
+	JSONWarnCloseObject,
+	
+	JSONErrorUnexpectedEOF,
+	JSONErrorIllegalToken,			/* text: the token */
+	JSONErrorDepth,					/* arg: the limit */
+	JSONErrorStringLength,			/* arg: the limit */
+	JSONErrorTokenCount,			/* arg: the limit */
+	JSONErrorInputLength,			/* arg: the limit */
+	JSONErrorUnbalanced,
+	JSONErrorInternal,
+	
+	JSONErrorCodeCount
+};
+
+/*	JSONError
+ *
+ *		A diagnostic found by the parser: a code, where it was found, and an
+ *	argument, either a number or a short piece of text (longer text is cut
+ *	short). The message is only formatted when asked for.
+ */
+
+class JSONError
+{
+	public:
+						JSONError(JSONErrorCode c, uint32_t l, uint32_t col, uint64_t off) :
+								offset(off), record(0), line(l), column(col), code(c), textLength(0)
+							{
+								arg = 0;
+							}
+		
+		JSONErrorCode	getCode() const
+							{
+								return code;
+							}
+		bool			isWarning() const
+							{
+								return code < JSONErrorUnexpectedEOF;
+							}
+		
+		long			getLine() const
+							{
+								return line;
+							}
+		void			setLine(long l)
+							{
+								line = (uint32_t)l;
+							}
+		uint32_t		getColumn() const
+							{
+								return column;
+							}
+		void			setColumn(uint32_t c)
+							{
+								column = c;
+							}
+		uint64_t		getOffset() const
+							{
+								return offset;
+							}
+		
+		/*
+		 *	Record number, for inputs with multiple records (NDJSON). Records
+		 *	are numbered from 1; 0 means the input is a single document.
+		 */
+		
+		long			getRecord() const
+							{
+								return record;
+							}
+		void			setRecord(long r)
+							{
+								record = r;
+							}
+		
+		void			setArgument(uint64_t value)
+							{
+								arg = value;
+							}
+		void			setText(std::string_view text);
+		
+		/*
+		 *	The message. render() writes it to buf without allocating, and
+		 *	returns its length; summary() describes the code in general.
+		 */
+		
+		size_t			render(char *buf, size_t size) const;
+		std::string		getError() const;
+		static const char *summary(JSONErrorCode code);
+		
+	private:
+		uint64_t		offset;
+		long			record;
+		uint32_t		line;
+		uint32_t		column;
+		JSONErrorCode	code;
+		uint8_t			textLength;
+		union {
+			uint64_t	arg;
+			char		text[32];
+		};
+};
+
+/*	JSONDiagnostics
+ *
+ *		The diagnostics from a parse. Every diagnostic is counted by code,
+ *	but with a limit set only the first few of each code are kept, so a
+ *	badly damaged file does not cost more to report on than to parse.
+ *	Clearing keeps the storage, so a parser reused for many documents does
+ *	not allocate for them.
+ */
+
+class JSONDiagnostics: public std::vector<JSONError>
+{
+	public:
+						JSONDiagnostics();
+		
+		void			setLimit(size_t perCode)
+							{
+								limit = perCode;
+							}
+		size_t			getLimit() const
+							{
+								return limit;
+							}
+		
+		/*
+		 *	Count a diagnostic, and return true if it should be kept
+		 */
+		
+		bool			note(JSONErrorCode code)
+							{
+								++counts[code];
+								if (limit && (kept[code] >= limit)) return false;
+								++kept[code];
+								return true;
+							}
+		void			add(const JSONError &e)
+							{
+								if (note(e.getCode())) push_back(e);
+							}
+		void			merge(const JSONDiagnostics &d);
+		void			clear();
+		
+		size_t			getCount(JSONErrorCode code) const
+							{
+								return counts[code];
+							}
+		size_t			getDropped(JSONErrorCode code) const
+							{
+								return counts[code] - kept[code];
+							}
+		
+	private:
+		size_t			limit;			/* kept per code; 0 keeps all */
+		size_t			counts[JSONErrorCodeCount];
+		size_t			kept[JSONErrorCodeCount];
+};
+
+/*	BasicJSONParser
+ *
+ *		JSON Parser and syntax checker. The parser calls the SAX-like
+ *	interface on its Handler, which derives from it (as in
+ *	class MyParser: public BasicJSONParser<MyParser>). The calls are resolved
+ *	at compile time, and can be inlined. The Handler provides:
+ *
+ *		void null();
+ *		void boolean(bool value);
+ *		void integer(int64_t value);
+ *		void real(double value);
+ *		void string(std::string_view value);
+ *		void startArray();
+ *		void endArray();
+ *		void startObject();
+ *		void endObject();
+ *		void objectKey(std::string_view value);
+ *
+ *	and may also provide bool skipContainer(), which is called before each
+ *	array or object. If it returns true the lexer steps over the container
+ *	by balancing brackets, and no callbacks are made for it. Pushed input is
+ *	never skipped.
+ *
+ *		The parser is a state machine over an explicit stack of open
+ *	containers, so deeply nested input cannot overflow the C stack. Input is
+ *	checked against the limits set with setLimits().
+ *
+ *		Input may also be pushed to the parser as it arrives, by calling
+ *	feed() for each block and finish() at the end. Callbacks are made as
+ *	soon as each value is complete, and the parse picks up where it left
+ *	off with the next block. A Handler with state of its own to reset
+ *	provides a startPush() which calls ours; it is called by the first
+ *	feed().
+ */
+
+template <class Handler> class BasicJSONParser
+{
+	public:
+						BasicJSONParser();
+						~BasicJSONParser();
+						
+		bool			parse(JSONLexer *lexer, bool warnings);
+		bool			parseRange(JSONLexer *lexer, bool isObject, bool first, bool last, bool warnings);
+		
+		void			startPush();
+		bool			feed(const char *data, size_t len);
+		bool			finish();
+		
+		bool			skipContainer()
+							{
+								return false;
+							}
+		
+		void			setLimits(const JSONLimits &l)
+							{
+								limits = l;
+							}
+		bool			exceededLimit()
+							{
+								return aborted;
+							}
+		void			setStats(JSONStats *s)
+							{
+								stats = s;
+							}
+		
+		/*
+		 *	Found errors
+		 */
+		
+		JSONDiagnostics	errors;
+		
+	protected:
+		void			warn(JSONErrorCode code, std::string_view text = std::string_view())
+							{
+								if (warnings) report(code,text,0);
+							}
+		void			error(JSONErrorCode code, std::string_view text = std::string_view())
+							{
+								report(code,text,0);
+							}
+		void			error(JSONErrorCode code, uint64_t arg)
+							{
+								report(code,std::string_view(),arg);
+							}
+		
+		/*
+		 *	True if the value passed to string() or objectKey() is a view of
+		 *	persistent input, and may be kept after the callback returns.
+		 */
+		
+		bool			isBorrowed()
+							{
+								return lexer->isBorrowed();
+							}
+
+	private:
+		enum State {
+			StateValue,					/* expecting a value */
+			StateMember,				/* expecting a member or a close */
+			StateColon,					/* expecting the ':' after a key */
+			StateNext					/* expecting a separator or a close */
+		};
+		
+		struct Frame {
+			bool		isObject;
+			bool		tailComma;		/* a separator was seen */
+			bool		success;
+			bool		outer;			/* the container of a parseRange */
+			bool		partial;		/* EOF after a value ends the part */
+		};
+		
+		Handler			&handler()
+							{
+								return *static_cast<Handler *>(this);
+							}
+		
+		void			start(JSONLexer *lexer, bool warnings);
+		void			report(JSONErrorCode code, std::string_view text, uint64_t arg);
+		bool			run(State state);
+		bool			suspend(State state)
+							{
+								resume = state;
+								suspended = true;
+								return false;
+							}
+		bool			overLimit(JSONLimit limit);
+		void			unexpectedEOF();
+		void			counted(JSONType type)
+							{
+								if (stats) stats->value(type);
+							}
+		void			counted()
+							{
+								if (stats) stats->input(lexer->getByteCount(),lexer->getTokenCount());
+							}
+		
+		JSONLexer		*lexer;
+		bool			warnings;
+		bool			sawEOF;
+		bool			rangeEnd;
+		bool			aborted;
+		JSONLimits		limits;
+		std::vector<Frame> stack;
+		JSONStats		*stats;
+		
+		/*
+		 *	Push parsing state
+		 */
+		
+		JSONPushInput	*pushInput;
+		JSONLexer		*pushLexer;
+		State			resume;			/* where run() stopped for more input */
+		bool			suspended;
+		bool			pushing;		/* between the first feed() and finish() */
+		bool			pushDone;		/* the value is complete */
+		bool			pushResult;
+		size_t			pushBytes;
+};
+
+/*	BasicJSONParser::BasicJSONParser
+ *
+ *		Parser
+ */
+
+template <class Handler>
+BasicJSONParser<Handler>::BasicJSONParser()
+{
+	lexer = NULL;
+	warnings = true;
+	sawEOF = false;
+	rangeEnd = false;
+	aborted = false;
+	stats = NULL;
+	
+	pushInput = NULL;
+	pushLexer = NULL;
+	resume = StateValue;
+	suspended = false;
+	pushing = false;
+	pushDone = false;
+	pushResult = false;
+	pushBytes = 0;
+}
+
+template <class Handler>
+BasicJSONParser<Handler>::~BasicJSONParser()
+{
+	delete pushLexer;
+	delete pushInput;
+}
+
+/*	BasicJSONParser::report
+ *
+ *		Record a diagnostic at the current position, unless we already have
+ *	as many of this kind as we keep.
+ */
+
+template <class Handler>
+void BasicJSONParser<Handler>::report(JSONErrorCode code, std::string_view text, uint64_t arg)
+{
+	if (!errors.note(code)) return;
+	
+	errors.push_back(JSONError(code,lexer->getLine(),lexer->getColumn(),lexer->getOffset()));
+	if (text.data()) {
+		errors.back().setText(text);
+	} else {
+		errors.back().setArgument(arg);
+	}
+}
+
+/*	BasicJSONParser::start
+ *
+ *		Reset for a new parse
+ */
+
+template <class Handler>
+void BasicJSONParser<Handler>::start(JSONLexer *l, bool w)
+{
+	lexer = l;
+	warnings = w;
+	sawEOF = false;
+	rangeEnd = false;
+	aborted = false;
+	suspended = false;
+	
+	errors.clear();
+	stack.clear();
+	lexer->setLimits(limits);
+	lexer->setStats(stats);
+}
+
+/*	BasicJSONParser::parse
+ *
+ *		Parse the input file, issuing warnings if the warning flag is set. If
+ *	this returns false, there was a problem parsing the results
+ */
+ 
+template <class Handler>
+bool BasicJSONParser<Handler>::parse(JSONLexer *l, bool w)
+{
+	JSONStatsPhase phase(stats,JSONPhaseParse);
+	
+	start(l,w);
+	bool ok = run(StateValue);
+	counted();
+	return ok;
+}
+
+/*	BasicJSONParser::parseRange
+ *
+ *		Parse the members of part of a container. The parallel parser splits
+ *	a large array or object at the commas between its members; each part
+ *	starts just after the opening bracket (if first is set) or just after a
+ *	comma, and ends just before a comma or (if last is set) runs through the
+ *	closing bracket. Callers supply the enclosing container themselves.
+ *
+ *		Returns false if a part other than the last did not end cleanly at
+ *	a member boundary, which means the split was not where the sequential
+ *	parser would have seen a separator.
+ */
+
+template <class Handler>
+bool BasicJSONParser<Handler>::parseRange(JSONLexer *l, bool isObject, bool first, bool last, bool w)
+{
+	JSONStatsPhase phase(stats,JSONPhaseParse);
+	
+	start(l,w);
+	
+	Frame f = { isObject, !first, true, true, !last };
+	stack.push_back(f);
+	run(StateMember);
+	counted();
+	
+	return !aborted && (last || (rangeEnd && !sawEOF));
+}
+
+/*	BasicJSONParser::startPush
+ *
+ *		Start a new push parse
+ */
+
+template <class Handler>
+void BasicJSONParser<Handler>::startPush()
+{
+	delete pushLexer;
+	delete pushInput;
+	pushInput = new JSONPushInput;
+	pushLexer = new JSONLexer(pushInput);
+	
+	start(pushLexer,true);
+	resume = StateValue;
+	pushing = true;
+	pushDone = false;
+	pushResult = false;
+	pushBytes = 0;
+}
+
+/*	BasicJSONParser::feed
+ *
+ *		Parse the next block of pushed input, making callbacks for every
+ *	value it completes. The block need not remain valid after we return.
+ *	Input after the end of the top level value is ignored. Returns false
+ *	once a limit has been exceeded, since nothing more will be parsed.
+ */
+
+template <class Handler>
+bool BasicJSONParser<Handler>::feed(const char *data, size_t len)
+{
+	if (!pushing) handler().startPush();
+	if (pushDone) return !aborted;
+	
+	JSONStatsPhase phase(stats,JSONPhaseParse);
+	pushInput->push((const uint8_t *)data,len);
+	pushBytes += len;
+	pushResult = run(resume);
+	
+	if (suspended) {
+		/*
+		 *	A token still being carried over is not seen by the lexer, so
+		 *	check it against the limits here. Past the byte limit the input
+		 *	may as well end, and the lexer cuts it off where parse() would.
+		 *	Escapes take up to six bytes per byte of text, so only a carry
+		 *	longer than that is sure to be too long.
+		 */
+		
+		if (limits.maxBytes && (pushBytes > limits.maxBytes)) {
+			pushInput->finish();
+			pushResult = run(resume);
+		} else if (limits.maxStringLength && (pushInput->pending() > 6 * limits.maxStringLength + 2)) {
+			pushResult = overLimit(JSONLimitString);
+		} else {
+			return true;
+		}
+	}
+	
+	pushDone = true;
+	return !aborted;
+}
+
+/*	BasicJSONParser::finish
+ *
+ *		End the pushed input, and finish the parse. Returns the same result
+ *	parse() would have for the input as a whole.
+ */
+
+template <class Handler>
+bool BasicJSONParser<Handler>::finish()
+{
+	if (!pushing) handler().startPush();
+	if (!pushDone) {
+		JSONStatsPhase phase(stats,JSONPhaseParse);
+		pushInput->finish();
+		pushResult = run(resume);
+	}
+	
+	counted();
+	pushing = false;
+	return pushResult;
+}
+
+/*	BasicJSONParser::unexpectedEOF
+ *
+ *		Report EOF in the middle of a value
+ */
+
+template <class Handler>
+void BasicJSONParser<Handler>::unexpectedEOF()
+{
+	sawEOF = true;
+	error(JSONErrorUnexpectedEOF);
+}
+
+/*	BasicJSONParser::overLimit
+ *
+ *		Report an exceeded limit and give up. Containers still open are left
+ *	open; the parse has failed.
+ */
+
+template <class Handler>
+bool BasicJSONParser<Handler>::overLimit(JSONLimit limit)
+{
+	if (limit == JSONLimitDepth) {
+		error(JSONErrorDepth,(uint64_t)limits.maxDepth);
+	} else if (limit == JSONLimitString) {
+		error(JSONErrorStringLength,(uint64_t)limits.maxStringLength);
+	} else if (limit == JSONLimitTokens) {
+		error(JSONErrorTokenCount,(uint64_t)limits.maxTokens);
+	} else {
+		error(JSONErrorInputLength,(uint64_t)limits.maxBytes);
+	}
+	
+	stack.clear();
+	aborted = true;
+	return false;
+}
+
+/*	BasicJSONParser::run
+ *
+ *		Run the parser until the top level value (or for parseRange, the
+ *	enclosing container) is finished. Returns false if a value could not be
+ *	parsed; as before, a container counts as parsed even if some of its
+ *	members were not, and the failure is only recorded in the errors.
+ *
+ *		If pushed input runs out, this returns with suspended set, and is
+ *	called again with the state it stopped in once there is more.
+ */
+
+template <class Handler>
+bool BasicJSONParser<Handler>::run(State state)
+{
+	int token;
+	bool ok;
+	
+	suspended = false;
+	for (;;) {
+		if (state == StateValue) {
+			/*
+			 *	Parse a value. This assumes the next token is either a start
+			 *	of object, start of array, true, false, null, a number or a
+			 *	string. Anything else is skipped with a warning.
+			 */
+			
+			token = lexer->readToken();
+			for (;;) {
+				if (token == MORE) return suspend(StateValue);
+				if (token == LIMIT) return overLimit(lexer->getLimit());
+				if ((token == -1) || (token == '{') || (token == '[') || (token == TOKEN) || (token == STRING) || (token == NUMBER)) break;
+				
+				warn(JSONWarnUnexpectedToken,lexer->token);
+				token = lexer->readToken();
+			}
+			
+			if ((token == '{') || (token == '[')) {
+				if (!pushing && handler().skipContainer()) {
+					ok = lexer->skipValue();
+					if (!ok) unexpectedEOF();
+					if (stack.empty()) return ok;
+					if (!ok) stack.back().success = false;
+					state = StateNext;
+					continue;
+				}
+				
+				if (limits.maxDepth && (stack.size() >= limits.maxDepth)) return overLimit(JSONLimitDepth);
+				
+				Frame f = { token == '{', false, true, false, false };
+				if (f.isObject) {
+					counted(JSONTypeObject);
+					handler().startObject();
+				} else {
+					counted(JSONTypeArray);
+					handler().startArray();
+				}
+				stack.push_back(f);
+				if (stats) stats->depth(stack.size());
+				state = StateMember;
+				continue;
+			}
+			
+			ok = true;
+			if (token == -1) {
+				unexpectedEOF();
+				ok = false;
+			} else if (token == TOKEN) {
+				std::string &t = lexer->token;
+				
+				if (t == "true") {
+					counted(JSONTypeBoolean);
+					handler().boolean(true);
+				} else if (t == "false") {
+					counted(JSONTypeBoolean);
+					handler().boolean(false);
+				} else if (t == "null") {
+					counted(JSONTypeNull);
+					handler().null();
+				} else {
+					/*
+					 *	Unexpected string token in stream. Error and abort
+					 */
+					 
+					error(JSONErrorIllegalToken,t);
+					ok = false;
+				}
+			} else if (token == STRING) {
+				counted(JSONTypeString);
+				handler().string(lexer->text());
+			} else {
+				/*
+				 *	Parse number. The lexer has already gathered the digits;
+				 *	anything with a fraction or exponent, or which does not fit
+				 *	in 64 bits, is a real.
+				 */
+				 
+				int64_t val;
+				counted(JSONTypeNumber);
+				if (JSONTokenToInteger(lexer->number,&val)) {
+					handler().integer(val);
+				} else {
+					handler().real(JSONTokenToReal(lexer->number,lexer->token.c_str()));
+				}
+			}
+			
+			if (stack.empty()) return ok;
+			if (!ok) stack.back().success = false;
+			state = StateNext;
+			continue;
+		}
+		
+		Frame &f = stack.back();
+		token = lexer->readToken();
+		if (token == MORE) return suspend(state);
+		if (token == LIMIT) return overLimit(lexer->getLimit());
+		
+		if (state == StateColon) {
+			if (token != ':') {
+				warn(JSONWarnExpectedColon);
+				lexer->pushToken();
+			}
+			
+			state = StateValue;
+			continue;
+		}
+		
+		if (state == StateMember) {
+			if (f.isObject) {
+				/*
+				 *	key: value, ...
+				 */
+				
+				if (token == '}') {
+					if (f.tailComma) {
+						warn(JSONWarnCloseAfterComma);
+					}
+				} else if (token == ']') {
+					warn(JSONWarnCloseArray);
+				} else {
+					if (token != STRING) {
+						warn(JSONWarnExpectedKey);
+					}
+					
+					handler().objectKey(lexer->text());
+					state = StateColon;
+					continue;
+				}
+			} else {
+				/*
+				 *	value, value, ...
+				 */
+				
+				if (token == ']') {
+					if (f.tailComma) {
+						warn(JSONWarnCloseAfterComma);
+					}
+				} else if (token == '}') {
+					warn(JSONWarnCloseObject);
+				} else {
+					lexer->pushToken();
+					state = StateValue;
+					continue;
+				}
+			}
+		} else {
+			/*
+			 *	Read the terminating ',' or close. If we are parsing part
+			 *	of a container, EOF after a value marks the end of the part
+			 *	rather than an error.
+			 */
+			
+			if (token == -1) {
+				if (f.partial) {
+					rangeEnd = true;
+				} else {
+					f.success = false;
+					unexpectedEOF();
+				}
+			} else if (f.isObject && (token == ']')) {
+				warn(JSONWarnCloseArray);
+			} else if (!f.isObject && (token == '}')) {
+				warn(JSONWarnCloseObject);
+			} else if (token != (f.isObject ? '}' : ']')) {
+				if (token != ',') {
+					if (f.isObject) {
+						warn(JSONWarnExpectedMemberComma);
+					} else {
+						warn(JSONWarnExpectedValueComma);
+					}
+					lexer->pushToken();
+				}
+				f.tailComma = true;
+				state = StateMember;
+				continue;
+			}
+		}
+		
+		/*
+		 *	Close the container. The range container belongs to the caller.
+		 */
+		
+		bool isObject = f.isObject;
+		bool outer = f.outer;
+		bool success = f.success;
+		stack.pop_back();
+		
+		if (outer) return success;
+		if (isObject) {
+			handler().endObject();
+		} else {
+			handler().endArray();
+		}
+		
+		if (stack.empty()) return true;
+		state = StateNext;
+	}
+}
+
+/*	JSONParser
+ *
+ *		Parser with a virtual SAX-like interface, for handlers which are
+ *	chosen at run time.
+ */
+ 
+class JSONParser: public BasicJSONParser<JSONParser>
+{
+	public:
+						JSONParser();
+		virtual			~JSONParser();
+		
+		/*
+		 *	SAX-like interface
+		 */
+		
+		virtual void	null() = 0;
+		virtual void	boolean(bool value) = 0;
+		virtual void	integer(int64_t value) = 0;
+		virtual void	real(double value) = 0;
+		virtual void	string(std::string_view value) = 0;
+		
+		virtual void	startArray() = 0;
+		virtual void	endArray() = 0;
+		
+		virtual void	startObject() = 0;
+		virtual void	endObject() = 0;
+		virtual void	objectKey(std::string_view value) = 0;
+		
+		virtual bool	skipContainer();
+};
+
+extern template class BasicJSONParser<JSONParser>;
+
+/****************************************************************************/
+/*																			*/
+/*	DOM Parser																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONArena
+ *
+ *		Bump allocator for DOM nodes. Memory is carved out of large chunks,
+ *	optionally backed by huge pages, and is never freed individually;
+ *	reset() releases everything allocated at once while keeping the chunks
+ *	around for the next document.
+ */
+
+class JSONArena
+{
+	public:
+						JSONArena(size_t chunkSize = 4*1024*1024, bool hugePages = false);
+						~JSONArena();
+		
+		void			*alloc(size_t size, size_t align = sizeof(void *))
+							{
+								uintptr_t p = ((uintptr_t)ptr + align - 1) & ~(uintptr_t)(align - 1);
+								if (p + size <= (uintptr_t)limit) {
+									ptr = (uint8_t *)(p + size);
+									return (void *)p;
+								}
+								return grow(size,align);
+							}
+		
+		void			reset();
+		void			release();
+		
+		size_t			bytesUsed();
+		size_t			bytesReserved()
+							{
+								return reserved;
+							}
+		
+	private:
+		struct Chunk {
+			Chunk		*next;
+			size_t		size;
+			bool		mapped;
+		};
+		
+		void			*grow(size_t size, size_t align);
+		Chunk			*newChunk(size_t size);
+		
+		size_t			chunkSize;
+		bool			hugePages;
+		
+		Chunk			*first;
+		Chunk			*current;
+		uint8_t			*ptr;
+		uint8_t			*limit;
+		size_t			spent;			/* bytes used in chunks before current */
+		size_t			reserved;
+};
+
+/*	JSONAllocator
+ *
+ *		STL allocator which allocates from an arena, or from the heap if the
+ *	arena is NULL. Memory from an arena is released by resetting the arena.
+ */
+
+template <class T> class JSONAllocator
+{
+	public:
+		typedef T		value_type;
+		
+						JSONAllocator() : arena(NULL)
+							{
+							}
+						JSONAllocator(JSONArena *a) : arena(a)
+							{
+							}
+		template <class U> JSONAllocator(const JSONAllocator<U> &a) : arena(a.arena)
+							{
+							}
+		
+		T				*allocate(size_t n)
+							{
+								if (arena) return (T *)arena->alloc(n * sizeof(T),alignof(T));
+								return (T *)::operator new(n * sizeof(T));
+							}
+		void			deallocate(T *p, size_t)
+							{
+								if (arena == NULL) ::operator delete(p);
+							}
+		
+		JSONArena		*arena;
+};
+
+template <class T, class U> bool operator == (const JSONAllocator<T> &a, const JSONAllocator<U> &b)
+{
+	return a.arena == b.arena;
+}
+
+template <class T, class U> bool operator != (const JSONAllocator<T> &a, const JSONAllocator<U> &b)
+{
+	return a.arena != b.arena;
+}
+
+/*	JSONKey
+ *
+ *		An object key: a view of a string interned in a JSONKeyTable, along
+ *	with its hash. Keys are only valid while their key table is.
+ */
+
+class JSONKey: public std::string_view
+{
+	public:
+						JSONKey() : hash(0)
+							{
+							}
+						JSONKey(std::string_view str, uint32_t h) : std::string_view(str), hash(h)
+							{
+							}
+		
+		uint32_t		hash;
+};
+
+/*	JSONKeyTable
+ *
+ *		Interned object keys. Each distinct key is stored once, with its
+ *	hash, and objects refer to it by a JSONKey. A table is meant to be kept
+ *	for a whole parse session: keys interned while parsing one document
+ *	are found again when parsing the next. Not thread safe; use one table
+ *	per thread.
+ *
+ *		Keys are copied into the table's own storage, or into the arena given
+ *	to the constructor. Keys copied into an arena stay valid as long as the
+ *	rest of the arena does, even after the table is deleted.
+ */
+
+class JSONKeyTable
+{
+	public:
+						JSONKeyTable(JSONArena *storage = NULL);
+						~JSONKeyTable();
+		
+		JSONKey			intern(std::string_view str);
+		void			clear();
+		
+		size_t			size()
+							{
+								return count;
+							}
+		size_t			bytesUsed()
+							{
+								return own.bytesUsed() + slots.size() * sizeof(JSONKey);
+							}
+		
+		static uint32_t	hash(std::string_view str);
+		
+	private:
+		void			grow();
+		
+		JSONArena		own;
+		JSONArena		*storage;		/* own, or the arena given */
+		std::vector<JSONKey> slots;		/* open addressing; empty if data() is NULL */
+		size_t			count;
+};
+
+/*	JSONNode
+ *
+ *		Each potential value in our json object is represented by a node.
+ *	Nodes may be allocated from an arena with new (arena) JSONNull; nodes
+ *	allocated this way must never be deleted, and are instead released all
+ *	at once by resetting the arena.
+ */
+
+class JSONNode
+{
+	public:
+						JSONNode();
+		virtual			~JSONNode();
+						
+		virtual JSONType type() = 0;
+		
+		static void		*operator new(size_t size)
+							{
+								return ::operator new(size);
+							}
+		static void		*operator new(size_t size, JSONArena *arena)
+							{
+								if (arena) return arena->alloc(size);
+								return ::operator new(size);
+							}
+		static void		operator delete(void *ptr)
+							{
+								::operator delete(ptr);
+							}
+		static void		operator delete(void *ptr, JSONArena *arena)
+							{
+								if (arena == NULL) ::operator delete(ptr);
+							}
+};
+
+/*	JSONDuplicates
+ *
+ *		What an object does when a key is added which it already contains.
+ *	With JSONDuplicateLast the new value replaces the old one in the old
+ *	one's position; with JSONDuplicateFirst the new value is refused; with
+ *	JSONDuplicateKeepAll both are kept, and find() returns the last.
+ */
+
+enum JSONDuplicates {
+	JSONDuplicateLast,
+	JSONDuplicateFirst,
+	JSONDuplicateKeepAll
+};
+
+/*	JSONObject
+ *
+ *		Object members are kept in a flat array in insertion order. Small
+ *	objects are searched linearly, comparing hashes first; once an object
+ *	grows past JSONOBJECT_LINEAR members, the first lookup builds a hash
+ *	index over the array, which is then kept up to date as members are
+ *	added. The object owns its members.
+ */
+
+#define JSONOBJECT_LINEAR	16
+
+class JSONObject: public JSONNode
+{
+	public:
+		typedef std::pair<JSONKey, JSONNode *> Member;
+		typedef std::vector<Member, JSONAllocator<Member> > Members;
+		typedef Members::iterator iterator;
+		
+						JSONObject(JSONArena *arena = NULL);
+						~JSONObject();
+	
+		JSONType		type();
+		
+		iterator		begin()
+							{
+								return members.begin();
+							}
+		iterator		end()
+							{
+								return members.end();
+							}
+		size_t			size()
+							{
+								return members.size();
+							}
+		bool			empty()
+							{
+								return members.empty();
+							}
+		
+		JSONNode		*find(std::string_view key);
+		JSONNode		*find(const JSONKey &key);
+		
+		/*
+		 *	Add a member. Returns false if the node was refused because of a
+		 *	duplicate key, in which case the caller still owns it. A value
+		 *	replaced under JSONDuplicateLast is deleted (unless it came from
+		 *	an arena).
+		 */
+		
+		bool			add(const JSONKey &key, JSONNode *node, JSONDuplicates policy = JSONDuplicateLast);
+		
+		/*
+		 *	Remove every member without deleting it, as clear() does for a
+		 *	JSONArray.
+		 */
+		
+		void			clear()
+							{
+								members.clear();
+								index.clear();
+							}
+		
+	private:
+		long			lookup(const JSONKey &key);
+		void			buildIndex(size_t slots);
+		void			indexMember(size_t pos);
+		
+		Members			members;
+		std::vector<uint32_t, JSONAllocator<uint32_t> > index;	/* member + 1, or 0 */
+};
+
+class JSONArray: public JSONNode, public std::vector<JSONNode *, JSONAllocator<JSONNode *> >
+{
+	public:
+						JSONArray(JSONArena *arena = NULL);
+						~JSONArray();
+	
+		JSONType		type();
+};
+
+/*	JSONString
+ *
+ *		A string value. The characters are copied into the arena if one is
+ *	given, or onto the heap otherwise, and the string is a view of that copy.
+ *	If copy is false the string is a view of the caller's characters, which
+ *	must outlive it.
+ */
+
+class JSONString: public JSONNode, public std::string_view
+{
+	public:
+						JSONString();
+						JSONString(std::string_view val, JSONArena *arena = NULL);
+						JSONString(std::string_view val, JSONArena *arena, bool copy);
+						~JSONString();
+	
+		JSONType		type();
+		
+	private:
+		bool			owned;
+};
+
+class JSONNumber: public JSONNode
+{
+	public:
+						JSONNumber(int64_t value);
+						JSONNumber(double value);
+						JSONNumber(bool value);
+						~JSONNumber();
+						
+		JSONType		type();
+		bool			isIntegerValue()
+							{
+								return isInteger;
+							}
+		
+		int64_t			intValue();
+		double			realValue();
+		bool			boolValue();
+	
+	private:
+		bool			isBoolean;
+		bool			isInteger;
+		union {
+			bool		bvalue;
+			int64_t		ivalue;
+			double		rvalue;
+		} u;
+};
+
+class JSONNull: public JSONNode
+{
+	public:
+						JSONNull();
+						~JSONNull();
+	
+		JSONType		type();
+};
+
+/*	JSONRecordParser
+ *
+ *		Parse into a JSON object. If an arena is given, the entire document is
+ *	allocated from the arena, and is released by resetting the arena rather
+ *	than by deleting the returned node. Object keys are interned in the key
+ *	table, which must outlive the document. If none is given the parser
+ *	makes one for each document which lasts as long as the document does:
+ *	keys are copied into the arena if there is one, and otherwise the table
+ *	is deleted along with the returned node. Duplicate keys are handled as
+ *	set by setDuplicates(); by default the last value wins.
+ *
+ *		With setBorrowStrings(true), strings and keys which need no decoding
+ *	are views of persistent input (see JSONLexer) rather than copies; only
+ *	strings with escapes are copied. The document is then only valid while
+ *	the input is.
+ */
+
+class JSONRecordParser: public BasicJSONParser<JSONRecordParser>
+{
+	public:
+						JSONRecordParser(JSONArena *arena = NULL, JSONKeyTable *keys = NULL);
+						~JSONRecordParser();
+		
+		JSONNode		*parse(JSONLexer *lexer);
+		JSONNode		*parseRange(JSONLexer *lexer, bool isObject, bool first, bool last, bool *clean);
+		
+		/*
+		 *	Push parsing: feed() the input a block at a time, then finish()
+		 *	returns the document as parse() would.
+		 */
+		
+		void			startPush();
+		JSONNode		*finish();
+		
+		void			setDuplicates(JSONDuplicates policy)
+							{
+								duplicates = policy;
+							}
+		void			setBorrowStrings(bool flag)
+							{
+								borrowStrings = flag;
+							}
+		
+		/*
+		 *	Interface
+		 */
+		
+		void			null();
+		void			boolean(bool value);
+		void			integer(int64_t value);
+		void			real(double value);
+		void			string(std::string_view value);
+		
+		void			startArray();
+		void			endArray();
+		
+		void			startObject();
+		void			endObject();
+		void			objectKey(std::string_view value);
+							
+	private:
+		struct Frame {
+			JSONObject	*object;		/* one of these is set */
+			JSONArray	*array;
+		};
+		
+		void			startDocument();
+		void			addValue(JSONNode *node);
+		void			clearDropped();
+		JSONNode		*result(bool success);
+		
+		JSONArena		*arena;
+		JSONKeyTable	*keys;			/* in use for this document */
+		JSONKeyTable	*sharedKeys;	/* given to the constructor */
+		JSONKeyTable	*ownKeys;		/* made by us, not yet given away */
+		JSONNode		*root;
+		JSONKey			key;
+		JSONDuplicates	duplicates;
+		bool			borrowStrings;
+		std::vector<Frame> stack;
+		std::vector<JSONNode *> dropped;	/* refused duplicates, heap only */
+};
+
+
+/****************************************************************************/
+/*																			*/
+/*	Tape DOM																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONTapeTag
+ *
+ *		The tape is an array of 64-bit entries. The top 8 bits of each entry
+ *	are a tag, and the low 56 bits are a payload:
+ *
+ *		null, true, false		no payload
+ *		integer, real			the next entry holds the raw 64-bit value
+ *		string					offset of the string in the string buffer
+ *		start object, array		index of the matching end entry
+ *		end object, array		index of the matching start entry
+ *
+ *	Object members are stored as a key string followed by the value. Strings
+ *	are stored in the string buffer as a 32-bit length, the bytes, and a
+ *	trailing NUL.
+ */
+
+enum JSONTapeTag {
+	JSONTapeNull = 'n',
+	JSONTapeTrue = 't',
+	JSONTapeFalse = 'f',
+	JSONTapeInteger = 'l',
+	JSONTapeReal = 'd',
+	JSONTapeString = '"',
+	JSONTapeStartObject = '{',
+	JSONTapeEndObject = '}',
+	JSONTapeStartArray = '[',
+	JSONTapeEndArray = ']'
+};
+
+#define JSONTAPE_PAYLOAD	0x00FFFFFFFFFFFFFFULL
+
+/*	JSONTapeCursor
+ *
+ *		Refers to a single value on a tape. Cursors are cheap to copy and do
+ *	not own anything; they remain valid as long as the tape does.
+ */
+
+class JSONTapeCursor
+{
+	public:
+						JSONTapeCursor() : tape(NULL), strings(NULL), index(0)
+							{
+							}
+						JSONTapeCursor(const uint64_t *t, const uint8_t *s, size_t i) : tape(t), strings(s), index(i)
+							{
+							}
+		
+		bool			isValid()
+							{
+								return tape != NULL;
+							}
+		JSONTapeTag		tag()
+							{
+								return (JSONTapeTag)(tape[index] >> 56);
+							}
+		size_t			getIndex()
+							{
+								return index;
+							}
+		JSONType		type();
+		
+		/*
+		 *	Values
+		 */
+		
+		bool			isIntegerValue()
+							{
+								return tag() == JSONTapeInteger;
+							}
+		int64_t			intValue();
+		double			realValue();
+		bool			boolValue();
+		std::string_view stringValue();
+		
+		/*
+		 *	Navigation. For containers, first() returns the first child, or a
+		 *	cursor for which isEnd() is true if the container is empty. For
+		 *	objects the children alternate key, value. next() steps over the
+		 *	current value, skipping containers in one step.
+		 */
+		
+		bool			isEnd()
+							{
+								JSONTapeTag t = tag();
+								return (t == JSONTapeEndObject) || (t == JSONTapeEndArray);
+							}
+		JSONTapeCursor	first()
+							{
+								return JSONTapeCursor(tape,strings,index + 1);
+							}
+		JSONTapeCursor	next();
+		
+		size_t			size();
+		JSONTapeCursor	operator [] (size_t index);
+		JSONTapeCursor	find(std::string_view key);
+		
+	private:
+		const uint64_t	*tape;
+		const uint8_t	*strings;
+		size_t			index;
+};
+
+/*	JSONTape
+ *
+ *		A parsed document stored as a tape and a string buffer
+ */
+
+class JSONTape
+{
+	public:
+						JSONTape();
+						~JSONTape();
+		
+		void			clear();
+		
+		JSONTapeCursor	root()
+							{
+								if (tape.empty()) return JSONTapeCursor();
+								return JSONTapeCursor(tape.data(),strings.data(),0);
+							}
+		
+		size_t			bytesUsed()
+							{
+								return tape.size() * sizeof(uint64_t) + strings.size();
+							}
+		
+		std::vector<uint64_t> tape;
+		std::vector<uint8_t> strings;
+};
+
+/*	JSONTapeParser
+ *
+ *		Parse into a tape. Object members are kept in the order they appear
+ *	in the input, and duplicate keys are always kept.
+ */
+
+class JSONTapeParser: public BasicJSONParser<JSONTapeParser>
+{
+	public:
+						JSONTapeParser();
+						~JSONTapeParser();
+		
+		bool			parse(JSONLexer *lexer, JSONTape *tape);
+		
+		/*
+		 *	Interface
+		 */
+		
+		void			null();
+		void			boolean(bool value);
+		void			integer(int64_t value);
+		void			real(double value);
+		void			string(std::string_view value);
+		
+		void			startArray();
+		void			endArray();
+		
+		void			startObject();
+		void			endObject();
+		void			objectKey(std::string_view value);
+		
+	private:
+		struct Frame {
+			size_t		start;
+			size_t		key;			/* index of unmatched key, or 0 */
+		};
+		
+		void			addValue();
+		void			appendString(JSONTapeTag tag, std::string_view value);
+		void			dropKey(Frame &f);
+		
+		JSONTape		*tape;
+		std::vector<Frame> stack;
+};
+
+/****************************************************************************/
+/*																			*/
+/*	Snapshots																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONSnapshot
+ *
+ *		A document saved to a file as a tape, which is memory mapped and read
+ *	in place. Opening a snapshot checks the header and maps the file; there
+ *	is nothing to rebuild, and pages are only read as the tape is walked.
+ *
+ *		The file holds a header, the tape, the string pool, in which each
+ *	distinct key is stored once, and optionally a key index, which lets
+ *	find() look up a member of a large object with a binary search rather
+ *	than a scan. Offsets are from the start of their section, so the file
+ *	can be mapped anywhere. Snapshots are written in the byte order of the
+ *	machine, and are refused if the byte order or version differ.
+ *
+ *		write() writes to a temporary file and renames it into place, so a
+ *	snapshot being mapped by another process is never rewritten under it.
+ */
+
+class JSONSnapshot
+{
+	public:
+						JSONSnapshot();
+						~JSONSnapshot();
+		
+		static bool		write(JSONNode *node, const char *path, bool keyIndex = false);
+		
+		bool			open(int fd);
+		void			close();
+		bool			isValid()
+							{
+								return tape != NULL;
+							}
+		bool			hasKeyIndex()
+							{
+								return objectCount > 0;
+							}
+		
+		JSONTapeCursor	root()
+							{
+								if (tape == NULL) return JSONTapeCursor();
+								return JSONTapeCursor(tape,strings,0);
+							}
+		JSONTapeCursor	find(JSONTapeCursor object, std::string_view key);
+		
+	private:
+		struct Header;
+		struct Object;
+		struct Key;
+		struct Builder;
+		
+		std::string_view keyAt(const Key &k);
+		bool			validate();
+		
+		void			*map;
+		size_t			mapLength;
+		const uint64_t	*tape;
+		size_t			tapeCount;
+		const uint8_t	*strings;
+		size_t			stringsLength;
+		const Object	*objects;		/* indexed objects, by tape index */
+		size_t			objectCount;
+		const Key		*keys;			/* sorted keys of each object */
+		size_t			keyCount;
+};
+
+/****************************************************************************/
+/*																			*/
+/*	On-demand DOM															*/
+/*																			*/
+/****************************************************************************/
+
+class JSONLazyDocument;
+
+/*	JSONLazyValue
+ *
+ *		A value in a JSONLazyDocument. Containers are found through the
+ *	document's structural index and are only read when they are looked into;
+ *	scalars are built when they are found. The members of a container are
+ *	found in one walk the first time it is looked into, and kept, so later
+ *	lookups in it by key or position do not read it again. Values are cheap
+ *	to copy and are valid as long as the document is.
+ *
+ *		Lookups follow the same repair rules as JSONRecordParser, so a path
+ *	finds the value the full parser would have put there. A key which occurs
+ *	more than once finds the value JSONDuplicateLast would keep, and indexing
+ *	an object by number counts each key once, where it first occurs.
+ */
+
+class JSONLazyValue
+{
+	public:
+						JSONLazyValue() : doc(NULL), container(-1), scalar(NULL)
+							{
+							}
+						JSONLazyValue(JSONLazyDocument *d, long c) : doc(d), container(c), scalar(NULL)
+							{
+							}
+						JSONLazyValue(JSONLazyDocument *d, JSONNode *n) : doc(d), container(-1), scalar(n)
+							{
+							}
+		
+		bool			isValid()
+							{
+								return (container >= 0) || (scalar != NULL);
+							}
+		JSONType		type();
+		
+		/*
+		 *	Navigation. An invalid value is returned if there is no such
+		 *	member, and looking into an invalid value gives another.
+		 */
+		
+		size_t			size();
+		JSONLazyValue	operator [] (std::string_view key);
+		JSONLazyValue	operator [] (size_t index);
+		JSONLazyValue	operator [] (int index)
+							{
+								return (*this)[(size_t)index];
+							}
+		JSONLazyValue	operator [] (const char *key)
+							{
+								return (*this)[std::string_view(key)];
+							}
+		
+		/*
+		 *	Build the value and everything in it. The node belongs to the
+		 *	document.
+		 */
+		
+		JSONNode		*node();
+		
+	private:
+		JSONLazyDocument *doc;
+		long			container;		/* index in the document, or -1 */
+		JSONNode		*scalar;
+};
+
+/*	JSONLazyDocument
+ *
+ *		A document over a block of memory which is only parsed where it is
+ *	looked at. The constructor makes one pass with the stage 1 scanner to
+ *	find where each array and object opens and closes; after that a lookup
+ *	reads only the members of the containers on its path, and steps over
+ *	each member which is itself a container in one jump.
+ *
+ *		A document which needs repair is indexed again with the lexer,
+ *	following the parser's repairs, so containers end where the parser
+ *	would end them. The data must outlive the document.
+ */
+
+class JSONLazyDocument
+{
+	public:
+						JSONLazyDocument(const void *data, size_t length);
+						~JSONLazyDocument();
+		
+		JSONLazyValue	root();
+		
+		JSONLazyValue	operator [] (std::string_view key)
+							{
+								return root()[key];
+							}
+		JSONLazyValue	operator [] (const char *key)
+							{
+								return root()[std::string_view(key)];
+							}
+		JSONLazyValue	operator [] (size_t index)
+							{
+								return root()[index];
+							}
+		JSONLazyValue	operator [] (int index)
+							{
+								return root()[(size_t)index];
+							}
+		
+		size_t			containerCount()
+							{
+								return containers.size();
+							}
+		
+	private:
+		friend class JSONLazyValue;
+		
+		struct Container {
+			uint64_t	open;			/* offset of the open bracket */
+			uint64_t	close;			/* of the close bracket, or length */
+			size_t		next;			/* first container after this one */
+			bool		isObject;
+		};
+		struct Indexer;
+		struct Members;
+		
+		bool			indexStructure();
+		void			indexTokens();
+		long			find(uint64_t open, size_t hint);
+		long			skip(JSONLexer &lexer, size_t *hint);
+		JSONNode		*scalar(JSONLexer &lexer, int token);
+		JSONLazyValue	value(JSONLexer &lexer, int token, size_t *hint);
+		Members			*members(long c);
+		JSONNode		*build(long c);
+		
+		const uint8_t	*data;
+		size_t			length;
+		std::vector<Container> containers;
+		std::vector<Members *> cache;	/* by container, once walked */
+		
+		JSONArena		arena;
+		JSONKeyTable	keys;
+};
+
+
+/****************************************************************************/
+/*																			*/
+/*	Output																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONWriter
+ *
+ *		Buffered output sink. Output is accumulated in a large buffer, and
+ *	handed to the sink through overflow() when the buffer fills and through
+ *	flush(). Subclasses must call flush() from their destructor.
+ */
+
+class JSONWriter
+{
+	public:
+						JSONWriter(size_t capacity = 256*1024);
+		virtual			~JSONWriter();
+		
+		void			write(const char *data, size_t len)
+							{
+								if (len <= (size_t)(limit - ptr)) {
+									memcpy(ptr,data,len);
+									ptr += len;
+								} else {
+									writeLarge(data,len);
+								}
+							}
+		void			write(std::string_view str)
+							{
+								write(str.data(),str.size());
+							}
+		void			put(char c)
+							{
+								if (ptr == limit) overflow(1);
+								*ptr++ = c;
+							}
+		
+		/*
+		 *	Direct access to the buffer: reserve() returns space for at
+		 *	least len bytes, and commit() marks how much was used.
+		 */
+		
+		char			*reserve(size_t len)
+							{
+								if (len > (size_t)(limit - ptr)) overflow(len);
+								return ptr;
+							}
+		void			commit(char *end)
+							{
+								ptr = end;
+							}
+		
+		/*
+		 *	Formatting primitives
+		 */
+		
+		void			indent(int depth);
+		void			newline(int depth);
+		void			string(std::string_view str);
+		void			integer(int64_t value);
+		void			real(double value);
+		void			print(const char *fmt, ...);
+		
+		virtual void	flush();
+		bool			failed()
+							{
+								return error;
+							}
+		void			setStats(JSONStats *s)
+							{
+								stats = s;
+							}
+		
+		/*
+		 *	Strings are written as ASCII, with everything else escaped as
+		 *	\uXXXX, unless raw UTF-8 is turned on.
+		 */
+		
+		void			setRawUTF8(bool flag)
+							{
+								rawUTF8 = flag;
+							}
+		bool			isRawUTF8()
+							{
+								return rawUTF8;
+							}
+		
+	protected:
+		virtual void	overflow(size_t len);
+		virtual void	writeLarge(const char *data, size_t len);
+		virtual void	drain(const char *data, size_t len) = 0;
+		
+		char			*buffer;
+		char			*ptr;
+		char			*limit;
+		size_t			capacity;
+		bool			error;
+		bool			rawUTF8;
+		JSONStats		*stats;			/* times and counts output drained */
+};
+
+/*	JSONFdWriter
+ *
+ *		Writes to a file descriptor with write(2). Writes larger than the
+ *	buffer go out together with the buffered data in one writev(2).
+ */
+
+class JSONFdWriter: public JSONWriter
+{
+	public:
+						JSONFdWriter(int fd, size_t capacity = 256*1024);
+						~JSONFdWriter();
+		
+	protected:
+		void			writeLarge(const char *data, size_t len);
+		void			drain(const char *data, size_t len);
+		
+		int				fd;
+};
+
+/*	JSONFileWriter
+ *
+ *		Creates (or truncates) and writes to the named file
+ */
+
+class JSONFileWriter: public JSONFdWriter
+{
+	public:
+						JSONFileWriter(const char *path, size_t capacity = 256*1024);
+						~JSONFileWriter();
+		
+		bool			isValid()
+							{
+								return fd >= 0;
+							}
+};
+
+/*	JSONMemoryWriter
+ *
+ *		Accumulates output in memory. The buffer grows as needed and is never
+ *	drained; the caller reads it with data() and size().
+ */
+
+class JSONMemoryWriter: public JSONWriter
+{
+	public:
+						JSONMemoryWriter(size_t capacity = 64*1024);
+						~JSONMemoryWriter();
+		
+		const char		*data()
+							{
+								return buffer;
+							}
+		size_t			size()
+							{
+								return ptr - buffer;
+							}
+		std::string_view str()
+							{
+								return std::string_view(buffer,ptr - buffer);
+							}
+		void			clear()
+							{
+								ptr = buffer;
+							}
+		
+		void			flush();
+		
+	protected:
+		void			overflow(size_t len);
+		void			writeLarge(const char *data, size_t len);
+		void			drain(const char *data, size_t len);
+};
+
+/****************************************************************************/
+/*																			*/
+/*	Formatting																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONFormat
+ *
+ *		Pretty print a DOM or a tape to the writer
+ */
+
+extern void JSONFormat(JSONNode *node, JSONWriter *out, int depth = 0, bool sameLine = false);
+extern void JSONFormat(JSONTapeCursor c, JSONWriter *out);
+
+/*	JSONMinify
+ *
+ *		Write a DOM or a tape with no whitespace at all
+ */
+
+extern void JSONMinify(JSONNode *node, JSONWriter *out);
+extern void JSONMinify(JSONTapeCursor c, JSONWriter *out);
+
+/*	JSONStreamFormatter
+ *
+ *		Formats directly from the parser callbacks without building a DOM,
+ *	producing the same layout as JSONFormat. Only the open containers and
+ *	the most recent object key are held in memory, so memory use depends on
+ *	the nesting depth rather than the size of the input. Object members are
+ *	written in input order. With setMinify the layout is that of JSONMinify.
+ */
+
+class JSONStreamFormatter: public BasicJSONParser<JSONStreamFormatter>
+{
+	public:
+						JSONStreamFormatter(JSONWriter *out);
+						~JSONStreamFormatter();
+		
+		void			setMinify(bool flag)
+							{
+								minify = flag;
+							}
+		
+		bool			format(JSONLexer *lexer);
+		bool			formatRange(JSONLexer *lexer, bool isObject, bool first, bool last);
+		void			startPush();
+		
+		/*
+		 *	True once any output has been written, so a partial document can
+		 *	be ended with a newline before the diagnostics are listed.
+		 */
+		
+		bool			wroteOutput()
+							{
+								return wrote;
+							}
+		
+		void			null();
+		void			boolean(bool value);
+		void			integer(int64_t value);
+		void			real(double value);
+		void			string(std::string_view value);
+		
+		void			startArray();
+		void			endArray();
+		
+		void			startObject();
+		void			endObject();
+		void			objectKey(std::string_view value);
 		
-		void			startObject();
-		void			endObject();
-		void			objectKey(std::string &value);
-							
 	private:
-		void			addValue(JSONNode *node);
+		struct Frame {
+			bool		sameLine;
+			int			depth;
+			size_t		count;
+		};
 		
-		JSONNode		*root;
+		void			startValue(int *depth = NULL, bool *sameLine = NULL);
+		void			startContainer();
+		void			endContainer();
+		
+		JSONWriter		*out;
+		std::vector<Frame> stack;
+		std::string		key;			/* copy of keyView if not borrowed */
+		std::string_view keyView;
+		bool			hasKey;
+		bool			wrote;
+		bool			minify;
+};
+
+/*	JSONSelector
+ *
+ *		Writes the values in a document which match a JSON Pointer (RFC
+ *	6901), in which a reference token of * matches every member of an
+ *	object or array. Each match is built into a DOM and written formatted or
+ *	minified on lines of its own. Containers which cannot hold a match are
+ *	stepped over by the lexer without being parsed, and other values which
+ *	do not match are never built.
+ *
+ *		A key which occurs more than once in an object on the path is
+ *	resolved by the duplicates policy, as the DOM would resolve it. With
+ *	JSONDuplicateKeepAll each occurrence matches and matches are written as
+ *	they are found; with JSONDuplicateFirst later occurrences are skipped.
+ *	With JSONDuplicateLast the matches under each key of such an object are
+ *	held until the object ends, and a later occurrence replaces them in the
+ *	place of the first, so output is delayed. Skipped containers
+ *	are not checked: there are no diagnostics for them, and a repair which
+ *	would have moved where one ends is not made.
+ *
+ *		A snapshot is selected from in place, following the pointer down the
+ *	tape and using the key index where there is one. A JSONLazyDocument is
+ *	selected from by looking up each token, so only the containers on the
+ *	path are read.
+ */
+
+class JSONSelector: public JSONParser
+{
+	public:
+						JSONSelector(JSONWriter *out);
+						~JSONSelector();
+		
+		bool			setPointer(std::string_view pointer);
+		void			setMinify(bool flag)
+							{
+								minify = flag;
+							}
+		void			setDuplicates(JSONDuplicates policy)
+							{
+								duplicates = policy;
+							}
+		
+		bool			select(JSONLexer *lexer);
+		bool			select(JSONSnapshot *snapshot);
+		bool			select(JSONLazyDocument *doc);
+		size_t			getMatches()
+							{
+								return matches;
+							}
+		
+		/*
+		 *	Interface
+		 */
+		
+		void			null();
+		void			boolean(bool value);
+		void			integer(int64_t value);
+		void			real(double value);
+		void			string(std::string_view value);
+		
+		void			startArray();
+		void			endArray();
+		
+		void			startObject();
+		void			endObject();
+		void			objectKey(std::string_view value);
+		
+		bool			skipContainer();
+		
+	private:
+		enum Visit {
+			VisitSkip,					/* cannot hold a match */
+			VisitPath,					/* on the way to a match */
+			VisitMatch,
+			VisitInside					/* part of a match */
+		};
+		
+		struct Token {
+			std::string	text;
+			bool		wildcard;
+			size_t		index;			/* as an array index, or SIZE_MAX */
+		};
+		
+		struct Frame {
+			bool		isObject;
+			bool		onPath;
+			size_t		count;			/* members so far */
+			JSONNode	*node;			/* if part of a match */
+			bool		keyed;			/* an object on the path with a Level */
+		};
+		struct Level;
+		
+		Visit			visit();
+		bool			visitKey();
+		void			startLevel();
+		void			endLevel();
+		void			emit(std::string_view text, size_t count);
+		void			value(JSONNode *node);
+		void			startContainer(bool isObject);
+		void			endContainer();
+		void			write(JSONNode *node);
+		void			write(JSONTapeCursor c);
+		void			selectTape(JSONSnapshot *snapshot, JSONTapeCursor c, size_t depth);
+		void			selectLazy(JSONLazyValue v, size_t depth);
+		
+		JSONWriter		*out;
+		std::vector<Token> pointer;
+		std::vector<Frame> stack;
 		std::string		key;
-		std::vector<JSONNode *> stack;
+		
+		Visit			pending;		/* from skipContainer() */
+		bool			hasPending;
+		size_t			matchDepth;		/* stack size at the match, or 0 */
+		JSONNode		*match;
+		size_t			matches;
+		
+		std::vector<Level *> levels;	/* reused; levelCount are in use */
+		size_t			levelCount;
+		JSONMemoryWriter scratch;		/* a match being held */
+		
+		JSONArena		arena;
+		JSONKeyTable	keys;
+		bool			minify;
+		JSONDuplicates	duplicates;
+};
+
+
+/****************************************************************************/
+/*																			*/
+/*	Pipeline																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONBlockRing
+ *
+ *		Bounded single producer, single consumer ring of fixed-size blocks,
+ *	used to hand data between the stages of a pipeline. The producer fills
+ *	the block returned by acquire() and hands it over with publish(); the
+ *	consumer reads the block returned by take() and hands it back with
+ *	release(). The indexes are atomic, so neither side takes a lock unless
+ *	it has to wait: a full ring holds back the producer and an empty ring
+ *	holds back the consumer, so memory use is fixed at count blocks.
+ *
+ *		close() marks the end of the data, and take() returns NULL once the
+ *	consumer has caught up; cancel() tells the producer the consumer has
+ *	gone, and acquire() returns NULL.
+ */
+
+class JSONBlockRing
+{
+	public:
+		struct Block {
+			char		*data;
+			size_t		length;			/* bytes used */
+			size_t		capacity;
+		};
+		
+						JSONBlockRing(size_t count, size_t blockSize);
+						~JSONBlockRing();
+		
+		/*
+		 *	Producer
+		 */
+		
+		Block			*acquire();
+		void			publish();
+		void			close();
+		void			sync();
+		bool			isEmpty()
+							{
+								return tail == head;
+							}
+		
+		/*
+		 *	Consumer
+		 */
+		
+		Block			*take();
+		void			release();
+		void			cancel();
+		
+	private:
+		template <class Ready> void wait(Ready ready);
+		void			wake();
+		
+		std::vector<Block> blocks;
+		std::atomic<size_t> head;		/* next block to publish */
+		std::atomic<size_t> tail;		/* next block to release */
+		std::atomic<bool> closed;
+		std::atomic<bool> cancelled;
+		
+		std::mutex		lock;
+		std::condition_variable cond;
+		std::atomic<int> sleepers;
+};
+
+/*	JSONPipelineInput
+ *
+ *		Reads from a file descriptor on a reader thread, which runs ahead of
+ *	the lexer by up to count blocks. The lexer only waits if it catches up
+ *	with the reader, so slow storage is read while the last block is parsed.
+ *	A block is handed over when it is full, or sooner if the lexer is
+ *	waiting for it. Blocks are reused, so the input is not persistent.
+ */
+
+class JSONPipelineInput: public JSONInput
+{
+	public:
+						JSONPipelineInput(int fd, size_t blockSize = 1024*1024, size_t count = 4);
+						~JSONPipelineInput();
+		
+		size_t			read(const uint8_t **data);
+		
+	private:
+		void			run();
+		
+		int				fd;
+		JSONBlockRing	ring;
+		bool			reading;		/* a block is taken */
+		std::thread		reader;
+};
+
+/*	JSONPipelineWriter
+ *
+ *		Writes to a file descriptor on a writer thread. When the buffer
+ *	fills it is handed to the writer thread whole, and formatting carries
+ *	on in another block; up to count blocks are in flight. flush() waits
+ *	until everything has been written. Time spent waiting for the writer
+ *	is counted as writing.
+ */
+
+class JSONPipelineWriter: public JSONWriter
+{
+	public:
+						JSONPipelineWriter(int fd, size_t capacity = 256*1024, size_t count = 4);
+						~JSONPipelineWriter();
+		
+		void			flush();
+		
+	protected:
+		void			overflow(size_t len);
+		void			drain(const char *data, size_t len);
+		
+	private:
+		void			handOff();
+		void			run();
+		
+		int				fd;
+		JSONBlockRing	ring;
+		std::atomic<bool> failed;		/* set by the writer thread */
+		std::thread		writer;
+};
+
+
+/****************************************************************************/
+/*																			*/
+/*	Parallel Processing														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONWorkPool
+ *
+ *		Work stealing thread pool. Each worker has its own task queue; tasks
+ *	submitted from a worker go to the back of that worker's queue, and tasks
+ *	submitted from elsewhere are spread across the queues. Workers take work
+ *	from the back of their own queue, and steal from the front of the other
+ *	queues when they run out.
+ */
+
+class JSONWorkPool
+{
+	public:
+						JSONWorkPool(int threads = 0);
+						~JSONWorkPool();
+		
+		int				size()
+							{
+								return (int)threads.size();
+							}
+		
+		void			submit(std::function<void()> task);
+		void			wait();
+		
+		int				worker();
+		
+	private:
+		struct Queue {
+			std::mutex	lock;
+			std::deque<std::function<void()> > tasks;
+		};
+		
+		void			run(int index);
+		bool			take(int index, std::function<void()> &task);
+		
+		std::vector<std::thread> threads;
+		std::vector<Queue *> queues;
+		
+		std::mutex		lock;
+		std::condition_variable wake;
+		std::condition_variable idle;
+		std::atomic<long> queued;
+		std::atomic<long> pending;
+		size_t			next;
+		bool			stop;
+};
+
+/*	JSONLines
+ *
+ *		Parse and format newline delimited JSON (NDJSON, JSON Lines) in
+ *	parallel. The input is split into chunks at newline boundaries, each
+ *	chunk is parsed and formatted on the work pool, and the results are
+ *	written in input order. Errors are tagged with their record number and
+ *	line number. Blank lines are skipped, and do not count as records.
+ */
+
+class JSONLines
+{
+	public:
+						JSONLines(JSONWorkPool *pool);
+						~JSONLines();
+		
+		void			setMinify(bool flag)
+							{
+								minify = flag;
+							}
+		void			setChunkSize(size_t size)
+							{
+								chunkSize = size;
+							}
+		void			setDuplicates(JSONDuplicates policy)
+							{
+								duplicates = policy;
+							}
+		void			setLimits(const JSONLimits &l)
+							{
+								limits = l;
+							}
+		void			setStats(JSONStats *s)
+							{
+								stats = s;
+							}
+		
+		bool			process(JSONInput *input, JSONWriter *out);
+		
+		JSONDiagnostics	errors;
+		size_t			records;
+		
+	private:
+		struct Chunk;
+		struct Worker;
+		
+		void			submit(Chunk *chunk);
+		void			parseChunk(Chunk *chunk);
+		void			emit(Chunk *chunk, JSONWriter *out);
+		
+		JSONWorkPool	*pool;
+		bool			minify;
+		size_t			chunkSize;
+		JSONDuplicates	duplicates;
+		JSONLimits		limits;			/* applied to each record */
+		JSONStats		*stats;			/* workers' counts are merged here */
+		
+		std::vector<Worker *> workers;
+		std::mutex		lock;
+		std::condition_variable done;
+		
+		long			line;
+};
+
+/*	JSONParallelParser
+ *
+ *		Parse a single large array or object in parallel. A quote and escape
+ *	aware scan of the document, run in parallel over segments and joined
+ *	with a prefix sum, finds commas between members of the top level
+ *	container. The members between those commas are parsed on the work
+ *	pool, and the parts are joined into one container (parse) or written
+ *	in order as formatted output (format).
+ *
+ *		If a part does not end where the sequential parser would have seen a
+ *	separator (which only happens with malformed input), it is parsed again
+ *	sequentially together with the following parts. Input which is not an
+ *	array or object is parsed sequentially.
+ *
+ *		The depth and string length limits are checked in each part. Token
+ *	and byte limits need a count from the start of the input, so documents
+ *	parsed with those limits set are parsed sequentially.
+ */
+
+class JSONParallelParser
+{
+	public:
+						JSONParallelParser(JSONWorkPool *pool);
+						~JSONParallelParser();
+		
+		void			setPartSize(size_t size)
+							{
+								partSize = size;
+							}
+		void			setDuplicates(JSONDuplicates policy)
+							{
+								duplicates = policy;
+							}
+		void			setBorrowStrings(bool flag)
+							{
+								borrowStrings = flag;
+							}
+		void			setLimits(const JSONLimits &l)
+							{
+								limits = l;
+							}
+		void			setStats(JSONStats *s)
+							{
+								stats = s;
+							}
+		void			setMinify(bool flag)
+							{
+								minify = flag;
+							}
+		
+		JSONNode		*parse(const uint8_t *data, size_t length);
+		bool			format(const uint8_t *data, size_t length, JSONWriter *out);
+		bool			wroteOutput()
+							{
+								return wrote;
+							}
+		
+		JSONDiagnostics	errors;
+		
+	private:
+		struct Segment;
+		struct Part;
+		
+		bool			split(const uint8_t *data, size_t length);
+		void			scanSegment(Segment *seg);
+		void			findSplit(Segment *seg, const uint8_t *close);
+		void			parsePart(Part *part);
+		void			waitPart(Part *part);
+		void			run(JSONNode *root, JSONWriter *out);
+		void			collect(Part *part);
+		uint32_t		columnAt(const uint8_t *p);
+		void			reset();
+		bool			canSplit()
+							{
+								return (limits.maxTokens == 0) && (limits.maxBytes == 0);
+							}
+		
+		JSONWorkPool	*pool;
+		size_t			partSize;
+		JSONDuplicates	duplicates;
+		bool			borrowStrings;
+		JSONLimits		limits;
+		JSONStats		*stats;			/* parts' counts are merged here */
+		
+		const uint8_t	*data;
+		const uint8_t	*colScan;		/* searched for newlines up to here */
+		const uint8_t	*colLine;		/* start of the line at colScan */
+		bool			isObject;
+		bool			failed;
+		bool			formatting;
+		bool			wrote;			/* any output when formatting */
+		bool			rawUTF8;		/* of the output when formatting */
+		bool			minify;			/* of the output when formatting */
+		std::vector<Segment> segments;
+		std::vector<Part *> parts;
+		std::vector<JSONArena *> arenas;
+		std::vector<JSONKeyTable *> keys;
+		
+		std::mutex		lock;
+		std::condition_variable done;
+};
+
+/*	JSONParallelFormatter
+ *
+ *		Format a large DOM in parallel. The tree is cut into units of about
+ *	unitSize nodes, each a run of consecutive members of one container; a
+ *	member too large for one unit is itself cut up. Units are formatted on
+ *	the work pool into buffers of their own, at the depth they will appear
+ *	at, and written in order, with the brackets and separators between them
+ *	written by the caller's thread. The output is the same as JSONFormat, or
+ *	JSONMinify if minify is set. The number of units in flight is bounded,
+ *	and their buffers are reused.
+ */
+
+class JSONParallelFormatter
+{
+	public:
+						JSONParallelFormatter(JSONWorkPool *pool);
+						~JSONParallelFormatter();
+		
+		void			setMinify(bool flag)
+							{
+								minify = flag;
+							}
+		void			setUnitSize(size_t nodes)
+							{
+								unitSize = nodes;
+							}
+		
+		void			format(JSONNode *node, JSONWriter *out);
+		
+	private:
+		struct Unit;
+		
+		void			plan(JSONNode *node, int depth, bool sameLine);
+		JSONWriter		*text();
+		void			queue(JSONNode *container, size_t begin, size_t end, int depth, bool sameLine);
+		void			formatUnit(Unit *unit);
+		Unit			*newUnit();
+		void			push(Unit *unit);
+		void			emit();
+		
+		JSONWorkPool	*pool;
+		bool			minify;
+		size_t			unitSize;
+		
+		JSONWriter		*out;
+		std::deque<Unit *> inflight;	/* in output order */
+		std::vector<Unit *> spare;
+		Unit			*literal;		/* text unit being written, or NULL */
+		std::vector<JSONNode *> pending;	/* scratch for Weight */
+		
+		std::mutex		lock;
+		std::condition_variable done;
+};
+
+/*	JSONBatchOutput
+ *
+ *		Where a batch writes the formatted files
+ */
+
+enum JSONBatchOutput {
+	JSONBatchSummary,				/* nowhere; only the report */
+	JSONBatchInPlace,				/* over the input file */
+	JSONBatchMirror					/* to the same relative path in another directory */
+};
+
+/*	JSONBatch
+ *
+ *		Parse and format many files on the work pool. Each worker keeps one
+ *	parser, arena, input buffer and output buffer, which are reused for
+ *	every file it processes. Files are read whole, so this suits many small
+ *	files rather than a few large ones.
+ *
+ *		Output files are written to a temporary file and renamed into place,
+ *	so a file is never seen half written; files repaired in place whose
+ *	output is the same as their input are not rewritten. The diagnostics for
+ *	each file are counted rather than written, and collected into a single
+ *	report, which lists every file which needed repair or failed.
+ *
+ *		Directories are searched recursively for files ending in .json;
+ *	symbolic links to directories are not followed. The number of files
+ *	queued is bounded, so a large tree is processed as it is searched. A
+ *	file whose output would go where an earlier file's went (the same name
+ *	under two directories being mirrored, or the same file given twice) is
+ *	not processed, and is reported as a duplicate.
+ */
+
+class JSONBatch
+{
+	public:
+						JSONBatch(JSONWorkPool *pool);
+						~JSONBatch();
+		
+		void			setOutput(JSONBatchOutput mode, const char *dir = NULL);
+		void			setMinify(bool flag)
+							{
+								minify = flag;
+							}
+		void			setRawUTF8(bool flag)
+							{
+								rawUTF8 = flag;
+							}
+		void			setDuplicates(JSONDuplicates policy)
+							{
+								duplicates = policy;
+							}
+		void			setLimits(const JSONLimits &l)
+							{
+								limits = l;
+							}
+		void			setStats(JSONStats *s)
+							{
+								stats = s;
+							}
+		
+		void			add(const char *path);
+		void			finish();
+		void			report(JSONWriter *out);
+		
+	private:
+		struct Result;
+		struct Worker;
+		
+		void			addDirectory(const std::string &dir, const std::string &rel);
+		void			submit(const std::string &path, const std::string &rel);
+		void			processFile(const std::string &path, const std::string &rel);
+		
+		JSONWorkPool	*pool;
+		JSONBatchOutput	output;
+		std::string		outDir;
+		bool			minify;
+		bool			rawUTF8;
+		JSONDuplicates	duplicates;
+		JSONLimits		limits;			/* applied to each file */
+		JSONStats		*stats;			/* workers' counts are merged here */
+		
+		std::vector<Worker *> workers;
+		std::vector<Result> failures;	/* found while searching */
+		std::unordered_set<std::string> targets; /* where output goes */
+		
+		std::mutex		lock;
+		std::condition_variable done;
+		size_t			queued;			/* files submitted but not finished */
 };
 
 
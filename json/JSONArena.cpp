@@ -0,0 +1,171 @@
+//
+//  JSONArena.cpp
+//  prettyjson
+//
+
+#include <stdlib.h>
+#include <new>
+#include <sys/mman.h>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Arena Allocator															*/
+/*																			*/
+/****************************************************************************/
+
+#define HUGEPAGESIZE	(2*1024*1024)
+
+/*	JSONArena::JSONArena
+ *
+ *		Construct the arena. Chunks are not allocated until first needed.
+ */
+
+JSONArena::JSONArena(size_t size, bool huge)
+{
+	chunkSize = size;
+	hugePages = huge;
+
+	first = NULL;
+	current = NULL;
+	ptr = NULL;
+	limit = NULL;
+	spent = 0;
+	reserved = 0;
+}
+
+JSONArena::~JSONArena()
+{
+	release();
+}
+
+/*	JSONArena::newChunk
+ *
+ *		Allocate a new chunk from the system. With huge pages we map the chunk
+ *	directly, first asking for explicit huge pages, then falling back to
+ *	transparent huge pages, then to the heap.
+ */
+
+JSONArena::Chunk *JSONArena::newChunk(size_t size)
+{
+	Chunk *c = NULL;
+	bool mapped = false;
+
+	if (hugePages) {
+		size = (size + HUGEPAGESIZE - 1) & ~(size_t)(HUGEPAGESIZE - 1);
+		void *p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+		p = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,-1,0);
+#endif
+		if (p == MAP_FAILED) {
+			p = mmap(NULL,size,PROT_READ | PROT_WRITE,MAP_PRIVATE | MAP_ANONYMOUS,-1,0);
+#ifdef MADV_HUGEPAGE
+			if (p != MAP_FAILED) madvise(p,size,MADV_HUGEPAGE);
+#endif
+		}
+		if (p != MAP_FAILED) {
+			c = (Chunk *)p;
+			mapped = true;
+		}
+	}
+
+	if (c == NULL) {
+		c = (Chunk *)malloc(size);
+		if (c == NULL) throw std::bad_alloc();
+	}
+
+	c->next = NULL;
+	c->size = size;
+	c->mapped = mapped;
+	reserved += size;
+	JSONStats::allocation(size);
+	return c;
+}
+
+/*	JSONArena::grow
+ *
+ *		The current chunk is full. Move to the next chunk, reusing chunks
+ *	retained by reset() if they are large enough, and allocating a new chunk
+ *	if not. Requests larger than a chunk get a chunk of their own.
+ */
+
+void *JSONArena::grow(size_t size, size_t align)
+{
+	size_t need = sizeof(Chunk) + size + align;
+
+	if (current) spent += limit - (uint8_t *)(current + 1);
+
+	if (current && current->next && (current->next->size >= need)) {
+		current = current->next;
+	} else {
+		Chunk *c = newChunk((need > chunkSize) ? need : chunkSize);
+		if (current == NULL) {
+			c->next = first;
+			first = c;
+		} else {
+			c->next = current->next;
+			current->next = c;
+		}
+		current = c;
+	}
+
+	ptr = (uint8_t *)(current + 1);
+	limit = current->size + (uint8_t *)current;
+	return alloc(size,align);
+}
+
+/*	JSONArena::reset
+ *
+ *		Release everything allocated from the arena in one operation. The
+ *	chunks are kept for reuse by the next document.
+ */
+
+void JSONArena::reset()
+{
+	current = first;
+	spent = 0;
+	if (current) {
+		ptr = (uint8_t *)(current + 1);
+		limit = current->size + (uint8_t *)current;
+	} else {
+		ptr = limit = NULL;
+	}
+}
+
+/*	JSONArena::release
+ *
+ *		Return all memory to the system
+ */
+
+void JSONArena::release()
+{
+	while (first) {
+		Chunk *c = first;
+		first = c->next;
+
+		JSONStats::release();
+		if (c->mapped) {
+			munmap(c,c->size);
+		} else {
+			free(c);
+		}
+	}
+
+	current = NULL;
+	ptr = limit = NULL;
+	spent = 0;
+	reserved = 0;
+}
+
+/*	JSONArena::bytesUsed
+ *
+ *		Bytes handed out since the last reset, including alignment padding
+ *	and space abandoned at the end of each chunk.
+ */
+
+size_t JSONArena::bytesUsed()
+{
+	if (current == NULL) return 0;
+	return spent + (ptr - (uint8_t *)(current + 1));
+}
@@ -0,0 +1,473 @@
+//
+//  JSONBatch.cpp
+//  prettyjson
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Structures														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONBatch::Result
+ *
+ *		A file which needed repair or failed
+ */
+
+struct JSONBatch::Result
+{
+	std::string			path;
+	const char			*status;
+	size_t				warnings;
+	size_t				errors;
+};
+
+/*	JSONBatch::Worker
+ *
+ *		Per-worker state, reused for every file the worker processes, and
+ *	the worker's share of the totals for the report.
+ */
+
+struct JSONBatch::Worker
+{
+	JSONArena			arena;
+	JSONKeyTable		keys;
+	JSONRecordParser	parser;
+	JSONMemoryWriter	out;
+	std::vector<char>	input;
+	JSONStats			stats;
+	
+	std::vector<Result>	results;
+	uint64_t			files;
+	uint64_t			clean;
+	uint64_t			written;
+	uint64_t			bytesIn;
+	uint64_t			bytesOut;
+	uint64_t			codes[JSONErrorCodeCount];
+	
+						Worker() : parser(&arena,&keys)
+							{
+								parser.setBorrowStrings(true);
+								files = clean = written = bytesIn = bytesOut = 0;
+								memset(codes,0,sizeof(codes));
+							}
+};
+
+/*	Relative
+ *
+ *		The path of a file named directly, to use under the output directory:
+ *	the path with any leading /, ./ and ../ removed, so it cannot land
+ *	outside the directory.
+ */
+
+static std::string Relative(const char *path)
+{
+	for (;;) {
+		if (*path == '/') {
+			++path;
+		} else if (!strncmp(path,"./",2)) {
+			path += 2;
+		} else if (!strncmp(path,"../",3)) {
+			path += 3;
+		} else {
+			break;
+		}
+	}
+	return path;
+}
+
+/*	MakeParents
+ *
+ *		Create the directories above the path. Another worker may be creating
+ *	the same directories, so finding one already there is fine.
+ */
+
+static void MakeParents(const std::string &path)
+{
+	for (size_t pos = path.find('/',1); pos != std::string::npos; pos = path.find('/',pos + 1)) {
+		mkdir(path.substr(0,pos).c_str(),0777);
+	}
+}
+
+/*	WriteFile
+ *
+ *		Write the data to a temporary file next to the path and rename it
+ *	into place. Returns false if it could not be written.
+ */
+
+static bool WriteFile(const std::string &path, std::string_view data, mode_t mode, int worker)
+{
+	std::string tmp = path + "." + std::to_string(getpid()) + "." + std::to_string(worker) + ".tmp";
+
+	int fd = open(tmp.c_str(),O_WRONLY | O_CREAT | O_TRUNC,mode & 0777);
+	if (fd < 0) return false;
+
+	const char *p = data.data();
+	size_t len = data.size();
+	bool ok = true;
+	while (len > 0) {
+		ssize_t n = ::write(fd,p,len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			ok = false;
+			break;
+		}
+		p += n;
+		len -= n;
+	}
+
+	if (close(fd)) ok = false;
+	if (ok) ok = (rename(tmp.c_str(),path.c_str()) == 0);
+	if (!ok) unlink(tmp.c_str());
+	return ok;
+}
+
+/*	ReadFile
+ *
+ *		Read the whole file into the buffer. Returns false on error.
+ */
+
+static bool ReadFile(int fd, std::vector<char> &buffer, size_t *length)
+{
+	struct stat st;
+	if (fstat(fd,&st) || !S_ISREG(st.st_mode)) return false;
+
+	size_t len = 0;
+	if (buffer.size() < (size_t)st.st_size + 1) buffer.resize((size_t)st.st_size + 1);
+	for (;;) {
+		if (len == buffer.size()) buffer.resize(len * 2);
+
+		ssize_t n = ::read(fd,buffer.data() + len,buffer.size() - len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			return false;
+		}
+		if (n == 0) break;
+		len += n;
+	}
+
+	*length = len;
+	return true;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Batch																	*/
+/*																			*/
+/****************************************************************************/
+
+JSONBatch::JSONBatch(JSONWorkPool *p)
+{
+	pool = p;
+	output = JSONBatchSummary;
+	minify = false;
+	rawUTF8 = false;
+	duplicates = JSONDuplicateLast;
+	stats = NULL;
+	queued = 0;
+
+	for (int i = 0; i < pool->size(); ++i) {
+		workers.push_back(new Worker);
+	}
+}
+
+JSONBatch::~JSONBatch()
+{
+	finish();
+	for (size_t i = 0; i < workers.size(); ++i) {
+		delete workers[i];
+	}
+}
+
+/*	JSONBatch::setOutput
+ *
+ *		Set where the formatted files go. dir is the output directory for
+ *	JSONBatchMirror.
+ */
+
+void JSONBatch::setOutput(JSONBatchOutput mode, const char *dir)
+{
+	output = mode;
+	outDir = dir ? dir : "";
+	while ((outDir.size() > 1) && (outDir.back() == '/')) outDir.pop_back();
+}
+
+/*	JSONBatch::add
+ *
+ *		Queue a file, or every .json file under a directory. A directory's
+ *	files are mirrored relative to the directory; a file named directly is
+ *	mirrored at its own path.
+ */
+
+void JSONBatch::add(const char *path)
+{
+	struct stat st;
+
+	if (stat(path,&st) == 0 && S_ISDIR(st.st_mode)) {
+		addDirectory(path,"");
+	} else {
+		submit(path,Relative(path));
+	}
+}
+
+/*	JSONBatch::addDirectory
+ *
+ *		Search a directory. Entries are visited in name order, so the work is
+ *	queued the same way each run.
+ */
+
+void JSONBatch::addDirectory(const std::string &dir, const std::string &rel)
+{
+	DIR *d = opendir(dir.c_str());
+	if (d == NULL) {
+		Result r = { dir, "unreadable", 0, 0 };
+		failures.push_back(r);
+		return;
+	}
+
+	std::vector<std::string> names;
+	struct dirent *e;
+	while ((e = readdir(d)) != NULL) {
+		if (!strcmp(e->d_name,".") || !strcmp(e->d_name,"..")) continue;
+		names.push_back(e->d_name);
+	}
+	closedir(d);
+	std::sort(names.begin(),names.end());
+
+	for (size_t i = 0; i < names.size(); ++i) {
+		std::string path = dir + ((dir.back() == '/') ? "" : "/") + names[i];
+		std::string sub = rel.empty() ? names[i] : rel + "/" + names[i];
+		struct stat st;
+
+		if (lstat(path.c_str(),&st)) continue;
+		if (S_ISDIR(st.st_mode)) {
+			addDirectory(path,sub);
+		} else if ((names[i].size() > 5) && (names[i].compare(names[i].size() - 5,5,".json") == 0)) {
+			if (S_ISREG(st.st_mode) || (S_ISLNK(st.st_mode) && (stat(path.c_str(),&st) == 0) && S_ISREG(st.st_mode))) {
+				submit(path,sub);
+			}
+		}
+	}
+}
+
+/*	JSONBatch::submit
+ *
+ *		Queue a file on the pool, first waiting if too many are queued. A
+ *	file is only queued if nothing queued before it writes to the same place:
+ *	the same relative path when mirroring, or the same file when writing in
+ *	place.
+ */
+
+void JSONBatch::submit(const std::string &path, const std::string &rel)
+{
+	std::string target;
+	struct stat st;
+
+	if (output == JSONBatchMirror) {
+		target = rel;
+	} else if ((output == JSONBatchInPlace) && (stat(path.c_str(),&st) == 0)) {
+		target = std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+	}
+	if (!target.empty() && !targets.insert(target).second) {
+		Result r = { path, "duplicate", 0, 0 };
+		failures.push_back(r);
+		return;
+	}
+
+	{
+		size_t maxQueued = 64 * workers.size();
+		std::unique_lock<std::mutex> lk(lock);
+		done.wait(lk,[this,maxQueued] { return queued < maxQueued; });
+		++queued;
+	}
+
+	pool->submit([this,path,rel] { processFile(path,rel); });
+}
+
+/*	JSONBatch::processFile
+ *
+ *		Runs on a worker: parse the file, count its diagnostics, and write
+ *	its output.
+ */
+
+void JSONBatch::processFile(const std::string &path, const std::string &rel)
+{
+	int index = pool->worker();
+	Worker *w = workers[index];
+	Result r = { path, NULL, 0, 0 };
+	size_t length = 0;
+	struct stat st;
+
+	++w->files;
+
+	int fd = open(path.c_str(),O_RDONLY);
+	bool readable = (fd >= 0) && (fstat(fd,&st) == 0) && ReadFile(fd,w->input,&length);
+	if (fd >= 0) close(fd);
+
+	if (!readable) {
+		r.status = "unreadable";
+	} else {
+		w->bytesIn += length;
+
+		JSONMemoryInput in(w->input.data(),length);
+		JSONLexer lexer(&in);
+
+		/*
+		 *	As with JSONLines, keys are shared by every file the worker
+		 *	parses, and started over if the table gets large.
+		 */
+
+		w->arena.reset();
+		if (w->keys.bytesUsed() > 16*1024*1024) w->keys.clear();
+		w->parser.setDuplicates(duplicates);
+		w->parser.setLimits(limits);
+		w->parser.setStats(stats ? &w->stats : NULL);
+		w->parser.errors.setLimit(1);
+		JSONNode *node = w->parser.parse(&lexer);
+
+		for (int i = 0; i < JSONErrorCodeCount; ++i) {
+			JSONErrorCode code = (JSONErrorCode)i;
+			size_t n = w->parser.errors.getCount(code);
+			w->codes[i] += n;
+			if (code < JSONErrorUnexpectedEOF) {
+				r.warnings += n;
+			} else {
+				r.errors += n;
+			}
+		}
+
+		if (node == NULL) {
+			r.status = "failed";
+		} else if (output != JSONBatchSummary) {
+			w->out.clear();
+			w->out.setRawUTF8(rawUTF8);
+			if (minify) {
+				JSONMinify(node,&w->out);
+			} else {
+				JSONFormat(node,&w->out);
+			}
+			w->out.put('\n');
+
+			std::string_view data = w->out.str();
+			bool same = (output == JSONBatchInPlace) && (data == std::string_view(w->input.data(),length));
+			if (!same) {
+				std::string target = path;
+				if (output == JSONBatchMirror) {
+					target = outDir + "/" + rel;
+					MakeParents(target);
+				}
+
+				if (WriteFile(target,data,st.st_mode,index)) {
+					++w->written;
+					w->bytesOut += data.size();
+				} else {
+					r.status = "unwritable";
+				}
+			}
+		}
+
+		if ((r.status == NULL) && (r.warnings || r.errors)) r.status = "repaired";
+	}
+
+	if (r.status) {
+		w->results.push_back(r);
+	} else {
+		++w->clean;
+	}
+
+	std::lock_guard<std::mutex> g(lock);
+	--queued;
+	done.notify_all();
+}
+
+/*	JSONBatch::finish
+ *
+ *		Wait until every queued file has been processed
+ */
+
+void JSONBatch::finish()
+{
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		done.wait(lk,[this] { return queued == 0; });
+	}
+	pool->wait();
+
+	if (stats) {
+		for (size_t i = 0; i < workers.size(); ++i) {
+			stats->merge(workers[i]->stats);
+			workers[i]->stats.clear();
+		}
+	}
+}
+
+/*	JSONBatch::report
+ *
+ *		Write the report as a JSON object: the totals, the diagnostics
+ *	counted by kind, and the files which needed repair or failed, sorted by
+ *	path.
+ */
+
+void JSONBatch::report(JSONWriter *out)
+{
+	uint64_t files = 0;
+	uint64_t clean = 0;
+	uint64_t written = 0;
+	uint64_t bytesIn = 0;
+	uint64_t bytesOut = 0;
+	uint64_t codes[JSONErrorCodeCount] = { 0 };
+	std::vector<Result> results = failures;
+
+	for (size_t i = 0; i < workers.size(); ++i) {
+		Worker *w = workers[i];
+		files += w->files;
+		clean += w->clean;
+		written += w->written;
+		bytesIn += w->bytesIn;
+		bytesOut += w->bytesOut;
+		for (int j = 0; j < JSONErrorCodeCount; ++j) codes[j] += w->codes[j];
+		results.insert(results.end(),w->results.begin(),w->results.end());
+	}
+	std::sort(results.begin(),results.end(),[](const Result &a, const Result &b) {
+		return a.path < b.path;
+	});
+
+	size_t repaired = 0;
+	for (size_t i = 0; i < results.size(); ++i) {
+		if (!strcmp(results[i].status,"repaired")) ++repaired;
+	}
+
+	out->print("{\n\t\"files\": %llu,\n\t\"clean\": %llu,\n\t\"repaired\": %zu,\n\t\"failed\": %zu,\n",
+			(unsigned long long)files,(unsigned long long)clean,repaired,results.size() - repaired);
+	out->print("\t\"written\": %llu,\n\t\"bytes_in\": %llu,\n\t\"bytes_out\": %llu,\n",
+			(unsigned long long)written,(unsigned long long)bytesIn,(unsigned long long)bytesOut);
+
+	bool first = true;
+	out->write("\t\"diagnostics\": {");
+	for (int i = 0; i < JSONErrorCodeCount; ++i) {
+		if (codes[i] == 0) continue;
+
+		out->write(first ? "\n\t\t" : ",\n\t\t");
+		out->string(JSONError::summary((JSONErrorCode)i));
+		out->print(": %llu",(unsigned long long)codes[i]);
+		first = false;
+	}
+	out->write(first ? "},\n" : "\n\t},\n");
+
+	out->write("\t\"files_with_problems\": [");
+	for (size_t i = 0; i < results.size(); ++i) {
+		const Result &r = results[i];
+		out->write(i ? ",\n\t\t{ \"path\": " : "\n\t\t{ \"path\": ");
+		out->string(r.path);
+		out->print(", \"status\": \"%s\", \"warnings\": %zu, \"errors\": %zu }",r.status,r.warnings,r.errors);
+	}
+	out->write(results.empty() ? "]\n}\n" : "\n\t]\n}\n");
+}
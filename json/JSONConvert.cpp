@@ -0,0 +1,655 @@
+//
+//  JSONConvert.cpp
+//  prettyjson
+//
+
+#include <stdlib.h>
+#include <math.h>
+#include <locale.h>
+#if defined(__APPLE__)
+#include <xlocale.h>
+#endif
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Powers of Five															*/
+/*																			*/
+/****************************************************************************/
+
+/*
+ *	Range of decimal exponents covered by the table. Parsing needs -342 to
+ *	308 (outside of that any 19 digit mantissa is zero or infinity); the
+ *	real formatter needs a little more on either side.
+ */
+
+#define POW5_MIN		-348
+#define POW5_MAX		347
+#define POW5_COUNT		(POW5_MAX - POW5_MIN + 1)
+
+#define PARSE_MIN		-342
+#define PARSE_MAX		308
+
+/*	BigNum
+ *
+ *		Just enough of an arbitrary precision unsigned integer to build the
+ *	table: multiply and divide by small values, and extract the top bits.
+ */
+
+struct BigNum
+{
+	uint32_t		limb[64];		/* little endian */
+	int				size;
+	
+	BigNum(uint32_t v = 0)
+		{
+			limb[0] = v;
+			size = v ? 1 : 0;
+		}
+	
+	void			setBit(int bit)
+		{
+			size = bit / 32 + 1;
+			memset(limb,0,size * sizeof(uint32_t));
+			limb[bit / 32] = 1U << (bit % 32);
+		}
+	
+	void			multiply(uint32_t v)
+		{
+			uint64_t carry = 0;
+			for (int i = 0; i < size; ++i) {
+				carry += (uint64_t)limb[i] * v;
+				limb[i] = (uint32_t)carry;
+				carry >>= 32;
+			}
+			if (carry) limb[size++] = (uint32_t)carry;
+		}
+	
+	void			divide(uint32_t v)
+		{
+			uint64_t rem = 0;
+			for (int i = size; i-- > 0; ) {
+				rem = (rem << 32) | limb[i];
+				limb[i] = (uint32_t)(rem / v);
+				rem %= v;
+			}
+			while ((size > 0) && (limb[size - 1] == 0)) --size;
+		}
+	
+	void			increment()
+		{
+			for (int i = 0; i < size; ++i) {
+				if (++limb[i]) return;
+			}
+			limb[size++] = 1;
+		}
+	
+	int				bits() const
+		{
+			if (size == 0) return 0;
+			return size * 32 - __builtin_clz(limb[size - 1]);
+		}
+	
+	bool			bit(int n) const
+		{
+			if ((n < 0) || (n >= size * 32)) return false;
+			return (limb[n / 32] >> (n % 32)) & 1;
+		}
+	
+	/*
+	 *	The 128 bits starting at the most significant bit, truncated or
+	 *	padded with zeros.
+	 */
+	
+	void			top128(uint64_t *hi, uint64_t *lo) const
+		{
+			int top = bits() - 1;
+			*hi = *lo = 0;
+			for (int i = 0; i < 64; ++i) {
+				*hi = (*hi << 1) | bit(top - i);
+				*lo = (*lo << 1) | bit(top - 64 - i);
+			}
+		}
+};
+
+/*	Pow5Table
+ *
+ *		128 bit approximations of 5^q for q from POW5_MIN to POW5_MAX,
+ *	normalized so the top bit is set. Positive powers are truncated; for
+ *	negative powers we store floor(2^b / 5^-q) + 1, as the Eisel-Lemire
+ *	algorithm expects. Built on first use with exact integer arithmetic,
+ *	dividing by 5^13 at a time.
+ */
+
+static const uint64_t *Pow5Table()
+{
+	static uint64_t *table = [] {
+		uint64_t *t = new uint64_t[2 * POW5_COUNT];
+		int bits5[-POW5_MIN + 1];
+		BigNum p(1);
+		
+		for (int q = 0; (q <= -POW5_MIN) || (q <= POW5_MAX); ++q) {
+			if (q <= -POW5_MIN) bits5[q] = p.bits();
+			if (q <= POW5_MAX) {
+				p.top128(&t[2 * (q - POW5_MIN)],&t[2 * (q - POW5_MIN) + 1]);
+			}
+			p.multiply(5);
+		}
+		
+		for (int q = -1; q >= POW5_MIN; --q) {
+			int n = -q;
+			int z = bits5[n];
+			int b = (n <= 27) ? z + 127 : 2 * z + 128;
+			
+			BigNum c;
+			c.setBit(b);
+			for (; n >= 13; n -= 13) c.divide(1220703125);		/* 5^13 */
+			for (; n > 0; --n) c.divide(5);
+			c.increment();
+			
+			c.top128(&t[2 * (q - POW5_MIN)],&t[2 * (q - POW5_MIN) + 1]);
+		}
+		return t;
+	}();
+	
+	return table;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Number Parsing															*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONTokenToInteger
+ *
+ *		Convert the number to an integer. Returns false if the number has a
+ *	fraction or exponent, or does not fit in 64 bits.
+ */
+
+bool JSONTokenToInteger(const JSONNumberToken &num, int64_t *value)
+{
+	if (num.isReal || num.truncated || (num.exponent != 0)) return false;
+	
+	if (num.negative) {
+		if (num.mantissa > (uint64_t)INT64_MAX + 1) return false;
+		*value = (int64_t)(0 - num.mantissa);
+	} else {
+		if (num.mantissa > (uint64_t)INT64_MAX) return false;
+		*value = (int64_t)num.mantissa;
+	}
+	return true;
+}
+
+/*	Multiply
+ *
+ *		64 x 64 -> 128 bit multiply
+ */
+
+static inline void Multiply(uint64_t a, uint64_t b, uint64_t *hi, uint64_t *lo)
+{
+	unsigned __int128 r = (unsigned __int128)a * b;
+	*hi = (uint64_t)(r >> 64);
+	*lo = (uint64_t)r;
+}
+
+/*	EiselLemire
+ *
+ *		Compute w * 10^q correctly rounded, for a nonzero w. This follows
+ *	the algorithm as published by Lemire ("Number Parsing at a Gigabyte
+ *	per Second"): a 64 x 128 bit product with the power of five gives
+ *	enough bits to round correctly, including subnormals.
+ */
+
+static double EiselLemire(uint64_t w, int64_t q, bool negative)
+{
+	uint64_t mantissa;
+	int64_t power2;
+	
+	if (q < PARSE_MIN) {
+		mantissa = 0;
+		power2 = 0;
+	} else if (q > PARSE_MAX) {
+		mantissa = 0;
+		power2 = 0x7FF;
+	} else {
+		const uint64_t *pow5 = Pow5Table() + 2 * (q - POW5_MIN);
+		int lz = __builtin_clzll(w);
+		w <<= lz;
+		
+		/*
+		 *	We need the top 55 bits of the product; only consult the low
+		 *	half of the power if the bits below those could carry.
+		 */
+		
+		uint64_t hi,lo;
+		Multiply(w,pow5[0],&hi,&lo);
+		if ((hi & 0x1FF) == 0x1FF) {
+			uint64_t hi2,lo2;
+			Multiply(w,pow5[1],&hi2,&lo2);
+			lo += hi2;
+			if (hi2 > lo) ++hi;
+		}
+		
+		int upper = (int)(hi >> 63);
+		mantissa = hi >> (upper + 9);
+		power2 = ((((152170 + 65536) * q) >> 16) + 63) + upper - lz + 1023;
+		
+		if (power2 <= 0) {
+			/*
+			 *	Subnormal
+			 */
+			
+			if (-power2 + 1 >= 64) {
+				mantissa = 0;
+				power2 = 0;
+			} else {
+				mantissa >>= -power2 + 1;
+				mantissa += (mantissa & 1);
+				mantissa >>= 1;
+				power2 = (mantissa < (1ULL << 52)) ? 0 : 1;
+			}
+		} else {
+			/*
+			 *	Exactly halfway between two doubles: round to even
+			 */
+			
+			if ((lo <= 1) && (q >= -4) && (q <= 23) && ((mantissa & 3) == 1)) {
+				if ((mantissa << (upper + 9)) == hi) {
+					mantissa &= ~1ULL;
+				}
+			}
+			
+			mantissa += (mantissa & 1);
+			mantissa >>= 1;
+			if (mantissa >= (2ULL << 52)) {
+				mantissa = 1ULL << 52;
+				++power2;
+			}
+			mantissa &= ~(1ULL << 52);
+			
+			if (power2 >= 0x7FF) {
+				mantissa = 0;
+				power2 = 0x7FF;
+			}
+		}
+	}
+	
+	uint64_t bits = mantissa | ((uint64_t)power2 << 52);
+	if (negative) bits |= 1ULL << 63;
+	
+	double d;
+	memcpy(&d,&bits,sizeof(d));
+	return d;
+}
+
+/*	CLocale
+ *
+ *		The "C" locale, so the fallback conversion ignores the user's locale
+ */
+
+static locale_t CLocale()
+{
+	static locale_t loc = newlocale(LC_ALL_MASK,"C",(locale_t)0);
+	return loc;
+}
+
+/*	JSONTokenToReal
+ *
+ *		Convert the number to a double, correctly rounded. Small values with
+ *	small exponents are exact in double arithmetic (Clinger's fast path);
+ *	everything else with a mantissa that holds all the digits goes through
+ *	Eisel-Lemire. Numbers with more than 19 significant digits fall back on
+ *	strtod in the C locale, using the text of the token.
+ */
+
+double JSONTokenToReal(const JSONNumberToken &num, const char *text)
+{
+	static const double pow10[] = {
+		1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+		1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+	};
+	
+	if (!num.truncated) {
+		if (num.mantissa == 0) return num.negative ? -0.0 : 0.0;
+		
+		if ((num.mantissa <= (1ULL << 53)) && (num.exponent >= -22) && (num.exponent <= 22)) {
+			double d = (double)num.mantissa;
+			if (num.exponent < 0) {
+				d /= pow10[-num.exponent];
+			} else {
+				d *= pow10[num.exponent];
+			}
+			return num.negative ? -d : d;
+		}
+		
+		return EiselLemire(num.mantissa,num.exponent,num.negative);
+	}
+	
+	return strtod_l(text,NULL,CLocale());
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Number Formatting														*/
+/*																			*/
+/****************************************************************************/
+
+/*
+ *	Pairs of decimal digits, for writing two digits at a time
+ */
+
+static const char GDigits[] =
+	"00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+	"40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+	"8081828384858687888990919293949596979899";
+
+/*	JSONWriteInteger
+ *
+ *		Write the integer to the buffer, which must hold at least 21 bytes.
+ *	Returns the end of the written text.
+ */
+
+char *JSONWriteInteger(char *buf, int64_t value)
+{
+	char tmp[20];
+	char *p = tmp + sizeof(tmp);
+	uint64_t v = (uint64_t)value;
+	
+	if (value < 0) {
+		*buf++ = '-';
+		v = 0 - v;
+	}
+	
+	while (v >= 100) {
+		const char *d = GDigits + 2 * (v % 100);
+		v /= 100;
+		*--p = d[1];
+		*--p = d[0];
+	}
+	if (v >= 10) {
+		*--p = GDigits[2 * v + 1];
+		*--p = GDigits[2 * v];
+	} else {
+		*--p = (char)('0' + v);
+	}
+	
+	size_t len = tmp + sizeof(tmp) - p;
+	memcpy(buf,p,len);
+	return buf + len;
+}
+
+/*	DiyFp
+ *
+ *		A floating point value with a 64 bit significand, f * 2^e
+ */
+
+struct DiyFp
+{
+	uint64_t		f;
+	int				e;
+};
+
+static inline DiyFp Multiply(DiyFp x, DiyFp y)
+{
+	uint64_t hi,lo;
+	Multiply(x.f,y.f,&hi,&lo);
+	if (lo & (1ULL << 63)) ++hi;				/* round */
+	
+	DiyFp r = { hi, x.e + y.e + 64 };
+	return r;
+}
+
+static inline DiyFp Normalize(DiyFp x)
+{
+	int s = __builtin_clzll(x.f);
+	DiyFp r = { x.f << s, x.e - s };
+	return r;
+}
+
+/*	CachedPower
+ *
+ *		Return 10^k as a DiyFp, choosing k so that a value with binary
+ *	exponent e multiplied by it has an exponent between -60 and -32. The
+ *	significand is the power of five table entry rounded to 64 bits.
+ */
+
+static DiyFp CachedPower(int e, int *k)
+{
+	int q = (int)ceil((-61 - e) * 0.30102999566398114);
+	const uint64_t *pow5 = Pow5Table() + 2 * (q - POW5_MIN);
+	
+	DiyFp c;
+	c.f = pow5[0] + (pow5[1] >> 63);
+	c.e = ((217706 * q) >> 16) - 63;
+	if (c.f == 0) {								/* rounded up to 2^64 */
+		c.f = 1ULL << 63;
+		++c.e;
+	}
+	
+	*k = q;
+	return c;
+}
+
+/*	GrisuRound
+ *
+ *		Move the last digit down while that brings us closer to the value
+ *	and stays within the rounding interval
+ */
+
+static inline void GrisuRound(char *buffer, int len, uint64_t delta, uint64_t rest, uint64_t tenKappa, uint64_t wpw)
+{
+	while ((rest < wpw) && (delta - rest >= tenKappa) &&
+			((rest + tenKappa < wpw) || (wpw - rest > rest + tenKappa - wpw))) {
+		buffer[len - 1]--;
+		rest += tenKappa;
+	}
+}
+
+/*	DigitGen
+ *
+ *		Generate the shortest digits within delta of the upper boundary
+ */
+
+static void DigitGen(DiyFp w, DiyFp mp, uint64_t delta, char *buffer, int *len, int *k)
+{
+	static const uint64_t pow10[] = {
+		1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+		10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL,
+		100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+		100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL,
+		100000000000000000ULL, 1000000000000000000ULL, 10000000000000000000ULL
+	};
+	
+	int shift = -mp.e;
+	uint64_t one = 1ULL << shift;
+	uint64_t wpw = mp.f - w.f;
+	uint32_t p1 = (uint32_t)(mp.f >> shift);
+	uint64_t p2 = mp.f & (one - 1);
+	
+	int kappa = 1;
+	while ((kappa < 10) && (p1 >= pow10[kappa])) ++kappa;
+	
+	*len = 0;
+	while (kappa > 0) {
+		uint32_t div = (uint32_t)pow10[kappa - 1];
+		uint32_t d = p1 / div;
+		p1 %= div;
+		
+		if (d || *len) buffer[(*len)++] = (char)('0' + d);
+		--kappa;
+		
+		uint64_t rest = ((uint64_t)p1 << shift) + p2;
+		if (rest <= delta) {
+			*k += kappa;
+			GrisuRound(buffer,*len,delta,rest,pow10[kappa] << shift,wpw);
+			return;
+		}
+	}
+	
+	for (;;) {
+		p2 *= 10;
+		delta *= 10;
+		char d = (char)(p2 >> shift);
+		if (d || *len) buffer[(*len)++] = (char)('0' + d);
+		p2 &= one - 1;
+		--kappa;
+		
+		if (p2 < delta) {
+			*k += kappa;
+			int index = -kappa;
+			GrisuRound(buffer,*len,delta,p2,one,wpw * (index < 20 ? pow10[index] : 0));
+			return;
+		}
+	}
+}
+
+/*	Grisu2
+ *
+ *		Find the shortest digits (almost always; always enough to read back
+ *	the same value) for a positive, finite, nonzero double. The value is
+ *	buffer * 10^k. This is Florian Loitsch's Grisu2, as used in RapidJSON.
+ */
+
+static void Grisu2(double value, char *buffer, int *len, int *k)
+{
+	uint64_t bits;
+	memcpy(&bits,&value,sizeof(bits));
+	
+	int biased = (int)((bits >> 52) & 0x7FF);
+	DiyFp v;
+	v.f = bits & ((1ULL << 52) - 1);
+	if (biased) {
+		v.f += 1ULL << 52;
+		v.e = biased - 1075;
+	} else {
+		v.e = -1074;
+	}
+	
+	/*
+	 *	Boundaries halfway to the neighboring doubles, with the same
+	 *	exponent. The lower boundary is closer if we are at a power of two.
+	 */
+	
+	DiyFp plus = { (v.f << 1) + 1, v.e - 1 };
+	while (!(plus.f & (1ULL << 53))) {
+		plus.f <<= 1;
+		--plus.e;
+	}
+	plus.f <<= 10;
+	plus.e -= 10;
+	
+	DiyFp minus;
+	if (v.f == (1ULL << 52)) {
+		minus.f = (v.f << 2) - 1;
+		minus.e = v.e - 2;
+	} else {
+		minus.f = (v.f << 1) - 1;
+		minus.e = v.e - 1;
+	}
+	minus.f <<= minus.e - plus.e;
+	minus.e = plus.e;
+	
+	DiyFp c = CachedPower(plus.e,k);
+	DiyFp w = Multiply(Normalize(v),c);
+	DiyFp wp = Multiply(plus,c);
+	DiyFp wm = Multiply(minus,c);
+	++wm.f;
+	--wp.f;
+	
+	*k = -*k;
+	DigitGen(w,wp,wp.f - wm.f,buffer,len,k);
+}
+
+/*	WriteExponent
+ *
+ *		Write a decimal exponent
+ */
+
+static char *WriteExponent(char *buf, int k)
+{
+	if (k < 0) {
+		*buf++ = '-';
+		k = -k;
+	}
+	
+	if (k >= 100) {
+		*buf++ = (char)('0' + k / 100);
+		k %= 100;
+		*buf++ = GDigits[2 * k];
+		*buf++ = GDigits[2 * k + 1];
+	} else if (k >= 10) {
+		*buf++ = GDigits[2 * k];
+		*buf++ = GDigits[2 * k + 1];
+	} else {
+		*buf++ = (char)('0' + k);
+	}
+	return buf;
+}
+
+/*	JSONWriteReal
+ *
+ *		Write the shortest text which reads back as the same double. Values
+ *	from 1e-6 up to 1e21 are written in decimal, and keep a ".0" if they
+ *	are integral so they read back as reals; anything else is written with
+ *	an exponent. Infinity (which we get from parsing huge exponents) is
+ *	written as 1e999 so that it reads back the same way. The buffer must
+ *	hold at least 32 bytes. Returns the end of the written text.
+ */
+
+char *JSONWriteReal(char *buf, double value)
+{
+	if (value != value) {
+		memcpy(buf,"null",4);
+		return buf + 4;
+	}
+	
+	if (signbit(value)) {
+		*buf++ = '-';
+		value = -value;
+	}
+	
+	if (value == 0) {
+		memcpy(buf,"0.0",3);
+		return buf + 3;
+	}
+	if (isinf(value)) {
+		memcpy(buf,"1e999",5);
+		return buf + 5;
+	}
+	
+	int len,k;
+	Grisu2(value,buf,&len,&k);
+	
+	int kk = len + k;							/* 10^(kk-1) <= value < 10^kk */
+	if ((k >= 0) && (kk <= 21)) {
+		/* 1234e7 -> 12340000000.0 */
+		for (int i = len; i < kk; ++i) buf[i] = '0';
+		buf[kk] = '.';
+		buf[kk + 1] = '0';
+		return buf + kk + 2;
+	} else if ((kk > 0) && (kk <= 21)) {
+		/* 1234e-2 -> 12.34 */
+		memmove(buf + kk + 1,buf + kk,len - kk);
+		buf[kk] = '.';
+		return buf + len + 1;
+	} else if ((kk > -6) && (kk <= 0)) {
+		/* 1234e-6 -> 0.001234 */
+		int offset = 2 - kk;
+		memmove(buf + offset,buf,len);
+		buf[0] = '0';
+		buf[1] = '.';
+		for (int i = 2; i < offset; ++i) buf[i] = '0';
+		return buf + len + offset;
+	} else if (len == 1) {
+		/* 1e30 */
+		buf[1] = 'e';
+		return WriteExponent(buf + 2,kk - 1);
+	} else {
+		/* 1234e30 -> 1.234e33 */
+		memmove(buf + 2,buf + 1,len - 1);
+		buf[1] = '.';
+		buf[len + 1] = 'e';
+		return WriteExponent(buf + len + 2,kk - 1);
+	}
+}
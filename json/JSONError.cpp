@@ -0,0 +1,150 @@
+//
+//  JSONError.cpp
+//  prettyjson
+//
+
+#include <stdio.h>
+#include <string.h>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Messages																*/
+/*																			*/
+/****************************************************************************/
+
+/*	GMessages
+ *
+ *		The message for each error code, and a summary of it without the
+ *	argument. Messages with an argument take it as %s (text) or %zu.
+ */
+
+static const struct {
+	const char		*message;
+	const char		*summary;
+} GMessages[JSONErrorCodeCount] = {
+	{ "token %s unexpected", "unexpected token" },
+	{ "expected object key as a string", NULL },
+	{ "expected ':' separating key from value", NULL },
+	{ "expected ',' separating key/value pairs in object", NULL },
+	{ "comma expected between array values", NULL },
+	{ "close after comma", NULL },
+	{ "close array instead of close object", NULL },
+	{ "close object instead of close array", NULL },
+	
+	{ "unexpected EOF", NULL },
+	{ "token %s illegal", "illegal token" },
+	{ "nesting deeper than %zu levels", "nesting too deep" },
+	{ "token longer than %zu bytes", "token too long" },
+	{ "more than %zu tokens", "too many tokens" },
+	{ "input longer than %zu bytes", "input too long" },
+	{ "Unbalanced close array and object markers make file invalid", NULL },
+	{ "INTERNAL ERROR: Multiple values without wrapped object", NULL }
+};
+
+/****************************************************************************/
+/*																			*/
+/*	Diagnostics																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONError::setText
+ *
+ *		Set the text argument. Text which does not fit is cut short and
+ *	marked with "..."
+ */
+
+void JSONError::setText(std::string_view str)
+{
+	size_t len = str.size();
+	
+	if (len > sizeof(text)) {
+		memcpy(text,str.data(),sizeof(text) - 3);
+		memcpy(text + sizeof(text) - 3,"...",3);
+		len = sizeof(text);
+	} else {
+		memcpy(text,str.data(),len);
+	}
+	textLength = (uint8_t)len;
+}
+
+/*	JSONError::render
+ *
+ *		Format the message
+ */
+
+size_t JSONError::render(char *buf, size_t size) const
+{
+	const char *msg = GMessages[code].message;
+	int len;
+	
+	if (strstr(msg,"%s")) {
+		char str[sizeof(text) + 1];
+		memcpy(str,text,textLength);
+		str[textLength] = 0;
+		len = snprintf(buf,size,msg,str);
+	} else {
+		len = snprintf(buf,size,msg,(size_t)arg);
+	}
+	
+	if (len < 0) return 0;
+	return ((size_t)len < size) ? (size_t)len : size - 1;
+}
+
+std::string JSONError::getError() const
+{
+	char buffer[512];
+	
+	size_t len = render(buffer,sizeof(buffer));
+	return std::string(buffer,len);
+}
+
+/*	JSONError::summary
+ *
+ *		Describe an error code, for reporting how many of them there were
+ */
+
+const char *JSONError::summary(JSONErrorCode code)
+{
+	return GMessages[code].summary ? GMessages[code].summary : GMessages[code].message;
+}
+
+/*	JSONDiagnostics::JSONDiagnostics
+ *
+ *		Diagnostics, with no limit
+ */
+
+JSONDiagnostics::JSONDiagnostics()
+{
+	limit = 0;
+	memset(counts,0,sizeof(counts));
+	memset(kept,0,sizeof(kept));
+}
+
+/*	JSONDiagnostics::clear
+ *
+ *		Forget the diagnostics and counts, but not the limit
+ */
+
+void JSONDiagnostics::clear()
+{
+	std::vector<JSONError>::clear();
+	memset(counts,0,sizeof(counts));
+	memset(kept,0,sizeof(kept));
+}
+
+/*	JSONDiagnostics::merge
+ *
+ *		Add the diagnostics from another parse. Those it counted but did not
+ *	keep are counted here too.
+ */
+
+void JSONDiagnostics::merge(const JSONDiagnostics &d)
+{
+	for (const_iterator iter = d.begin(); iter != d.end(); ++iter) {
+		add(*iter);
+	}
+	for (int i = 0; i < JSONErrorCodeCount; ++i) {
+		counts[i] += d.getDropped((JSONErrorCode)i);
+	}
+}
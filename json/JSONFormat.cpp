@@ -0,0 +1,559 @@
+//
+//  JSONFormat.cpp
+//  prettyjson
+//
+//  Created by William Woody on 10/15/21.
+//
+
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	DOM Formatter															*/
+/*																			*/
+/****************************************************************************/
+
+/*	NodeFrame
+ *
+ *		An open container while walking a DOM. The walk keeps its own stack
+ *	rather than recursing, so the depth of a document is limited only by
+ *	memory.
+ */
+
+struct NodeFrame
+{
+	JSONNode	*node;
+	bool		isObject;
+	bool		sameLine;
+	int			depth;
+	size_t		index;
+	size_t		size;
+};
+
+/*	OpenNode
+ *
+ *		If the node is a container, push a frame for it and return true
+ */
+
+static bool OpenNode(std::vector<NodeFrame> &stack, JSONNode *node, int depth, bool sameLine)
+{
+	JSONType type = node->type();
+	size_t size;
+
+	if (type == JSONTypeObject) {
+		size = static_cast<JSONObject *>(node)->size();
+	} else if (type == JSONTypeArray) {
+		size = static_cast<JSONArray *>(node)->size();
+	} else {
+		return false;
+	}
+
+	NodeFrame f = { node, type == JSONTypeObject, sameLine, depth, 0, size };
+	stack.push_back(f);
+	return true;
+}
+
+/*	NextMember
+ *
+ *		Return the next member of the container in the frame, and its key
+ *	in key if the container is an object
+ */
+
+static JSONNode *NextMember(NodeFrame &f, std::string_view *key)
+{
+	size_t i = f.index++;
+
+	if (f.isObject) {
+		JSONObject::Member &m = *(static_cast<JSONObject *>(f.node)->begin() + i);
+		*key = m.first;
+		return m.second;
+	}
+	return (*static_cast<JSONArray *>(f.node))[i];
+}
+
+/*	FormatScalar
+ *
+ *		Write a value which is not a container
+ */
+
+static void FormatScalar(JSONNode *node, JSONWriter *out)
+{
+	JSONType type = node->type();
+
+	if (type == JSONTypeString) {
+		out->string(*static_cast<JSONString *>(node));
+	} else if (type == JSONTypeNumber) {
+		JSONNumber *n = static_cast<JSONNumber *>(node);
+		if (n->isIntegerValue()) {
+			out->integer(n->intValue());
+		} else {
+			out->real(n->realValue());
+		}
+	} else if (type == JSONTypeBoolean) {
+		JSONNumber *n = static_cast<JSONNumber *>(node);
+		if (n->boolValue()) {
+			out->write("true",4);
+		} else {
+			out->write("false",5);
+		}
+	} else {
+		out->write("null",4);
+	}
+}
+
+/*	JSONFormat
+ *
+ *		Pretty print the node. The type() check tells us the concrete class,
+ *	so we cast directly rather than going through dynamic_cast.
+ */
+
+void JSONFormat(JSONNode *node, JSONWriter *out, int depth, bool sameLine)
+{
+	std::vector<NodeFrame> stack;
+
+	for (;;) {
+		if (!stack.empty()) {
+			NodeFrame &f = stack.back();
+
+			if (f.index == f.size) {
+				out->newline(f.depth-1);
+				out->put(f.isObject ? '}' : ']');
+
+				stack.pop_back();
+				if (stack.empty()) break;
+				continue;
+			}
+
+			if (f.index == 0) {
+				if (f.sameLine) {
+					out->newline(f.depth);
+				}
+			} else {
+				out->put(',');
+				out->put(' ');
+				out->newline(f.depth);
+			}
+
+			std::string_view key;
+			node = NextMember(f,&key);
+			if (f.isObject) {
+				out->string(key);
+				out->write(": ",2);
+			}
+
+			depth = f.depth + 1;
+			sameLine = true;
+		}
+
+		if (OpenNode(stack,node,depth,sameLine)) {
+			out->write(stack.back().isObject ? "{ " : "[ ",2);
+			continue;
+		}
+
+		FormatScalar(node,out);
+		if (stack.empty()) break;
+	}
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Tape Formatter															*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONFormat
+ *
+ *		Format a tape with a single linear pass. This produces the same layout
+ *	as the DOM formatter; the stack only tracks the open containers.
+ */
+
+struct TapeFrame
+{
+	bool		isObject;
+	bool		sameLine;
+	int			depth;
+	size_t		count;
+};
+
+void JSONFormat(JSONTapeCursor c, JSONWriter *out)
+{
+	std::vector<TapeFrame> stack;
+
+	if (!c.isValid()) return;
+
+	for (;;) {
+		int depth = 0;
+		bool sameLine = false;
+
+		if (!stack.empty()) {
+			TapeFrame &f = stack.back();
+
+			if (c.isEnd()) {
+				out->newline(f.depth-1);
+				out->put(f.isObject ? '}' : ']');
+
+				stack.pop_back();
+				c = c.next();						/* step past end */
+				if (stack.empty()) break;
+				continue;
+			}
+
+			if (f.count++ == 0) {
+				if (f.sameLine) {
+					out->newline(f.depth);
+				}
+			} else {
+				out->put(',');
+				out->put(' ');
+				out->newline(f.depth);
+			}
+
+			if (f.isObject) {
+				out->string(c.stringValue());
+				out->write(": ",2);
+				c = c.next();
+			}
+
+			depth = f.depth + 1;
+			sameLine = true;
+		}
+
+		JSONTapeTag tag = c.tag();
+		if ((tag == JSONTapeStartObject) || (tag == JSONTapeStartArray)) {
+			TapeFrame f = { tag == JSONTapeStartObject, sameLine, depth, 0 };
+			out->write(f.isObject ? "{ " : "[ ",2);
+			stack.push_back(f);
+			c = c.first();
+			continue;
+		}
+
+		if (tag == JSONTapeString) {
+			out->string(c.stringValue());
+		} else if (tag == JSONTapeInteger) {
+			out->integer(c.intValue());
+		} else if (tag == JSONTapeReal) {
+			out->real(c.realValue());
+		} else if (tag == JSONTapeTrue) {
+			out->write("true",4);
+		} else if (tag == JSONTapeFalse) {
+			out->write("false",5);
+		} else {
+			out->write("null",4);
+		}
+
+		if (stack.empty()) break;
+		c = c.next();
+	}
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Stream Formatter														*/
+/*																			*/
+/****************************************************************************/
+
+JSONStreamFormatter::JSONStreamFormatter(JSONWriter *w)
+{
+	out = w;
+	hasKey = false;
+	wrote = false;
+	minify = false;
+}
+
+JSONStreamFormatter::~JSONStreamFormatter()
+{
+}
+
+/*	JSONStreamFormatter::format
+ *
+ *		Parse and format the input
+ */
+
+bool JSONStreamFormatter::format(JSONLexer *lexer)
+{
+	stack.clear();
+	hasKey = false;
+	wrote = false;
+	return parse(lexer,true);
+}
+
+/*	JSONStreamFormatter::startPush
+ *
+ *		Start formatting pushed input (see BasicJSONParser::feed)
+ */
+
+void JSONStreamFormatter::startPush()
+{
+	stack.clear();
+	hasKey = false;
+	wrote = false;
+	BasicJSONParser::startPush();
+}
+
+/*	JSONStreamFormatter::formatRange
+ *
+ *		Format part of a large container (see BasicJSONParser::parseRange). The
+ *	first part writes the opening bracket and the last part the closing
+ *	bracket, so the parts concatenated in order are the same as the output
+ *	of format(). Returns false if the part did not end cleanly.
+ */
+
+bool JSONStreamFormatter::formatRange(JSONLexer *lexer, bool isObject, bool first, bool last)
+{
+	Frame f = { false, 0, first ? (size_t)0 : (size_t)1 };
+	
+	stack.clear();
+	stack.push_back(f);
+	hasKey = false;
+	wrote = true;
+	
+	if (first) out->write(isObject ? "{ " : "[ ",minify ? 1 : 2);
+	
+	bool clean = parseRange(lexer,isObject,first,last,true);
+	
+	if (last) {
+		endContainer();
+		out->put(isObject ? '}' : ']');
+	}
+	return clean;
+}
+
+/*	JSONStreamFormatter::startValue
+ *
+ *		Emit the separator and key before a value, and return the depth and
+ *	same line flag the value would be formatted with. The key is held until
+ *	its value arrives, so a key whose value could not be parsed is dropped
+ *	just as the record parser drops it.
+ */
+
+void JSONStreamFormatter::startValue(int *depth, bool *sameLine)
+{
+	int d = 0;
+	bool s = false;
+
+	wrote = true;
+	if (!stack.empty()) {
+		Frame &f = stack.back();
+		if (minify) {
+			if (f.count++ > 0) out->put(',');
+		} else if (f.count++ == 0) {
+			if (f.sameLine) {
+				out->newline(f.depth);
+			}
+		} else {
+			out->put(',');
+			out->put(' ');
+			out->newline(f.depth);
+		}
+
+		if (hasKey) {
+			out->string(keyView);
+			out->write(": ",minify ? 1 : 2);
+			hasKey = false;
+		}
+
+		d = f.depth + 1;
+		s = true;
+	}
+
+	if (depth) *depth = d;
+	if (sameLine) *sameLine = s;
+}
+
+void JSONStreamFormatter::startContainer()
+{
+	Frame f;
+	startValue(&f.depth,&f.sameLine);
+	f.count = 0;
+	stack.push_back(f);
+}
+
+void JSONStreamFormatter::endContainer()
+{
+	if (!minify) out->newline(stack.back().depth-1);
+	stack.pop_back();
+	hasKey = false;
+}
+
+void JSONStreamFormatter::null()
+{
+	startValue();
+	out->write("null",4);
+}
+
+void JSONStreamFormatter::boolean(bool value)
+{
+	startValue();
+	if (value) {
+		out->write("true",4);
+	} else {
+		out->write("false",5);
+	}
+}
+
+void JSONStreamFormatter::integer(int64_t value)
+{
+	startValue();
+	out->integer(value);
+}
+
+void JSONStreamFormatter::real(double value)
+{
+	startValue();
+	out->real(value);
+}
+
+void JSONStreamFormatter::string(std::string_view value)
+{
+	startValue();
+	out->string(value);
+}
+
+void JSONStreamFormatter::startArray()
+{
+	startContainer();
+	out->write("[ ",minify ? 1 : 2);
+}
+
+void JSONStreamFormatter::endArray()
+{
+	endContainer();
+	out->put(']');
+}
+
+void JSONStreamFormatter::startObject()
+{
+	startContainer();
+	out->write("{ ",minify ? 1 : 2);
+}
+
+void JSONStreamFormatter::endObject()
+{
+	endContainer();
+	out->put('}');
+}
+
+/*	JSONStreamFormatter::objectKey
+ *
+ *		Hold the key until its value arrives. Reading the value may replace
+ *	the input block, so the key is copied unless it is borrowed.
+ */
+
+void JSONStreamFormatter::objectKey(std::string_view value)
+{
+	if (isBorrowed()) {
+		keyView = value;
+	} else {
+		key.assign(value);
+		keyView = key;
+	}
+	hasKey = true;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Minified Formatter														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONMinify
+ *
+ *		Write the node with no whitespace
+ */
+
+void JSONMinify(JSONNode *node, JSONWriter *out)
+{
+	std::vector<NodeFrame> stack;
+
+	for (;;) {
+		if (!stack.empty()) {
+			NodeFrame &f = stack.back();
+
+			if (f.index == f.size) {
+				out->put(f.isObject ? '}' : ']');
+
+				stack.pop_back();
+				if (stack.empty()) break;
+				continue;
+			}
+
+			if (f.index > 0) out->put(',');
+
+			std::string_view key;
+			node = NextMember(f,&key);
+			if (f.isObject) {
+				out->string(key);
+				out->put(':');
+			}
+		}
+
+		if (OpenNode(stack,node,0,false)) {
+			out->put(stack.back().isObject ? '{' : '[');
+			continue;
+		}
+
+		FormatScalar(node,out);
+		if (stack.empty()) break;
+	}
+}
+
+/*	JSONMinify
+ *
+ *		Write a tape with no whitespace, in a single linear pass
+ */
+
+void JSONMinify(JSONTapeCursor c, JSONWriter *out)
+{
+	std::vector<TapeFrame> stack;
+
+	if (!c.isValid()) return;
+
+	for (;;) {
+		if (!stack.empty()) {
+			TapeFrame &f = stack.back();
+
+			if (c.isEnd()) {
+				out->put(f.isObject ? '}' : ']');
+
+				stack.pop_back();
+				c = c.next();						/* step past end */
+				if (stack.empty()) break;
+				continue;
+			}
+
+			if (f.count++ > 0) out->put(',');
+
+			if (f.isObject) {
+				out->string(c.stringValue());
+				out->put(':');
+				c = c.next();
+			}
+		}
+
+		JSONTapeTag tag = c.tag();
+		if ((tag == JSONTapeStartObject) || (tag == JSONTapeStartArray)) {
+			TapeFrame f = { tag == JSONTapeStartObject, false, 0, 0 };
+			out->put(f.isObject ? '{' : '[');
+			stack.push_back(f);
+			c = c.first();
+			continue;
+		}
+
+		if (tag == JSONTapeString) {
+			out->string(c.stringValue());
+		} else if (tag == JSONTapeInteger) {
+			out->integer(c.intValue());
+		} else if (tag == JSONTapeReal) {
+			out->real(c.realValue());
+		} else if (tag == JSONTapeTrue) {
+			out->write("true",4);
+		} else if (tag == JSONTapeFalse) {
+			out->write("false",5);
+		} else {
+			out->write("null",4);
+		}
+
+		if (stack.empty()) break;
+		c = c.next();
+	}
+}
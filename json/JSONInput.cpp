@@ -0,0 +1,408 @@
+//
+//  JSONInput.cpp
+//  prettyjson
+//
+
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Input Source															*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONInput::JSONInput
+ *
+ *		Base class for input sources
+ */
+
+JSONInput::JSONInput()
+{
+}
+
+JSONInput::~JSONInput()
+{
+}
+
+bool JSONInput::isPersistent()
+{
+	return false;
+}
+
+bool JSONInput::isWaiting()
+{
+	return false;
+}
+
+/*	JSONOpenInput
+ *
+ *		Memory map regular files, and read everything else in blocks
+ */
+
+JSONInput *JSONOpenInput(int fd)
+{
+	JSONMappedInput *mapped = new JSONMappedInput(fd);
+	if (mapped->isValid()) return mapped;
+
+	delete mapped;
+	return new JSONReadInput(fd);
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Memory Input															*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONMemoryInput::JSONMemoryInput
+ *
+ *		Wrap the buffer; we return it as a single block
+ */
+
+JSONMemoryInput::JSONMemoryInput(const void *data, size_t len)
+{
+	buffer = (const uint8_t *)data;
+	length = len;
+	done = false;
+}
+
+JSONMemoryInput::~JSONMemoryInput()
+{
+}
+
+size_t JSONMemoryInput::read(const uint8_t **data)
+{
+	if (done) return 0;
+	done = true;
+
+	*data = buffer;
+	return length;
+}
+
+bool JSONMemoryInput::isPersistent()
+{
+	return true;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Memory Mapped Input														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONMappedInput::JSONMappedInput
+ *
+ *		Map the file from the current file position to the end. We hint to
+ *	the kernel that we will be reading sequentially, so it can read ahead
+ *	aggressively and drop pages behind us.
+ */
+
+JSONMappedInput::JSONMappedInput(int fd)
+{
+	struct stat st;
+
+	map = NULL;
+	mapLength = 0;
+	offset = 0;
+	valid = false;
+	done = false;
+
+	if (fstat(fd,&st) || !S_ISREG(st.st_mode)) return;
+
+	off_t pos = lseek(fd,0,SEEK_CUR);
+	if ((pos < 0) || (pos > st.st_size)) return;
+
+	/*
+	 *	Empty files cannot be mapped, but are valid input.
+	 */
+
+	valid = true;
+	if (st.st_size == 0) return;
+
+	mapLength = (size_t)st.st_size;
+	offset = (size_t)pos;
+	map = mmap(NULL,mapLength,PROT_READ,MAP_PRIVATE,fd,0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		valid = false;
+		return;
+	}
+
+#if defined(POSIX_FADV_SEQUENTIAL)
+	posix_fadvise(fd,0,0,POSIX_FADV_SEQUENTIAL);
+#elif defined(F_RDAHEAD)
+	fcntl(fd,F_RDAHEAD,1);
+#endif
+	madvise(map,mapLength,MADV_SEQUENTIAL);
+	madvise(map,mapLength,MADV_WILLNEED);
+}
+
+JSONMappedInput::~JSONMappedInput()
+{
+	if (map) munmap(map,mapLength);
+}
+
+size_t JSONMappedInput::read(const uint8_t **data)
+{
+	if (done || (map == NULL)) return 0;
+	done = true;
+
+	*data = offset + (const uint8_t *)map;
+	return mapLength - offset;
+}
+
+bool JSONMappedInput::isPersistent()
+{
+	return true;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Block Read Input														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONReadInput::JSONReadInput
+ *
+ *		Read from a pipe or terminal in large blocks.
+ */
+
+JSONReadInput::JSONReadInput(int f, size_t size)
+{
+	fd = f;
+	blockSize = size;
+	buffer = (uint8_t *)malloc(blockSize);
+}
+
+JSONReadInput::~JSONReadInput()
+{
+	free(buffer);
+}
+
+size_t JSONReadInput::read(const uint8_t **data)
+{
+	ssize_t len;
+
+	if (buffer == NULL) return 0;
+
+	do {
+		len = ::read(fd,buffer,blockSize);
+	} while ((len < 0) && (errno == EINTR));
+
+	if (len <= 0) return 0;
+
+	*data = buffer;
+	return (size_t)len;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Stdio Input																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONStdioInput::JSONStdioInput
+ *
+ *		Read from a FILE. We read in large blocks so we only take the stdio
+ *	lock once per block rather than once per character.
+ */
+
+JSONStdioInput::JSONStdioInput(FILE *f, size_t size)
+{
+	file = f;
+	blockSize = size;
+	buffer = (uint8_t *)malloc(blockSize);
+}
+
+JSONStdioInput::~JSONStdioInput()
+{
+	free(buffer);
+}
+
+size_t JSONStdioInput::read(const uint8_t **data)
+{
+	if (buffer == NULL) return 0;
+
+	size_t len = fread(buffer,1,blockSize,file);
+	if (len == 0) return 0;
+
+	*data = buffer;
+	return len;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Push Input																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONPushInput::JSONPushInput
+ *
+ *		Input which is pushed to us rather than read
+ */
+
+JSONPushInput::JSONPushInput()
+{
+	block = NULL;
+	length = 0;
+	next = 2;
+	skip = NULL;
+	cut = NULL;
+	inString = false;
+	escaped = false;
+	finished = false;
+}
+
+JSONPushInput::~JSONPushInput()
+{
+}
+
+/*	JSONPushInput::scan
+ *
+ *		Track the string state through a run of bytes, setting cut after
+ *	each byte outside a string which ends a token: whitespace, punctuation
+ *	or a closing quote. With findCut false only the quotes and backslashes
+ *	are looked at, which is all it takes to follow the string state.
+ */
+
+void JSONPushInput::scan(const uint8_t *p, const uint8_t *e, bool findCut)
+{
+	JSONBlockMasks m;
+	
+	while (p < e) {
+		size_t n = e - p;
+		uint64_t valid = ~0ULL;
+		if (n >= 64) {
+			n = 64;
+			JSONScanner::classify(p,&m);
+		} else {
+			JSONScanner::classify(p,n,&m);
+			valid = (1ULL << n) - 1;
+		}
+		
+		uint64_t bits = m.quote | m.backslash;
+		if (findCut) bits |= m.structural;
+		
+		int lastQuote = -1;
+		while (bits) {
+			int idx = __builtin_ctzll(bits);
+			const uint8_t *q = p + idx;
+			bits &= bits - 1;
+			if (q == skip) continue;
+			
+			if (inString) {
+				if (*q == '\\') {
+					skip = q + 1;
+				} else if (*q == '"') {
+					inString = false;
+					lastQuote = idx;
+					cut = q + 1;
+				}
+			} else if (*q == '"') {
+				inString = true;
+				lastQuote = idx;
+			} else if (*q != '\\') {
+				cut = q + 1;
+			}
+		}
+		
+		/*
+		 *	Whitespace after the last quote in the block is outside a string
+		 *	if we end the block outside one.
+		 */
+		
+		if (findCut && !inString) {
+			uint64_t ws = m.whitespace & valid;
+			if (lastQuote >= 0) ws &= ~((2ULL << lastQuote) - 1);
+			if (ws) {
+				const uint8_t *q = p + 64 - __builtin_clzll(ws);
+				if (q > cut) cut = q;
+			}
+		}
+		p += n;
+	}
+}
+
+/*	JSONPushInput::push
+ *
+ *		Queue a block for the lexer, cut just after the last complete token.
+ *	What comes after that is carried over to the next push. The cut is
+ *	almost always in the last 64 bytes, so we only follow the string state
+ *	up to there, and go back over the whole block if it is not.
+ */
+
+void JSONPushInput::push(const uint8_t *data, size_t len)
+{
+	const uint8_t *e = data + len;
+	const uint8_t *tail = (len > 64) ? e - 64 : data;
+	bool startString = inString;
+	const uint8_t *startSkip = escaped ? data : NULL;
+	
+	skip = startSkip;
+	cut = data;
+	scan(data,tail,false);
+	scan(tail,e,true);
+	
+	if ((cut == data) && (tail > data)) {
+		inString = startString;
+		skip = startSkip;
+		scan(data,e,true);
+	}
+	escaped = (skip == e);
+	
+	if (cut == data) {
+		carry.append((const char *)data,len);
+		head.clear();
+		length = 0;
+	} else {
+		head.swap(carry);
+		carry.assign((const char *)cut,e - cut);
+		block = data;
+		length = cut - data;
+	}
+	next = 0;
+}
+
+/*	JSONPushInput::finish
+ *
+ *		No more data is coming, so whatever is carried over goes to the lexer
+ */
+
+void JSONPushInput::finish()
+{
+	head.swap(carry);
+	carry.clear();
+	length = 0;
+	next = 0;
+	finished = true;
+}
+
+size_t JSONPushInput::read(const uint8_t **data)
+{
+	if (next == 0) {
+		next = 1;
+		if (!head.empty()) {
+			*data = (const uint8_t *)head.data();
+			return head.size();
+		}
+	}
+	if (next == 1) {
+		next = 2;
+		if (length > 0) {
+			*data = block;
+			return length;
+		}
+	}
+	return 0;
+}
+
+bool JSONPushInput::isWaiting()
+{
+	return !finished;
+}
@@ -0,0 +1,117 @@
+//
+//  JSONKeyTable.cpp
+//  prettyjson
+//
+
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Key Table																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONKeyTable::JSONKeyTable
+ *
+ *		Keys are copied into small arena chunks; object keys are usually
+ *	few and short.
+ */
+
+JSONKeyTable::JSONKeyTable(JSONArena *s) : own(64*1024)
+{
+	storage = s ? s : &own;
+	count = 0;
+}
+
+JSONKeyTable::~JSONKeyTable()
+{
+}
+
+/*	JSONKeyTable::hash
+ *
+ *		FNV-1a hash of the key
+ */
+
+uint32_t JSONKeyTable::hash(std::string_view str)
+{
+	uint32_t h = 2166136261U;
+	const uint8_t *p = (const uint8_t *)str.data();
+	const uint8_t *e = p + str.size();
+	
+	while (p < e) {
+		h = (h ^ *p++) * 16777619U;
+	}
+	return h;
+}
+
+/*	JSONKeyTable::clear
+ *
+ *		Forget all keys. Any JSONKey from this table is invalid after this,
+ *	unless it was copied into an arena given to the constructor.
+ */
+
+void JSONKeyTable::clear()
+{
+	slots.clear();
+	own.reset();
+	count = 0;
+}
+
+/*	JSONKeyTable::grow
+ *
+ *		Double the number of slots and rehash. We keep the table at most half
+ *	full so probe sequences stay short.
+ */
+
+void JSONKeyTable::grow()
+{
+	std::vector<JSONKey> old;
+	old.swap(slots);
+	
+	slots.resize(old.empty() ? 64 : old.size() * 2);
+	size_t mask = slots.size() - 1;
+	
+	for (size_t i = 0; i < old.size(); ++i) {
+		if (old[i].data() == NULL) continue;
+		
+		size_t index = old[i].hash & mask;
+		while (slots[index].data() != NULL) index = (index + 1) & mask;
+		slots[index] = old[i];
+	}
+}
+
+/*	JSONKeyTable::intern
+ *
+ *		Return the interned copy of the key, adding it if this is the first
+ *	time we have seen it.
+ */
+
+JSONKey JSONKeyTable::intern(std::string_view str)
+{
+	if (count * 2 >= slots.size()) grow();
+	
+	uint32_t h = hash(str);
+	size_t mask = slots.size() - 1;
+	size_t index = h & mask;
+	
+	for (;;) {
+		JSONKey &slot = slots[index];
+		if (slot.data() == NULL) break;
+		if ((slot.hash == h) && (slot == str)) return slot;
+		index = (index + 1) & mask;
+	}
+	
+	/*
+	 *	New key. Store it with a trailing NUL so it can be used as a C
+	 *	string.
+	 */
+	
+	size_t len = str.size();
+	char *copy = (char *)storage->alloc(len + 1,1);
+	memcpy(copy,str.data(),len);
+	copy[len] = 0;
+	
+	slots[index] = JSONKey(std::string_view(copy,len),h);
+	++count;
+	return slots[index];
+}
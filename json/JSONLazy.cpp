@@ -0,0 +1,603 @@
+//
+//  JSONLazy.cpp
+//  prettyjson
+//
+
+#include <string.h>
+#include <unordered_map>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Structures														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONLazyDocument::Indexer
+ *
+ *		Follows the states of BasicJSONParser::run over a stream of tokens,
+ *	recording where each container opens and closes. Tokens are given as the
+ *	lexer returns them. When strict, step() returns false at the first token
+ *	the parser would have had to repair; otherwise it repairs as the parser
+ *	does. The parser ignores anything after the top level value, and so do
+ *	we.
+ */
+
+struct JSONLazyDocument::Indexer
+{
+	enum State {
+		StateValue,
+		StateMember,
+		StateColon,
+		StateNext,
+		StateDone
+	};
+
+	std::vector<Container> &containers;
+	std::vector<size_t>	stack;
+	uint64_t			length;
+	bool				strict;
+	State				state;
+
+						Indexer(std::vector<Container> &c, uint64_t len, bool s) : containers(c), length(len), strict(s), state(StateValue)
+							{
+								containers.clear();
+							}
+
+	bool				step(int token, uint64_t offset);
+	bool				close(int token, uint64_t offset);
+	void				finish();
+};
+
+/*	JSONLazyDocument::Members
+ *
+ *		The members of a container in order, and for an object the position
+ *	of each key
+ */
+
+struct JSONLazyDocument::Members
+{
+	std::vector<JSONLazyValue> values;
+	std::unordered_map<std::string_view,size_t> index;
+};
+
+/*	JSONLazyDocument::Indexer::step
+ *
+ *		Take one token. Brackets are at offset.
+ */
+
+bool JSONLazyDocument::Indexer::step(int token, uint64_t offset)
+{
+	for (;;) {
+		switch (state) {
+			case StateValue:
+				if ((token == '{') || (token == '[')) {
+					Container k = { offset, length, 0, token == '{' };
+					stack.push_back(containers.size());
+					containers.push_back(k);
+					state = StateMember;
+					return true;
+				}
+				if ((token == STRING) || (token == TOKEN) || (token == NUMBER)) {
+					state = stack.empty() ? StateDone : StateNext;
+					return true;
+				}
+				return !strict;				/* skipped */
+
+			case StateMember:
+				if ((token == '}') || (token == ']')) return close(token,offset);
+				if (containers[stack.back()].isObject) {
+					if (strict && (token != STRING)) return false;
+					state = StateColon;		/* any token is a key */
+					return true;
+				}
+				state = StateValue;
+				continue;
+
+			case StateColon:
+				state = StateValue;
+				if (token == ':') return true;
+				if (strict) return false;
+				continue;
+
+			case StateNext:
+				if ((token == '}') || (token == ']')) return close(token,offset);
+				state = StateMember;
+				if (token == ',') return true;
+				if (strict) return false;
+				continue;
+
+			default:
+				return true;
+		}
+	}
+}
+
+/*	JSONLazyDocument::Indexer::close
+ *
+ *		Either close bracket closes the innermost container
+ */
+
+bool JSONLazyDocument::Indexer::close(int token, uint64_t offset)
+{
+	Container &k = containers[stack.back()];
+	if (strict && (k.isObject != (token == '}'))) return false;
+
+	k.close = offset;
+	k.next = containers.size();
+	stack.pop_back();
+	state = stack.empty() ? StateDone : StateNext;
+	return true;
+}
+
+/*	JSONLazyDocument::Indexer::finish
+ *
+ *		Containers still open at the end close at the end
+ */
+
+void JSONLazyDocument::Indexer::finish()
+{
+	while (!stack.empty()) {
+		containers[stack.back()].next = containers.size();
+		stack.pop_back();
+	}
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Utilities														*/
+/*																			*/
+/****************************************************************************/
+
+/*	IsDelimiter
+ *
+ *		True for the bytes which end a bare word or number: whitespace as
+ *	the scanner sees it, structural characters, quotes and backslashes
+ */
+
+static inline bool IsDelimiter(uint8_t c)
+{
+	switch (c) {
+		case ' ': case '\t': case '\n': case '\v': case '\f': case '\r':
+		case '{': case '}': case '[': case ']': case ':': case ',':
+		case '"': case '\\':
+			return true;
+		default:
+			return false;
+	}
+}
+
+static inline bool IsDigit(uint8_t c)
+{
+	return (c >= '0') && (c <= '9');
+}
+
+/*	ScalarToken
+ *
+ *		Find the end of the run of bytes at p which is not whitespace or
+ *	punctuation, and return TOKEN or NUMBER if the lexer would read it as a
+ *	single token of that type. Anything else returns 0.
+ */
+
+static int ScalarToken(const uint8_t *p, const uint8_t *e, const uint8_t **end)
+{
+	const uint8_t *q = p;
+	while ((q < e) && !IsDelimiter(*q)) ++q;
+	*end = q;
+
+	uint8_t c = *p;
+	if (((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))) {
+		while (++p < q) {
+			c = *p;
+			if (!IsDigit(c) && (c != '_') && !((c >= 'a') && (c <= 'z')) && !((c >= 'A') && (c <= 'Z'))) return 0;
+		}
+		return TOKEN;
+	}
+
+	if (*p == '-') ++p;
+	if ((p >= q) || !IsDigit(*p)) return 0;
+	while ((p < q) && IsDigit(*p)) ++p;
+	if ((p < q) && (*p == '.')) {
+		if ((++p >= q) || !IsDigit(*p)) return 0;
+		while ((p < q) && IsDigit(*p)) ++p;
+	}
+	if ((p < q) && ((*p == 'e') || (*p == 'E'))) {
+		++p;
+		if ((p < q) && ((*p == '+') || (*p == '-'))) ++p;
+		if ((p >= q) || !IsDigit(*p)) return 0;
+		while ((p < q) && IsDigit(*p)) ++p;
+	}
+	return (p == q) ? NUMBER : 0;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Lazy Document															*/
+/*																			*/
+/****************************************************************************/
+
+JSONLazyDocument::JSONLazyDocument(const void *d, size_t len)
+{
+	data = (const uint8_t *)d;
+	length = len;
+	if (!indexStructure()) indexTokens();
+}
+
+JSONLazyDocument::~JSONLazyDocument()
+{
+	for (size_t i = 0; i < cache.size(); ++i) {
+		delete cache[i];
+	}
+}
+
+/*	JSONLazyDocument::indexStructure
+ *
+ *		Find every array and object in one pass with the stage 1 scanner.
+ *	Containers are recorded in the order they open, so the members of a
+ *	container follow it, and next gives the first container after all of
+ *	them. Tokens are found from the masks, without the lexer: quotes and
+ *	backslashes are tracked as the lexer reads them, and each run of other
+ *	bytes outside strings is checked to be one token. Returns false if the
+ *	document needs any repair.
+ */
+
+bool JSONLazyDocument::indexStructure()
+{
+	Indexer ix(containers,length,true);
+	const uint8_t *p = data;
+	const uint8_t *e = data + length;
+	const uint8_t *escaped = NULL;
+	const uint8_t *runEnd = data;
+	bool inString = false;
+	JSONBlockMasks m;
+
+	while ((p < e) && (ix.state != Indexer::StateDone)) {
+		size_t len = e - p;
+		if (len >= 64) {
+			len = 64;
+			JSONScanner::classify(p,&m);
+		} else {
+			JSONScanner::classify(p,len,&m);
+		}
+
+		/*
+		 *	Runs of other bytes are found by where they start. Bits past the
+		 *	end of short blocks are whitespace.
+		 */
+
+		uint64_t special = m.structural | m.quote | m.backslash;
+		uint64_t other = ~(special | m.whitespace);
+		uint64_t bits = special | (other & ~(other << 1));
+
+		while (bits) {
+			const uint8_t *q = p + __builtin_ctzll(bits);
+			bits &= bits - 1;
+			if ((q == escaped) || (q < runEnd)) continue;
+
+			uint8_t c = *q;
+			int token;
+			if (inString) {
+				if (c == '\\') {
+					escaped = q + 1;
+				} else if (c == '"') {
+					inString = false;
+				}
+				continue;
+			} else if (c == '"') {
+				inString = true;
+				token = STRING;
+			} else if (c == '\\') {
+				return false;				/* not a token */
+			} else if (IsDelimiter(c)) {
+				token = c;
+			} else {
+				token = ScalarToken(q,e,&runEnd);
+				if (token == 0) return false;
+			}
+
+			if (!ix.step(token,q - data)) return false;
+			if (ix.state == Indexer::StateDone) break;
+		}
+		p += len;
+	}
+
+	if (inString) return false;
+	ix.finish();
+	return true;
+}
+
+/*	JSONLazyDocument::indexTokens
+ *
+ *		Find every array and object with the lexer, repairing as the parser
+ *	does. This is slower, and is used for documents which need repair.
+ */
+
+void JSONLazyDocument::indexTokens()
+{
+	Indexer ix(containers,length,false);
+	JSONLexer lexer(data,length);
+	int token;
+
+	while ((ix.state != Indexer::StateDone) && ((token = lexer.readToken()) != -1)) {
+		ix.step(token,lexer.getOffset() - 1);
+	}
+	ix.finish();
+}
+
+/*	JSONLazyDocument::find
+ *
+ *		Find the container which opens at the given offset. When walking the
+ *	members of a container it is almost always the hint, the container after
+ *	the last one skipped; if a repair has put the lexer somewhere else, fall
+ *	back to a search. Returns -1 if there is no such container.
+ */
+
+long JSONLazyDocument::find(uint64_t open, size_t hint)
+{
+	if ((hint < containers.size()) && (containers[hint].open == open)) return (long)hint;
+
+	size_t lo = 0;
+	size_t hi = containers.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (containers[mid].open < open) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if ((lo < containers.size()) && (containers[lo].open == open)) return (long)lo;
+	return -1;
+}
+
+/*	JSONLazyDocument::skip
+ *
+ *		The lexer has just read an open bracket. Step over the container to
+ *	the token after it, and return its index.
+ */
+
+long JSONLazyDocument::skip(JSONLexer &lexer, size_t *hint)
+{
+	long c = find(lexer.getOffset() - 1,*hint);
+	if (c < 0) return -1;
+
+	const Container &k = containers[c];
+	*hint = k.next;
+	if (!lexer.skipTo((k.close < length) ? k.close + 1 : length)) return -1;
+	return c;
+}
+
+/*	JSONLazyDocument::scalar
+ *
+ *		Build the scalar the lexer has just read, as JSONRecordParser would.
+ *	Returns NULL for a bare word which is not true, false or null.
+ */
+
+JSONNode *JSONLazyDocument::scalar(JSONLexer &lexer, int token)
+{
+	if (token == STRING) {
+		return new (&arena) JSONString(lexer.text(),&arena,!lexer.isBorrowed());
+	}
+
+	if (token == NUMBER) {
+		int64_t val;
+		if (JSONTokenToInteger(lexer.number,&val)) {
+			return new (&arena) JSONNumber(val);
+		}
+		return new (&arena) JSONNumber(JSONTokenToReal(lexer.number,lexer.token.c_str()));
+	}
+
+	if (lexer.token == "true") return new (&arena) JSONNumber(true);
+	if (lexer.token == "false") return new (&arena) JSONNumber(false);
+	if (lexer.token == "null") return new (&arena) JSONNull;
+	return NULL;
+}
+
+/*	JSONLazyDocument::value
+ *
+ *		Return the value the lexer has just read the first token of
+ */
+
+JSONLazyValue JSONLazyDocument::value(JSONLexer &lexer, int token, size_t *hint)
+{
+	if ((token == '{') || (token == '[')) {
+		long c = skip(lexer,hint);
+		if (c < 0) return JSONLazyValue();
+		return JSONLazyValue(this,c);
+	}
+
+	return JSONLazyValue(this,scalar(lexer,token));
+}
+
+/*	JSONLazyDocument::root
+ *
+ *		The top level value. Tokens which cannot start a value are skipped,
+ *	as the parser does.
+ */
+
+JSONLazyValue JSONLazyDocument::root()
+{
+	JSONLexer lexer(data,length);
+	size_t hint = 0;
+	int token;
+
+	do {
+		token = lexer.readToken();
+		if (token == -1) return JSONLazyValue();
+	} while ((token != '{') && (token != '[') && (token != TOKEN) && (token != STRING) && (token != NUMBER));
+
+	return value(lexer,token,&hint);
+}
+
+/*	JSONLazyDocument::members
+ *
+ *		Walk the members of a container once, reading its own tokens and
+ *	stepping over the containers in it, and keep what was found. The
+ *	container ends where the parser would end it, which is not always where
+ *	the index closed it. Scalar members are built as they are read.
+ *
+ *		This follows the states of BasicJSONParser::run: tokens which cannot
+ *	start a value are skipped, a missing comma or colon is assumed, any
+ *	token at all is taken as a key, and either close bracket ends the
+ *	container. A member whose value is an illegal bare word is dropped. A
+ *	key which occurs again replaces the value, but keeps the place where
+ *	it first occurred, as JSONDuplicateLast does.
+ */
+
+JSONLazyDocument::Members *JSONLazyDocument::members(long c)
+{
+	if (cache.size() < containers.size()) cache.resize(containers.size(),NULL);
+	if (cache[c]) return cache[c];
+
+	Members *m = new Members;
+	cache[c] = m;
+
+	const Container &k = containers[c];
+	bool isObject = k.isObject;
+	size_t hint = c + 1;
+	JSONKey name;
+	int token;
+
+	JSONLexer lexer(data + k.open + 1,length - k.open - 1);
+	lexer.setOffset(k.open + 1,1);
+
+	for (;;) {
+		token = lexer.readToken();
+		if ((token == -1) || (token == '}') || (token == ']')) break;
+
+		/*
+		 *	key: value
+		 */
+
+		if (isObject) {
+			name = keys.intern(lexer.text());
+			token = lexer.readToken();
+			if (token != ':') lexer.pushToken();
+			token = lexer.readToken();
+		}
+
+		while ((token != -1) && (token != '{') && (token != '[') && (token != TOKEN) && (token != STRING) && (token != NUMBER)) {
+			token = lexer.readToken();
+		}
+		if (token == -1) break;
+
+		JSONLazyValue v;
+		if ((token == '{') || (token == '[')) {
+			long child = skip(lexer,&hint);
+			if (child < 0) break;
+			v = JSONLazyValue(this,child);
+		} else {
+			JSONNode *node = scalar(lexer,token);
+			if (node) v = JSONLazyValue(this,node);
+		}
+
+		if (v.isValid()) {
+			if (!isObject) {
+				m->values.push_back(v);
+			} else {
+				auto r = m->index.emplace(name,m->values.size());
+				if (r.second) {
+					m->values.push_back(v);
+				} else {
+					m->values[r.first->second] = v;
+				}
+			}
+		}
+
+		/*
+		 *	, or close
+		 */
+
+		token = lexer.readToken();
+		if ((token == -1) || (token == '}') || (token == ']')) break;
+		if (token != ',') lexer.pushToken();
+	}
+
+	return m;
+}
+
+/*	JSONLazyDocument::build
+ *
+ *		Parse a container and everything in it into the document's arena.
+ *	The parser finds the end of the container itself.
+ */
+
+JSONNode *JSONLazyDocument::build(long c)
+{
+	const Container &k = containers[c];
+
+	JSONLexer lexer(data + k.open,length - k.open);
+	lexer.setOffset(k.open,1);
+
+	JSONRecordParser parser(&arena,&keys);
+	parser.setBorrowStrings(true);
+	return parser.parse(&lexer);
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Lazy Value																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONLazyValue::type
+ *
+ *		The type of the value. An invalid value is null.
+ */
+
+JSONType JSONLazyValue::type()
+{
+	if (container >= 0) {
+		return doc->containers[container].isObject ? JSONTypeObject : JSONTypeArray;
+	}
+	if (scalar) return scalar->type();
+	return JSONTypeNull;
+}
+
+/*	JSONLazyValue::size
+ *
+ *		The number of members of a container, or 0 for anything else
+ */
+
+size_t JSONLazyValue::size()
+{
+	if (container < 0) return 0;
+	return doc->members(container)->values.size();
+}
+
+/*	JSONLazyValue::operator []
+ *
+ *		Look up a member of an object by key, or of an array or object by
+ *	position
+ */
+
+JSONLazyValue JSONLazyValue::operator [] (std::string_view key)
+{
+	if (container < 0) return JSONLazyValue();
+
+	JSONLazyDocument::Members *m = doc->members(container);
+	auto i = m->index.find(key);
+	if (i == m->index.end()) return JSONLazyValue();
+	return m->values[i->second];
+}
+
+JSONLazyValue JSONLazyValue::operator [] (size_t index)
+{
+	if (container < 0) return JSONLazyValue();
+
+	JSONLazyDocument::Members *m = doc->members(container);
+	if (index >= m->values.size()) return JSONLazyValue();
+	return m->values[index];
+}
+
+/*	JSONLazyValue::node
+ *
+ *		Build the value as a DOM node. Containers are parsed each time this
+ *	is called. Returns NULL for an invalid value.
+ */
+
+JSONNode *JSONLazyValue::node()
+{
+	if (container >= 0) return doc->build(container);
+	return scalar;
+}
@@ -15,19 +15,191 @@
 
 /*	JSONLexer::JSONLexer
  *
- *		Lexer engine
+ *		Lexer engine. The FILE constructor reads through stdio; the file
+ *	descriptor constructor memory maps regular files and reads everything
+ *	else in large blocks.
  */
 
 JSONLexer::JSONLexer(FILE *f)
 {
-	file = f;
-	pos = 0;
+	input = new JSONStdioInput(f);
+	ownsInput = true;
+	init();
+}
+
+JSONLexer::JSONLexer(int fd)
+{
+	input = JSONOpenInput(fd);
+	ownsInput = true;
+	init();
+}
+
+JSONLexer::JSONLexer(const void *data, size_t length)
+{
+	input = new JSONMemoryInput(data,length);
+	ownsInput = true;
+	init();
+}
+
+JSONLexer::JSONLexer(JSONInput *in)
+{
+	input = in;
+	ownsInput = false;
+	init();
+}
+
+void JSONLexer::init()
+{
+	cur = end = NULL;
+	eof = false;
 	line = 1;
 	pushBack = false;
+	lastToken = -1;
+	persistent = input->isPersistent();
+	borrowed = false;
+	
+	maxString = maxTokens = maxBytes = 0;
+	tokens = bytes = 0;
+	clipped = false;
+	limitHit = JSONLimitNone;
+	
+	useScanner = (JSONScanner::kernel() != JSONScanScalar);
+	winStart = NULL;
+	winLen = 0;
+	
+	base = 0;
+	blockStart = colScan = colLine = NULL;
+	blockColumn = 1;
+	
+	stats = NULL;
 }
 
 JSONLexer::~JSONLexer()
 {
+	if (ownsInput) delete input;
+}
+
+/*	JSONLexer::setLimits
+ *
+ *		Set the string length, token count and input size limits
+ */
+
+void JSONLexer::setLimits(const JSONLimits &limits)
+{
+	maxString = limits.maxStringLength;
+	maxTokens = limits.maxTokens;
+	maxBytes = limits.maxBytes;
+}
+
+/*	JSONLexer::getColumn
+ *
+ *		Return the column of the current position, counted in bytes from 1.
+ *	We look back for the last newline only as far as we looked last time,
+ *	so asking for every diagnostic on a long line costs no more than once.
+ */
+
+uint32_t JSONLexer::getColumn()
+{
+	if (blockStart == NULL) return blockColumn;
+	
+	for (const uint8_t *p = cur; p > colScan; ) {
+		if (*--p == '\n') {
+			colLine = p + 1;
+			break;
+		}
+	}
+	colScan = cur;
+	
+	if (colLine) return (uint32_t)(cur - colLine) + 1;
+	return blockColumn + (uint32_t)(cur - blockStart);
+}
+
+/*	JSONLexer::skipTo
+ *
+ *		Move forward to the given offset, if it lies within the current
+ *	block. This is used to step over a value whose end is already known;
+ *	newlines skipped are not counted. Returns false if the offset is not in
+ *	the block, in which case nothing changes.
+ */
+
+bool JSONLexer::skipTo(uint64_t offset)
+{
+	uint64_t pos = getOffset();
+	
+	if ((offset < pos) || (offset - pos > (uint64_t)(end - cur))) return false;
+	
+	cur += offset - pos;
+	pushBack = false;
+	winLen = 0;
+	return true;
+}
+
+/*	JSONLexer::skipValue
+ *
+ *		Step over the rest of a container by counting brackets, a scanner
+ *	window at a time. Only quotes, backslashes and structural characters
+ *	are looked at; either close bracket closes the innermost container. A
+ *	backslash escapes the byte after it even if that is in the next window
+ *	or block.
+ */
+
+bool JSONLexer::skipValue()
+{
+	long depth = 1;
+	bool inString = false;
+	bool escapeFirst = false;		/* first byte of the next block */
+	const uint8_t *escaped = NULL;
+	
+	pushBack = false;
+	for (;;) {
+		if ((cur >= end) && !fill()) return false;
+		
+		if (escapeFirst) {
+			escapeFirst = false;
+			if (*cur++ == '\n') ++line;
+			continue;
+		}
+		
+		loadWindow();
+		const uint8_t *base = cur;
+		const uint8_t *stop = winStart + winLen;
+		size_t off = cur - winStart;
+		uint64_t bits = (win.structural | win.quote | win.backslash) >> off;
+		uint64_t nl = win.newline >> off;
+		
+		while (bits) {
+			int idx = __builtin_ctzll(bits);
+			const uint8_t *p = base + idx;
+			bits &= bits - 1;
+			if (p == escaped) continue;
+			
+			uint8_t c = *p;
+			if (inString) {
+				if (c == '\\') {
+					escaped = p + 1;
+				} else if (c == '"') {
+					inString = false;
+				}
+			} else if (c == '"') {
+				inString = true;
+			} else if ((c == '[') || (c == '{')) {
+				++depth;
+			} else if (((c == ']') || (c == '}')) && (--depth == 0)) {
+				line += __builtin_popcountll(nl & ((1ULL << idx) - 1));
+				cur = p + 1;
+				return true;
+			}
+		}
+		
+		line += __builtin_popcountll(nl);
+		cur = stop;
+		if (escaped != stop) {
+			escaped = NULL;
+		} else if (stop == end) {
+			escaped = NULL;
+			escapeFirst = true;
+		}
+	}
 }
 
 /****************************************************************************/
@@ -36,36 +208,102 @@ JSONLexer::~JSONLexer()
 /*																			*/
 /****************************************************************************/
 
-/*	JSONLexer::readChar
+/*	JSONLexer::fill
  *
- *		Read the next character in the stream. Note this reads as 8-bit bytes,
- *	and does not validate unicode as UTF-8 characters.
+ *		Fetch the next block from our input source. Returns false at EOF.
+ *	Note this reads as 8-bit bytes, and does not validate unicode as UTF-8
+ *	characters. A block which runs past maxBytes is cut short, and the end
+ *	of it is reported as the byte limit rather than EOF. Running out of
+ *	input which is waiting for more is not EOF either.
  */
 
-int JSONLexer::readChar()
+bool JSONLexer::fill()
 {
-	int ret;
+	const uint8_t *data = NULL;
+	size_t len = 0;
+	
+	if (eof) return false;
 	
-	if (pos > 0) {
-		ret = stack[--pos];
-	} else {
-		ret = fgetc(file);
+	blockColumn = getColumn();
+	blockStart = colScan = colLine = NULL;
+	winLen = 0;
+	if (!clipped) {
+		JSONStatsPhase phase(stats,JSONPhaseRead);
+		len = input->read(&data);
+		if (maxBytes && (len > maxBytes - bytes)) {
+			len = maxBytes - bytes;
+			clipped = true;
+		}
+	}
+	if (len > 0) {
+		bytes += len;
+		cur = data;
+		end = data + len;
+		blockStart = colScan = data;
+		return true;
 	}
 	
-	if (ret == '\n') ++line;
-	return ret;
+	cur = end = NULL;
+	if (clipped) {
+		limitHit = JSONLimitBytes;
+	} else if (input->isWaiting()) {
+		return false;
+	}
+	eof = true;
+	return false;
+}
+
+/*	JSONLexer::loadWindow
+ *
+ *		Make sure the scanner masks cover the current position. The window
+ *	starts at the current position and covers up to 64 bytes of the block.
+ */
+
+void JSONLexer::loadWindow()
+{
+	if ((cur >= winStart) && (cur < winStart + winLen)) return;
+	
+	winStart = cur;
+	winLen = end - cur;
+	if (winLen > 64) winLen = 64;
+	JSONScanner::classify(cur,winLen,&win);
 }
 
-/*	JSONLexer::pushChar
+/*	Character classes
  *
- *		Push the read character back for re-reading again
+ *		Table driven replacements for isspace, isalpha, isdigit and so forth
+ *	in the "C" locale, which is what we've always parsed with.
  */
 
-void JSONLexer::pushChar(int ch)
+#define CSPACE		0x01
+#define CALPHA		0x02
+#define CDIGIT		0x04
+#define CHEX		0x08
+#define CIDENT		0x10		/* alnum or '_' */
+
+static struct CharClasses
 {
-	stack[pos++] = (uint8_t)ch;
+	uint8_t			flags[256];
 	
-	if (ch == '\n') --line;
+	constexpr CharClasses() : flags()
+		{
+			for (int i = 0; i < 256; ++i) {
+				uint8_t f = 0;
+				if ((i == ' ') || ((i >= '\t') && (i <= '\r'))) f |= CSPACE;
+				if (((i >= 'a') && (i <= 'z')) || ((i >= 'A') && (i <= 'Z'))) f |= CALPHA | CIDENT;
+				if ((i >= '0') && (i <= '9')) f |= CDIGIT | CHEX | CIDENT;
+				if (((i >= 'a') && (i <= 'f')) || ((i >= 'A') && (i <= 'F'))) f |= CHEX;
+				if (i == '_') f |= CIDENT;
+				flags[i] = f;
+			}
+		}
+} const GClasses;
+
+#define GClass		GClasses.flags
+
+static inline bool IsClass(int c, uint8_t f)
+{
+	return (c >= 0) && (GClass[c] & f);
 }
 
 /*	toHexValue
@@ -83,7 +321,9 @@ static int toHexValue(char ch)
 
 /*	JSONLexer::readToken
  *
- *		Read the next token in the stream
+ *		Read the next token in the stream. Whitespace, string contents and
+ *	digit runs are scanned directly over the input block, and only fall back
+ *	to per-character reads at block boundaries and escapes.
  */
 
 int JSONLexer::readToken()
@@ -99,93 +339,191 @@ int JSONLexer::readToken()
 		return lastToken;
 	}
 	
+	++tokens;
+	if ((maxTokens && (tokens > maxTokens)) || limitHit) {
+		if (!limitHit) limitHit = JSONLimitTokens;
+		return lastToken = LIMIT;
+	}
+	
 	/*
 	 *	Skip whitespace
 	 */
 	
-	while (isspace(c = readChar())) ;
-	if (c == -1) return -1;			/* At EOF */
+	for (;;) {
+		if ((cur >= end) && !fill()) {
+			if (limitHit) return lastToken = LIMIT;
+			if (eof) return lastToken = -1;
+			
+			/*
+			 *	Pushed input has run out between tokens. This attempt does
+			 *	not count as a token.
+			 */
+			
+			--tokens;
+			return lastToken = MORE;
+		}
+		
+		if (useScanner) {
+			/*
+			 *	Jump to the first non-whitespace byte in the window, or skip
+			 *	the window entirely if it is all whitespace.
+			 */
+			
+			loadWindow();
+			size_t off = cur - winStart;
+			uint64_t stop = ~win.whitespace >> off;
+			uint64_t nl = win.newline >> off;
+			if (stop) {
+				int idx = __builtin_ctzll(stop);
+				line += __builtin_popcountll(nl & ((1ULL << idx) - 1));
+				cur += idx;
+				break;
+			}
+			line += __builtin_popcountll(nl);
+			cur = winStart + winLen;
+		} else {
+			while ((cur < end) && (GClass[*cur] & CSPACE)) {
+				if (*cur == '\n') ++line;
+				++cur;
+			}
+			if (cur < end) break;
+		}
+	}
+	c = *cur++;
 	
 	/*
-	 *	Parse strings
+	 *	Parse strings. If the string ends within the block with no escapes,
+	 *	its text is left in the block and returned as a view.
 	 */
 	
 	token.clear();
+	view = std::string_view();
+	borrowed = false;
 	if (c == '"') {
-		while (((c = readChar()) != '"') && (c != -1)) {
-			if (c == '\\') {
+		bool simple = true;
+		for (;;) {
+			/*
+			 *	Copy the run of unescaped characters in bulk
+			 */
+			
+			const uint8_t *start = cur;
+			const uint8_t *stop = runEnd();
+			if (useScanner) {
+				while (cur < stop) {
+					loadWindow();
+					size_t off = cur - winStart;
+					uint64_t stop = (win.quote | win.backslash) >> off;
+					uint64_t nl = win.newline >> off;
+					if (stop) {
+						int idx = __builtin_ctzll(stop);
+						line += __builtin_popcountll(nl & ((1ULL << idx) - 1));
+						cur += idx;
+						break;
+					}
+					line += __builtin_popcountll(nl);
+					cur = winStart + winLen;
+				}
+			} else {
+				while ((cur < stop) && (*cur != '"') && (*cur != '\\')) {
+					if (*cur == '\n') ++line;
+					++cur;
+				}
+			}
+			
+			if (simple && (cur < end) && (*cur == '"')) {
+				if (tooLong(cur - start)) return lastToken = LIMIT;
+				view = std::string_view((const char *)start,cur - start);
+				borrowed = persistent;
+				++cur;
+				break;
+			}
+			simple = false;
+			token.append((const char *)start,cur - start);
+			if (tooLong(token.size())) return lastToken = LIMIT;
+			
+			if (cur >= end) {
+				if (fill()) continue;
+				break;					/* EOF in string */
+			}
+			
+			c = *cur++;
+			if (c == '"') break;
+			
+			/*
+			 *	Escape processing.
+			 */
+			
+			c = readChar();
+			if (c == -1) {
+				break;
+			} else if (c == 'u') {
 				/*
-				 *	Escape processing.
+				 *	Hex escape. Note hex escape runs 0x0000 to 0xFFFF
 				 */
-				
-				c = readChar();
-				if (c == 'u') {
-					/*
-					 *	Hex escape. Note hex escape runs 0x0000 to 0xFFFF
-					 */
-					 
-					uint16_t hex = 0;
-					int ct = 0;
-					while (ct++ < 4) {
-						c = readChar();
-						if (isxdigit(c)) {
-							hex = (hex << 4) | toHexValue(c);
-						} else {
-							pushChar(c);
-							break;
-						}
-					}
-					
-					/*
-					 *	Convert the hex value to UTF-8.
-					 */
-					
-					if (hex < 0x80) {
-						token.push_back((char)hex);
-					} else if (hex < 0x800) {
-						token.push_back((char)(0xC0 | (hex >> 6)));
-						token.push_back((char)(0x80 | (0x3F & hex)));
+				 
+				uint16_t hex = 0;
+				int ct = 0;
+				while (ct++ < 4) {
+					c = peekChar();
+					if (IsClass(c,CHEX)) {
+						hex = (hex << 4) | toHexValue(c);
+						readChar();
 					} else {
-						token.push_back((char)(0xE0 | (hex >> 12)));
-						token.push_back((char)(0x80 | (0x3F & (hex >> 6))));
-						token.push_back((char)(0x80 | (0x3F & hex)));
+						break;
 					}
-				} else if (c == 'b') {
-					token.push_back('\b');
-				} else if (c == 'f') {
-					token.push_back('\f');
-				} else if (c == 'n') {
-					token.push_back('\n');
-				} else if (c == 'r') {
-					token.push_back('\r');
-				} else if (c == 't') {
-					token.push_back('\t');
+				}
+				
+				/*
+				 *	Convert the hex value to UTF-8.
+				 */
+				
+				if (hex < 0x80) {
+					token.push_back((char)hex);
+				} else if (hex < 0x800) {
+					token.push_back((char)(0xC0 | (hex >> 6)));
+					token.push_back((char)(0x80 | (0x3F & hex)));
 				} else {
-					token.push_back((char)c);
+					token.push_back((char)(0xE0 | (hex >> 12)));
+					token.push_back((char)(0x80 | (0x3F & (hex >> 6))));
+					token.push_back((char)(0x80 | (0x3F & hex)));
 				}
+			} else if (c == 'b') {
+				token.push_back('\b');
+			} else if (c == 'f') {
+				token.push_back('\f');
+			} else if (c == 'n') {
+				token.push_back('\n');
+			} else if (c == 'r') {
+				token.push_back('\r');
+			} else if (c == 't') {
+				token.push_back('\t');
 			} else {
 				token.push_back((char)c);
 			}
 		}
 		
-		return lastToken = STRING;
+		return lastToken = limitHit ? LIMIT : STRING;
 	}
 	
-	if (isalpha(c)) {
+	if (IsClass(c,CALPHA)) {
 		/*
 		 *	Parse token.
 		 */
 		
-		while (isalnum(c) || (c == '_')) {
-			token.push_back((char)c);
-			c = readChar();
+		token.push_back((char)c);
+		for (;;) {
+			const uint8_t *start = cur;
+			const uint8_t *stop = runEnd();
+			while ((cur < stop) && (GClass[*cur] & CIDENT)) ++cur;
+			token.append((const char *)start,cur - start);
+			if (tooLong(token.size())) return lastToken = LIMIT;
+			if ((cur < end) || !fill()) break;
 		}
-		pushChar(c);
 		
-		return lastToken = TOKEN;
+		return lastToken = limitHit ? LIMIT : TOKEN;
 	}
 	
-	if (isdigit(c) || (c == '-')) {
+	if (IsClass(c,CDIGIT) || (c == '-')) {
 		token.push_back((char)c);
 		
 		/*
@@ -193,66 +531,44 @@ int JSONLexer::readToken()
 		 *	next token is a digit. If not, then it's a minus sign.)
 		 */
 		
+		number.mantissa = 0;
+		number.exponent = 0;
+		number.digits = 0;
+		number.negative = false;
+		number.isReal = false;
+		number.truncated = false;
+		
 		if (c == '-') {
-			c = readChar();
-			if (!isdigit(c)) {
-				pushChar(c);
-				
+			if (!IsClass(peekChar(),CDIGIT)) {
 				return lastToken = '-';
-			} else {
-				token.push_back((char)c);
 			}
+			number.negative = true;
+		} else {
+			number.mantissa = c - '0';
+			number.digits = (c != '0');
 		}
 		
 		/*
-		 *	At this point we've seen a single digit. Continue gathering digits
-		 *	until we hit a decimal or something else.
+		 *	Gather digits until we hit a decimal or something else.
 		 */
 		
-		for (;;) {
-			c = readChar();
-			if (isdigit(c)) {
-				token.push_back((char)c);
-			} else {
-				break;
-			}
-		}
+		scanDigits(false);
 		
+		c = peekChar();
 		if (c == '.') {
-			token.push_back((char)c);
-			
-			for (;;) {
-				c = readChar();
-				if (isdigit(c)) {
-					token.push_back((char)c);
-				} else {
-					break;
-				}
-			}
+			token.push_back((char)readChar());
+			number.isReal = true;
+			scanDigits(true);
+			c = peekChar();
 		}
 		
 		if ((c == 'e') || (c == 'E')) {
-			token.push_back((char)c);
-			
-			c = readChar();
-			if ((c == '-') || (c == '+')) {
-				token.push_back((char)c);
-			} else {
-				pushChar(c);
-			}
-			
-			for (;;) {
-				c = readChar();
-				if (isdigit(c)) {
-					token.push_back((char)c);
-				} else {
-					break;
-				}
-			}
+			token.push_back((char)readChar());
+			number.isReal = true;
+			scanExponent();
 		}
 		
-		pushChar(c);
-		return lastToken = NUMBER;
+		return lastToken = limitHit ? LIMIT : NUMBER;
 	}
 	
 	/*
@@ -262,3 +578,71 @@ int JSONLexer::readToken()
 	token.push_back((char)c);
 	return lastToken = c;
 }
+
+/*	JSONLexer::scanDigits
+ *
+ *		Append the run of digits at the current position to the token, and
+ *	accumulate them into the number. Leading zeros are not significant;
+ *	digits past the 19th are dropped, adjusting the exponent for digits
+ *	before the decimal point.
+ */
+
+void JSONLexer::scanDigits(bool fraction)
+{
+	uint64_t m = number.mantissa;
+	int32_t digits = number.digits;
+	int32_t exp = number.exponent;
+	
+	for (;;) {
+		const uint8_t *start = cur;
+		const uint8_t *stop = runEnd();
+		while ((cur < stop) && (GClass[*cur] & CDIGIT)) {
+			uint32_t d = *cur++ - '0';
+			if (digits < 19) {
+				m = m * 10 + d;
+				if (m) ++digits;
+				if (fraction) --exp;
+			} else {
+				if (d) number.truncated = true;
+				if (!fraction) ++exp;
+			}
+		}
+		token.append((const char *)start,cur - start);
+		if (tooLong(token.size()) || (cur < end) || !fill()) break;
+	}
+	
+	number.mantissa = m;
+	number.digits = digits;
+	number.exponent = exp;
+}
+
+/*	JSONLexer::scanExponent
+ *
+ *		Scan the exponent after an 'e', and add it to the number. The value
+ *	is clamped well past the point where the result is zero or infinity.
+ */
+
+void JSONLexer::scanExponent()
+{
+	bool negative = false;
+	int32_t exp = 0;
+	
+	int c = peekChar();
+	if ((c == '-') || (c == '+')) {
+		negative = (c == '-');
+		token.push_back((char)readChar());
+	}
+	
+	for (;;) {
+		const uint8_t *start = cur;
+		const uint8_t *stop = runEnd();
+		while ((cur < stop) && (GClass[*cur] & CDIGIT)) {
+			if (exp < 100000) exp = exp * 10 + (*cur - '0');
+			++cur;
+		}
+		token.append((const char *)start,cur - start);
+		if (tooLong(token.size()) || (cur < end) || !fill()) break;
+	}
+	
+	number.exponent += negative ? -exp : exp;
+}
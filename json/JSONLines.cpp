@@ -0,0 +1,313 @@
+//
+//  JSONLines.cpp
+//  prettyjson
+//
+
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Structures														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONLines::Chunk
+ *
+ *		A run of complete lines, and the results of parsing them. Line and
+ *	record numbers in the results are relative to the start of the chunk;
+ *	they are fixed up when the chunk is emitted in order.
+ */
+
+struct JSONLines::Chunk
+{
+	const uint8_t		*data;
+	size_t				length;
+	uint64_t			offset;			/* of data in the input */
+	std::string			copy;			/* holds data if input isn't persistent */
+
+	JSONMemoryWriter	out;
+	JSONDiagnostics		errors;
+	long				lines;
+	long				records;
+	bool				finished;
+};
+
+/*	JSONLines::Worker
+ *
+ *		Per-worker parser state, reused for every record the worker parses.
+ *	A record is formatted before its chunk is released, so strings can be
+ *	borrowed from the chunk.
+ */
+
+struct JSONLines::Worker
+{
+	JSONArena			arena;
+	JSONKeyTable		keys;
+	JSONRecordParser	parser;
+	JSONStats			stats;
+
+						Worker() : parser(&arena,&keys)
+							{
+								parser.setBorrowStrings(true);
+							}
+};
+
+/****************************************************************************/
+/*																			*/
+/*	JSON Lines																*/
+/*																			*/
+/****************************************************************************/
+
+JSONLines::JSONLines(JSONWorkPool *p)
+{
+	pool = p;
+	minify = false;
+	chunkSize = 1024*1024;
+	duplicates = JSONDuplicateLast;
+	stats = NULL;
+	records = 0;
+	line = 1;
+
+	for (int i = 0; i < pool->size(); ++i) {
+		workers.push_back(new Worker);
+	}
+}
+
+JSONLines::~JSONLines()
+{
+	for (size_t i = 0; i < workers.size(); ++i) {
+		delete workers[i];
+	}
+}
+
+/*	JSONLines::parseChunk
+ *
+ *		Runs on a worker: parse each line in the chunk as a record, and
+ *	format it into the chunk's output buffer.
+ */
+
+void JSONLines::parseChunk(Chunk *chunk)
+{
+	Worker *w = workers[pool->worker()];
+	const uint8_t *p = chunk->data;
+	const uint8_t *e = p + chunk->length;
+
+	while (p < e) {
+		const uint8_t *nl = (const uint8_t *)memchr(p,'\n',e - p);
+		const uint8_t *eol = nl ? nl : e;
+
+		/*
+		 *	Skip blank lines
+		 */
+
+		const uint8_t *q = p;
+		while ((q < eol) && ((*q == ' ') || (*q == '\t') || (*q == '\r'))) ++q;
+
+		if (q < eol) {
+			++chunk->records;
+
+			JSONMemoryInput in(p,eol - p);
+			JSONLexer lexer(&in);
+			lexer.setLine((uint32_t)(chunk->lines + 1));
+			lexer.setOffset(chunk->offset + (p - chunk->data),1);
+
+			/*
+			 *	Keys are shared by every record this worker parses. Records
+			 *	whose keys are all different (keyed by id, say) would grow
+			 *	the table without limit, so start over if it gets large.
+			 */
+			
+			w->arena.reset();
+			if (w->keys.bytesUsed() > 16*1024*1024) w->keys.clear();
+			w->parser.setDuplicates(duplicates);
+			w->parser.setLimits(limits);
+			w->parser.setStats(stats ? &w->stats : NULL);
+			w->parser.errors.setLimit(errors.getLimit());
+			JSONNode *node = w->parser.parse(&lexer);
+
+			JSONDiagnostics::iterator iter;
+			for (iter = w->parser.errors.begin(); iter != w->parser.errors.end(); ++iter) {
+				iter->setRecord(chunk->records);
+			}
+			chunk->errors.merge(w->parser.errors);
+
+			if (node) {
+				if (minify) {
+					JSONMinify(node,&chunk->out);
+				} else {
+					JSONFormat(node,&chunk->out);
+				}
+				chunk->out.put('\n');
+			}
+		}
+
+		if (nl) ++chunk->lines;
+		p = eol + 1;
+	}
+
+	std::lock_guard<std::mutex> g(lock);
+	chunk->finished = true;
+	done.notify_all();
+}
+
+/*	JSONLines::submit
+ *
+ *		Queue the chunk for parsing
+ */
+
+void JSONLines::submit(Chunk *chunk)
+{
+	chunk->lines = 0;
+	chunk->records = 0;
+	chunk->finished = false;
+	chunk->errors.setLimit(errors.getLimit());
+
+	pool->submit([this,chunk] { parseChunk(chunk); });
+}
+
+/*	JSONLines::emit
+ *
+ *		Wait for the chunk to finish, then write its output and fix up the
+ *	line and record numbers of its errors.
+ */
+
+void JSONLines::emit(Chunk *chunk, JSONWriter *out)
+{
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		done.wait(lk,[chunk] { return chunk->finished; });
+	}
+
+	out->write(chunk->out.str());
+
+	JSONDiagnostics::iterator iter;
+	for (iter = chunk->errors.begin(); iter != chunk->errors.end(); ++iter) {
+		iter->setLine(iter->getLine() + line - 1);
+		iter->setRecord(iter->getRecord() + records);
+	}
+	errors.merge(chunk->errors);
+
+	line += chunk->lines;
+	records += chunk->records;
+	delete chunk;
+}
+
+/*	JSONLines::process
+ *
+ *		Split the input into chunks of whole lines, parse them in parallel,
+ *	and write the results in order. Memory mapped and in-memory input is
+ *	parsed in place; other input is copied a chunk at a time. The number of
+ *	chunks in flight is bounded so memory use does not depend on the size
+ *	of the input.
+ */
+
+bool JSONLines::process(JSONInput *input, JSONWriter *out)
+{
+	std::deque<Chunk *> inflight;
+	size_t maxInflight = 4 * workers.size();
+	bool persistent = input->isPersistent();
+	uint64_t offset = 0;
+	std::string carry;
+	const uint8_t *data;
+	size_t len;
+
+	errors.clear();
+	records = 0;
+	line = 1;
+
+	/*
+	 *	Queue a chunk, first writing out the oldest chunks if there are too
+	 *	many in flight.
+	 */
+
+	auto queue = [&](const uint8_t *start, size_t length, bool copy) {
+		while (inflight.size() >= maxInflight) {
+			emit(inflight.front(),out);
+			inflight.pop_front();
+		}
+
+		Chunk *chunk = new Chunk;
+		if (copy) {
+			chunk->copy.assign((const char *)start,length);
+			start = (const uint8_t *)chunk->copy.data();
+		}
+		chunk->data = start;
+		chunk->length = length;
+		chunk->out.setRawUTF8(out->isRawUTF8());
+		chunk->offset = offset;
+		offset += length;
+
+		inflight.push_back(chunk);
+		submit(chunk);
+	};
+
+	auto readBlock = [&]() {
+		JSONStatsPhase phase(stats,JSONPhaseRead);
+		return input->read(&data);
+	};
+
+	while ((len = readBlock()) > 0) {
+		const uint8_t *pos = data;
+		const uint8_t *end = data + len;
+
+		/*
+		 *	Finish the line left over from the last block
+		 */
+
+		if (!carry.empty()) {
+			const uint8_t *nl = (const uint8_t *)memchr(pos,'\n',end - pos);
+			if (nl == NULL) {
+				carry.append((const char *)pos,len);
+				continue;
+			}
+			carry.append((const char *)pos,nl + 1 - pos);
+			queue((const uint8_t *)carry.data(),carry.size(),true);
+			carry.clear();
+			pos = nl + 1;
+		}
+
+		/*
+		 *	Cut the block into chunks at the first newline after each
+		 *	chunkSize bytes.
+		 */
+
+		while ((size_t)(end - pos) > chunkSize) {
+			const uint8_t *cut = pos + chunkSize;
+			const uint8_t *nl = (const uint8_t *)memchr(cut,'\n',end - cut);
+			if (nl == NULL) break;
+
+			queue(pos,nl + 1 - pos,!persistent);
+			pos = nl + 1;
+		}
+
+		/*
+		 *	Queue the remaining complete lines, and carry the partial line
+		 *	into the next block.
+		 */
+
+		const uint8_t *last = end;
+		while ((last > pos) && (last[-1] != '\n')) --last;
+		if (last > pos) {
+			queue(pos,last - pos,!persistent);
+		}
+		carry.append((const char *)last,end - last);
+	}
+
+	if (!carry.empty()) {
+		queue((const uint8_t *)carry.data(),carry.size(),true);
+	}
+
+	while (!inflight.empty()) {
+		emit(inflight.front(),out);
+		inflight.pop_front();
+	}
+
+	if (stats) {
+		for (size_t i = 0; i < workers.size(); ++i) {
+			stats->merge(workers[i]->stats);
+			workers[i]->stats.clear();
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,633 @@
+//
+//  JSONParallel.cpp
+//  prettyjson
+//
+
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Structures														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONParallelParser::Segment
+ *
+ *		A slice of the document scanned by one task. The first pass does not
+ *	know whether the slice starts inside a string, so it tracks both cases;
+ *	the prefix sum then picks the right one and fills in the state at the
+ *	start of the segment, from which the second pass finds a split point.
+ */
+
+struct JSONParallelParser::Segment
+{
+	const uint8_t		*start;
+	const uint8_t		*end;
+	
+	/* First pass: [0] if we start outside a string, [1] if inside */
+	bool				endInString[2];
+	long				delta[2];
+	long				minDelta[2];
+	long				newlines;
+	
+	/* Prefix sum: state at the start of the segment */
+	bool				inString;
+	long				depth;
+	long				line;
+	
+	/* Second pass: first comma between members of the top container */
+	const uint8_t		*split;
+	long				splitLine;
+};
+
+/*	JSONParallelParser::Part
+ *
+ *		A run of members of the top level container, and the results of
+ *	parsing it.
+ */
+
+struct JSONParallelParser::Part
+{
+	const uint8_t		*start;
+	size_t				length;
+	long				line;
+	bool				first;
+	bool				last;
+	
+	bool				clean;
+	bool				aborted;		/* exceeded a limit */
+	bool				finished;
+	JSONNode			*node;
+	JSONMemoryWriter	*out;
+	JSONDiagnostics		errors;
+	JSONStats			stats;
+};
+
+/*	ScanState
+ *
+ *		Structural state as seen by the lexer: whether we are in a string,
+ *	the byte escaped by a preceding backslash, and the bracket depth.
+ */
+
+struct ScanState
+{
+	bool				inString;
+	const uint8_t		*escaped;
+	long				depth;
+	long				minDepth;
+};
+
+static inline void ScanStep(ScanState &s, const uint8_t *p)
+{
+	if (p == s.escaped) return;
+	
+	uint8_t c = *p;
+	if (s.inString) {
+		if (c == '\\') {
+			s.escaped = p + 1;
+		} else if (c == '"') {
+			s.inString = false;
+		}
+	} else if (c == '"') {
+		s.inString = true;
+	} else if ((c == '[') || (c == '{')) {
+		++s.depth;
+	} else if ((c == ']') || (c == '}')) {
+		if (--s.depth < s.minDepth) s.minDepth = s.depth;
+	}
+}
+
+/*	ScanStructure
+ *
+ *		Call fn for each quote, backslash and structural character in the
+ *	range, using the stage 1 scanner to skip everything else. Stops and
+ *	returns the position if fn returns true, or returns NULL at the end of
+ *	the range. Newlines before the returned position are added to lines.
+ */
+
+template <class F>
+static const uint8_t *ScanStructure(const uint8_t *p, const uint8_t *e, long *lines, F fn)
+{
+	JSONBlockMasks m;
+	
+	while (p < e) {
+		size_t len = e - p;
+		if (len >= 64) {
+			len = 64;
+			JSONScanner::classify(p,&m);
+		} else {
+			JSONScanner::classify(p,len,&m);
+		}
+		
+		uint64_t bits = m.structural | m.quote | m.backslash;
+		while (bits) {
+			int idx = __builtin_ctzll(bits);
+			if (fn(p + idx)) {
+				*lines += __builtin_popcountll(m.newline & ((1ULL << idx) - 1));
+				return p + idx;
+			}
+			bits &= bits - 1;
+		}
+		*lines += __builtin_popcountll(m.newline);
+		p += len;
+	}
+	return NULL;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Parallel Parser															*/
+/*																			*/
+/****************************************************************************/
+
+JSONParallelParser::JSONParallelParser(JSONWorkPool *p)
+{
+	pool = p;
+	partSize = 4*1024*1024;
+	duplicates = JSONDuplicateLast;
+	borrowStrings = false;
+	stats = NULL;
+	data = colScan = colLine = NULL;
+	isObject = false;
+	failed = false;
+	formatting = false;
+	wrote = false;
+	rawUTF8 = false;
+	minify = false;
+	
+	/*
+	 *	One arena and key table per worker, and one for the calling thread
+	 */
+	
+	for (int i = 0; i <= pool->size(); ++i) {
+		arenas.push_back(new JSONArena);
+		keys.push_back(new JSONKeyTable);
+	}
+}
+
+JSONParallelParser::~JSONParallelParser()
+{
+	reset();
+	for (size_t i = 0; i < arenas.size(); ++i) {
+		delete arenas[i];
+		delete keys[i];
+	}
+}
+
+/*	JSONParallelParser::reset
+ *
+ *		Release the results of the last parse
+ */
+
+void JSONParallelParser::reset()
+{
+	for (size_t i = 0; i < parts.size(); ++i) {
+		delete parts[i]->out;
+		delete parts[i];
+	}
+	parts.clear();
+	segments.clear();
+	errors.clear();
+	failed = false;
+	wrote = false;
+	
+	for (size_t i = 0; i < arenas.size(); ++i) {
+		arenas[i]->reset();
+		keys[i]->clear();
+	}
+}
+
+/*	JSONParallelParser::scanSegment
+ *
+ *		First pass: find the bracket depth change across the segment, and
+ *	whether it ends in a string, for both possible starting states.
+ */
+
+void JSONParallelParser::scanSegment(Segment *seg)
+{
+	ScanState s[2] = {
+		{ false, NULL, 0, 0 },
+		{ true, NULL, 0, 0 }
+	};
+	
+	seg->newlines = 0;
+	ScanStructure(seg->start,seg->end,&seg->newlines,[&s](const uint8_t *p) {
+		ScanStep(s[0],p);
+		ScanStep(s[1],p);
+		return false;
+	});
+	
+	for (int i = 0; i < 2; ++i) {
+		seg->endInString[i] = s[i].inString;
+		seg->delta[i] = s[i].depth;
+		seg->minDelta[i] = s[i].minDepth;
+	}
+}
+
+/*	JSONParallelParser::findSplit
+ *
+ *		Second pass: find the first comma in the segment which separates two
+ *	members of the top level container, stopping at the point where the top
+ *	level container closes.
+ */
+
+void JSONParallelParser::findSplit(Segment *seg, const uint8_t *close)
+{
+	ScanState s = { seg->inString, NULL, seg->depth, seg->depth };
+	const uint8_t *end = (seg->end < close) ? seg->end : close;
+	
+	seg->splitLine = seg->line;
+	seg->split = ScanStructure(seg->start,end,&seg->splitLine,[&s](const uint8_t *p) {
+		if (!s.inString && (s.depth == 1) && (*p == ',') && (p != s.escaped)) return true;
+		ScanStep(s,p);
+		return false;
+	});
+}
+
+/*	JSONParallelParser::split
+ *
+ *		Find the top level container and split its contents into parts.
+ *	Returns false if the document is not an array or object.
+ */
+
+bool JSONParallelParser::split(const uint8_t *data, size_t length)
+{
+	const uint8_t *end = data + length;
+	const uint8_t *p = data;
+	long line = 1;
+	
+	while ((p < end) && ((*p == ' ') || (*p == '\t') || (*p == '\r') || (*p == '\n'))) {
+		if (*p == '\n') ++line;
+		++p;
+	}
+	if ((p >= end) || ((*p != '[') && (*p != '{'))) return false;
+	isObject = (*p == '{');
+	
+	/*
+	 *	Cut the contents into segments. A segment never starts just after a
+	 *	backslash, so it cannot start in the middle of an escape.
+	 */
+	
+	const uint8_t *body = p + 1;
+	size_t n = (end - body) / partSize;
+	if (n < 1) n = 1;
+	
+	const uint8_t *start = body;
+	for (size_t i = 1; i <= n; ++i) {
+		const uint8_t *stop = (i == n) ? end : body + (end - body) * i / n;
+		while ((stop < end) && (stop > start) && (stop[-1] == '\\')) ++stop;
+		if (stop <= start) continue;
+		
+		Segment seg;
+		seg.start = start;
+		seg.end = stop;
+		segments.push_back(seg);
+		start = stop;
+	}
+	if (segments.empty()) return false;		/* nothing after the bracket */
+	
+	for (size_t i = 0; i < segments.size(); ++i) {
+		Segment *seg = &segments[i];
+		pool->submit([this,seg] { scanSegment(seg); });
+	}
+	pool->wait();
+	
+	/*
+	 *	Prefix sum, and find the segment where the top level container
+	 *	closes, if it does.
+	 */
+	
+	const uint8_t *close = end;
+	bool inString = false;
+	long depth = 1;
+	
+	for (size_t i = 0; i < segments.size(); ++i) {
+		Segment &seg = segments[i];
+		int h = inString ? 1 : 0;
+		
+		seg.inString = inString;
+		seg.depth = depth;
+		seg.line = line;
+		
+		if ((close == end) && (depth + seg.minDelta[h] <= 0)) {
+			ScanState s = { inString, NULL, depth, depth };
+			long lines = 0;
+			close = ScanStructure(seg.start,seg.end,&lines,[&s](const uint8_t *p) {
+				ScanStep(s,p);
+				return s.depth <= 0;
+			});
+			if (close == NULL) close = end;
+		}
+		
+		inString = seg.endInString[h];
+		depth += seg.delta[h];
+		line += seg.newlines;
+	}
+	
+	/*
+	 *	Find a split point in each segment after the first
+	 */
+	
+	segments[0].split = NULL;
+	for (size_t i = 1; i < segments.size(); ++i) {
+		Segment *seg = &segments[i];
+		if (seg->start < close) {
+			pool->submit([this,seg,close] { findSplit(seg,close); });
+		} else {
+			seg->split = NULL;
+		}
+	}
+	pool->wait();
+	
+	/*
+	 *	Build the parts between the split points
+	 */
+	
+	start = body;
+	line = segments[0].line;
+	for (size_t i = 0; i <= segments.size(); ++i) {
+		const uint8_t *stop;
+		long next;
+		
+		if (i == segments.size()) {
+			stop = end;
+			next = 0;
+		} else if (segments[i].split) {
+			stop = segments[i].split;
+			next = segments[i].splitLine;
+		} else {
+			continue;
+		}
+		
+		Part *part = new Part;
+		part->start = start;
+		part->length = stop - start;
+		part->line = line;
+		part->first = parts.empty();
+		part->last = (i == segments.size());
+		part->clean = false;
+		part->aborted = false;
+		part->finished = false;
+		part->node = NULL;
+		part->out = NULL;
+		parts.push_back(part);
+		
+		start = stop + 1;
+		line = next;
+	}
+	
+	return true;
+}
+
+/*	JSONParallelParser::parsePart
+ *
+ *		Parse a part into a container of its own, or format it into a memory
+ *	buffer.
+ */
+
+void JSONParallelParser::parsePart(Part *part)
+{
+	JSONMemoryInput in(part->start,part->length);
+	JSONLexer lexer(&in);
+	lexer.setLine((uint32_t)part->line);
+	lexer.setOffset(part->start - data,1);
+	if (stats) part->stats.clear();
+	
+	if (formatting) {
+		delete part->out;
+		part->out = new JSONMemoryWriter;
+		part->out->setRawUTF8(rawUTF8);
+		
+		JSONStreamFormatter formatter(part->out);
+		formatter.setMinify(minify);
+		formatter.setLimits(limits);
+		formatter.setStats(stats ? &part->stats : NULL);
+		formatter.errors.setLimit(errors.getLimit());
+		part->clean = formatter.formatRange(&lexer,isObject,part->first,part->last);
+		part->aborted = formatter.exceededLimit();
+		part->errors = formatter.errors;
+	} else {
+		int w = pool->worker();
+		if (w < 0) w = (int)arenas.size() - 1;
+		
+		JSONRecordParser parser(arenas[w],keys[w]);
+		parser.setDuplicates(duplicates);
+		parser.setBorrowStrings(borrowStrings);
+		parser.setLimits(limits);
+		parser.setStats(stats ? &part->stats : NULL);
+		parser.errors.setLimit(errors.getLimit());
+		part->node = parser.parseRange(&lexer,isObject,part->first,part->last,&part->clean);
+		part->aborted = parser.exceededLimit();
+		part->errors = parser.errors;
+	}
+	
+	std::lock_guard<std::mutex> g(lock);
+	part->finished = true;
+	done.notify_all();
+}
+
+/*	JSONParallelParser::waitPart
+ *
+ *		Wait for a part to be parsed
+ */
+
+void JSONParallelParser::waitPart(Part *part)
+{
+	std::unique_lock<std::mutex> lk(lock);
+	done.wait(lk,[part] { return part->finished; });
+}
+
+/*	JSONParallelParser::run
+ *
+ *		Parse the parts on the work pool, and collect the results in order,
+ *	either into the root container or to the output. A part which did not
+ *	end cleanly is joined with the parts after it and parsed again on this
+ *	thread until it does. When formatting, the number of parts in flight is
+ *	bounded so the buffered output does not grow with the document. Sets
+ *	failed if a part exceeded a limit.
+ */
+
+void JSONParallelParser::run(JSONNode *root, JSONWriter *out)
+{
+	size_t limit = formatting ? 4 * pool->size() : parts.size();
+	size_t next = 0;
+	
+	for (size_t i = 0; i < parts.size(); ++i) {
+		while ((next < parts.size()) && (next < i + limit)) {
+			Part *part = parts[next++];
+			pool->submit([this,part] { parsePart(part); });
+		}
+		
+		Part *part = parts[i];
+		waitPart(part);
+		
+		/*
+		 *	Fall back to the sequential parser for a bad split
+		 */
+		
+		size_t j = i;
+		while (!part->clean && !part->aborted && (j + 1 < parts.size())) {
+			Part *tail = parts[++j];
+			if (j < next) {
+				waitPart(tail);
+			} else {
+				next = j + 1;
+			}
+			
+			part->length = tail->start + tail->length - part->start;
+			part->last = tail->last;
+			parsePart(part);
+		}
+		
+		/*
+		 *	Collect the results. A part which exceeded a limit ends the parse.
+		 */
+		
+		if (part->aborted) {
+			collect(part);
+			failed = true;
+			break;
+		}
+		
+		if (formatting) {
+			out->write(part->out->str());
+			wrote = true;
+		} else if (isObject) {
+			JSONObject *obj = static_cast<JSONObject *>(root);
+			JSONObject *src = static_cast<JSONObject *>(part->node);
+			JSONObject::iterator iter;
+			for (iter = src->begin(); iter != src->end(); ++iter) {
+				obj->add(iter->first,iter->second,duplicates);
+			}
+		} else {
+			JSONArray *array = static_cast<JSONArray *>(root);
+			JSONArray *src = static_cast<JSONArray *>(part->node);
+			array->insert(array->end(),src->begin(),src->end());
+		}
+		
+		collect(part);
+		
+		for (size_t k = i; k <= j; ++k) {
+			delete parts[k]->out;
+			parts[k]->out = NULL;
+		}
+		i = j;
+	}
+	
+	pool->wait();
+}
+
+/*	JSONParallelParser::collect
+ *
+ *		Add the diagnostics from a part. The part was parsed as if its first
+ *	byte were in column 1, so fix the columns on its first line.
+ */
+
+void JSONParallelParser::collect(Part *part)
+{
+	uint32_t column = 0;
+	
+	JSONDiagnostics::iterator iter;
+	for (iter = part->errors.begin(); iter != part->errors.end(); ++iter) {
+		if (iter->getLine() != part->line) continue;
+		if (column == 0) column = columnAt(part->start);
+		iter->setColumn(iter->getColumn() + column - 1);
+	}
+	errors.merge(part->errors);
+	if (stats) stats->merge(part->stats);
+}
+
+/*	JSONParallelParser::columnAt
+ *
+ *		Return the column of a position in the document. Positions are asked
+ *	for in order, so we only look back for a newline as far as last time.
+ */
+
+uint32_t JSONParallelParser::columnAt(const uint8_t *p)
+{
+	for (const uint8_t *q = p; q > colScan; ) {
+		if (*--q == '\n') {
+			colLine = q + 1;
+			break;
+		}
+	}
+	colScan = p;
+	return (uint32_t)(p - colLine) + 1;
+}
+
+/*	JSONParallelParser::parse
+ *
+ *		Parse the document into a DOM. The DOM is allocated from our arenas,
+ *	and is valid until the next parse or until the parser is deleted (and,
+ *	if strings are borrowed, while the data is).
+ */
+
+JSONNode *JSONParallelParser::parse(const uint8_t *d, size_t length)
+{
+	reset();
+	formatting = false;
+	data = colScan = colLine = d;
+	
+	JSONArena *arena = arenas.back();
+	
+	if (!canSplit() || !split(data,length)) {
+		JSONMemoryInput in(data,length);
+		JSONLexer lexer(&in);
+		JSONRecordParser parser(arena,keys.back());
+		parser.setDuplicates(duplicates);
+		parser.setBorrowStrings(borrowStrings);
+		parser.setLimits(limits);
+		parser.setStats(stats);
+		parser.errors.setLimit(errors.getLimit());
+		
+		JSONNode *node = parser.parse(&lexer);
+		errors = parser.errors;
+		return node;
+	}
+	
+	if (stats) stats->value(isObject ? JSONTypeObject : JSONTypeArray);
+	
+	JSONNode *root;
+	if (isObject) {
+		root = new (arena) JSONObject(arena);
+	} else {
+		root = new (arena) JSONArray(arena);
+	}
+	
+	run(root,NULL);
+	return failed ? NULL : root;
+}
+
+/*	JSONParallelParser::format
+ *
+ *		Parse and format the document to the output, as JSONStreamFormatter
+ *	does. Returns false if the document could not be parsed.
+ */
+
+bool JSONParallelParser::format(const uint8_t *d, size_t length, JSONWriter *out)
+{
+	reset();
+	formatting = true;
+	rawUTF8 = out->isRawUTF8();
+	data = colScan = colLine = d;
+	
+	if (!canSplit() || !split(data,length)) {
+		JSONMemoryInput in(data,length);
+		JSONLexer lexer(&in);
+		JSONStreamFormatter formatter(out);
+		formatter.setMinify(minify);
+		formatter.setLimits(limits);
+		formatter.setStats(stats);
+		formatter.errors.setLimit(errors.getLimit());
+		
+		bool ok = formatter.format(&lexer);
+		errors = formatter.errors;
+		wrote = formatter.wroteOutput();
+		return ok;
+	}
+	
+	if (stats) stats->value(isObject ? JSONTypeObject : JSONTypeArray);
+	
+	run(NULL,out);
+	return !failed;
+}
@@ -0,0 +1,344 @@
+//
+//  JSONParallelFormat.cpp
+//  prettyjson
+//
+
+#include "JSON.h"
+
+/*
+ *	Containers nested deeper than this are not cut into units of their own,
+ *	but formatted whole as members of the unit they fall in.
+ */
+
+#define PLAN_DEPTH			64
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Structures														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONParallelFormatter::Unit
+ *
+ *		A run of members of one container, and their formatted output. A
+ *	unit with no container holds text written by the planner, and is
+ *	finished from the start.
+ */
+
+struct JSONParallelFormatter::Unit
+{
+	JSONNode			*container;
+	size_t				begin;
+	size_t				end;
+	int					depth;			/* of the container */
+	bool				sameLine;
+	
+	bool				finished;
+	JSONMemoryWriter	out;
+};
+
+/*	Weight
+ *
+ *		Estimate the work to format the node: one per node, and one per 64
+ *	bytes of string. We stop counting at cap, so weighing a large subtree
+ *	costs no more than weighing one unit; a weight of cap or more only
+ *	says the node is at least that heavy. Nodes not yet weighed wait in
+ *	pending rather than on the thread's stack.
+ */
+
+static size_t Weight(JSONNode *node, size_t cap, std::vector<JSONNode *> &pending)
+{
+	size_t w = 0;
+
+	pending.clear();
+	pending.push_back(node);
+
+	while (!pending.empty() && (w < cap)) {
+		node = pending.back();
+		pending.pop_back();
+
+		JSONType type = node->type();
+		++w;
+		if (type == JSONTypeObject) {
+			JSONObject *obj = static_cast<JSONObject *>(node);
+			JSONObject::iterator iter;
+			for (iter = obj->begin(); (iter != obj->end()) && (w + pending.size() < cap); ++iter) {
+				w += 1 + iter->first.size() / 64;
+				pending.push_back(iter->second);
+			}
+		} else if (type == JSONTypeArray) {
+			JSONArray *array = static_cast<JSONArray *>(node);
+			JSONArray::iterator iter;
+			for (iter = array->begin(); (iter != array->end()) && (w + pending.size() < cap); ++iter) {
+				pending.push_back(*iter);
+			}
+		} else if (type == JSONTypeString) {
+			w += static_cast<JSONString *>(node)->size() / 64;
+		}
+	}
+
+	/*
+	 *	Each node left unweighed counts at least one
+	 */
+
+	return w + pending.size();
+}
+
+static bool IsContainer(JSONNode *node)
+{
+	JSONType type = node->type();
+	return (type == JSONTypeObject) || (type == JSONTypeArray);
+}
+
+static size_t Size(JSONNode *node)
+{
+	if (node->type() == JSONTypeObject) return static_cast<JSONObject *>(node)->size();
+	return static_cast<JSONArray *>(node)->size();
+}
+
+/*	Member
+ *
+ *		Write the separator and key which come before a member of the
+ *	container, exactly as JSONFormat or JSONMinify would, and return the
+ *	member's value.
+ */
+
+static JSONNode *Member(JSONWriter *w, JSONNode *container, size_t index, int depth, bool sameLine, bool minify)
+{
+	if (minify) {
+		if (index > 0) w->put(',');
+	} else if (index == 0) {
+		if (sameLine) {
+			w->newline(depth);
+		}
+	} else {
+		w->put(',');
+		w->put(' ');
+		w->newline(depth);
+	}
+
+	if (container->type() == JSONTypeObject) {
+		JSONObject::Member &m = *(static_cast<JSONObject *>(container)->begin() + index);
+		w->string(m.first);
+		if (minify) {
+			w->put(':');
+		} else {
+			w->write(": ",2);
+		}
+		return m.second;
+	}
+	return (*static_cast<JSONArray *>(container))[index];
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Parallel Formatter														*/
+/*																			*/
+/****************************************************************************/
+
+JSONParallelFormatter::JSONParallelFormatter(JSONWorkPool *p)
+{
+	pool = p;
+	minify = false;
+	unitSize = 16384;
+	out = NULL;
+	literal = NULL;
+}
+
+JSONParallelFormatter::~JSONParallelFormatter()
+{
+	for (size_t i = 0; i < spare.size(); ++i) {
+		delete spare[i];
+	}
+}
+
+/*	JSONParallelFormatter::format
+ *
+ *		Format the node. Scalars, small documents and single threaded pools
+ *	are formatted directly.
+ */
+
+void JSONParallelFormatter::format(JSONNode *node, JSONWriter *w)
+{
+	if ((pool->size() < 2) || !IsContainer(node) || (Weight(node,2 * unitSize,pending) < 2 * unitSize)) {
+		if (minify) {
+			JSONMinify(node,w);
+		} else {
+			JSONFormat(node,w);
+		}
+		return;
+	}
+
+	out = w;
+	literal = NULL;
+	plan(node,0,false);
+	while (!inflight.empty()) emit();
+
+	/*
+	 *	A worker may still be returning from its last unit
+	 */
+
+	pool->wait();
+}
+
+/*	JSONParallelFormatter::plan
+ *
+ *		Cut the members of the container into units. Members are gathered
+ *	until they weigh unitSize; a member which is a container weighing that
+ *	much by itself is planned in turn, so one huge member does not end up
+ *	in one unit, unless it is nested PLAN_DEPTH deep.
+ */
+
+void JSONParallelFormatter::plan(JSONNode *node, int depth, bool sameLine)
+{
+	bool isObject = (node->type() == JSONTypeObject);
+	size_t n = Size(node);
+	size_t begin = 0;
+	size_t weight = 0;
+
+	if (minify) {
+		text()->put(isObject ? '{' : '[');
+	} else {
+		text()->write(isObject ? "{ " : "[ ",2);
+	}
+
+	for (size_t i = 0; i < n; ++i) {
+		JSONNode *value;
+		if (isObject) {
+			value = (static_cast<JSONObject *>(node)->begin() + i)->second;
+		} else {
+			value = (*static_cast<JSONArray *>(node))[i];
+		}
+
+		size_t w = Weight(value,unitSize,pending);
+		if ((w >= unitSize) && IsContainer(value) && (depth < PLAN_DEPTH)) {
+			if (begin < i) queue(node,begin,i,depth,sameLine);
+			Member(text(),node,i,depth,sameLine,minify);
+			plan(value,depth + 1,true);
+			begin = i + 1;
+			weight = 0;
+			continue;
+		}
+
+		weight += w;
+		if (weight >= unitSize) {
+			queue(node,begin,i + 1,depth,sameLine);
+			begin = i + 1;
+			weight = 0;
+		}
+	}
+	if (begin < n) queue(node,begin,n,depth,sameLine);
+
+	if (!minify) text()->newline(depth - 1);
+	text()->put(isObject ? '}' : ']');
+}
+
+/*	JSONParallelFormatter::text
+ *
+ *		Return the writer for text between units
+ */
+
+JSONWriter *JSONParallelFormatter::text()
+{
+	if (literal == NULL) {
+		literal = newUnit();
+		literal->container = NULL;
+		literal->finished = true;
+		push(literal);
+	}
+	return &literal->out;
+}
+
+/*	JSONParallelFormatter::queue
+ *
+ *		Queue members [begin,end) of the container for formatting
+ */
+
+void JSONParallelFormatter::queue(JSONNode *container, size_t begin, size_t end, int depth, bool sameLine)
+{
+	Unit *unit = newUnit();
+	unit->container = container;
+	unit->begin = begin;
+	unit->end = end;
+	unit->depth = depth;
+	unit->sameLine = sameLine;
+	unit->finished = false;
+
+	literal = NULL;
+	push(unit);
+	pool->submit([this,unit] { formatUnit(unit); });
+}
+
+/*	JSONParallelFormatter::formatUnit
+ *
+ *		Runs on a worker: format the unit's members
+ */
+
+void JSONParallelFormatter::formatUnit(Unit *unit)
+{
+	for (size_t i = unit->begin; i < unit->end; ++i) {
+		JSONNode *value = Member(&unit->out,unit->container,i,unit->depth,unit->sameLine,minify);
+		if (minify) {
+			JSONMinify(value,&unit->out);
+		} else {
+			JSONFormat(value,&unit->out,unit->depth + 1,true);
+		}
+	}
+
+	std::lock_guard<std::mutex> g(lock);
+	unit->finished = true;
+	done.notify_all();
+}
+
+/*	JSONParallelFormatter::newUnit
+ *
+ *		Return an empty unit, reusing one already written if we can
+ */
+
+JSONParallelFormatter::Unit *JSONParallelFormatter::newUnit()
+{
+	Unit *unit;
+	if (spare.empty()) {
+		unit = new Unit;
+	} else {
+		unit = spare.back();
+		spare.pop_back();
+		unit->out.clear();
+	}
+	unit->out.setRawUTF8(out->isRawUTF8());
+	return unit;
+}
+
+/*	JSONParallelFormatter::push
+ *
+ *		Add a unit to the output, first writing out the oldest units if
+ *	there are too many in flight.
+ */
+
+void JSONParallelFormatter::push(Unit *unit)
+{
+	size_t maxInflight = 4 * pool->size();
+	while (inflight.size() >= maxInflight) emit();
+
+	inflight.push_back(unit);
+}
+
+/*	JSONParallelFormatter::emit
+ *
+ *		Wait for the oldest unit to finish, and write it out
+ */
+
+void JSONParallelFormatter::emit()
+{
+	Unit *unit = inflight.front();
+	inflight.pop_front();
+	if (unit == literal) literal = NULL;
+
+	{
+		std::unique_lock<std::mutex> lk(lock);
+		done.wait(lk,[unit] { return unit->finished; });
+	}
+
+	out->write(unit->out.str());
+	spare.push_back(unit);
+}
@@ -0,0 +1,348 @@
+//
+//  JSONPipeline.cpp
+//  prettyjson
+//
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <new>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Block Ring																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONBlockRing::JSONBlockRing
+ *
+ *		Allocate the blocks. They are allocated once and reused.
+ */
+
+JSONBlockRing::JSONBlockRing(size_t count, size_t blockSize) : blocks(count)
+{
+	for (size_t i = 0; i < count; ++i) {
+		blocks[i].data = (char *)malloc(blockSize);
+		if (blocks[i].data == NULL) throw std::bad_alloc();
+		blocks[i].length = 0;
+		blocks[i].capacity = blockSize;
+	}
+	head = 0;
+	tail = 0;
+	closed = false;
+	cancelled = false;
+	sleepers = 0;
+}
+
+JSONBlockRing::~JSONBlockRing()
+{
+	for (size_t i = 0; i < blocks.size(); ++i) {
+		free(blocks[i].data);
+	}
+}
+
+/*	JSONBlockRing::wait
+ *
+ *		Wait until ready() is true. We spin briefly first, since the other
+ *	side is usually close behind, then sleep. The sleeper count is raised
+ *	before ready() is checked under the lock, and the other side checks it
+ *	after moving its index, so one of the two always sees the other and a
+ *	wakeup cannot be lost.
+ */
+
+template <class Ready> void JSONBlockRing::wait(Ready ready)
+{
+	for (int i = 0; i < 64; ++i) {
+		if (ready()) return;
+		std::this_thread::yield();
+	}
+
+	std::unique_lock<std::mutex> lk(lock);
+	++sleepers;
+	while (!ready()) cond.wait(lk);
+	--sleepers;
+}
+
+void JSONBlockRing::wake()
+{
+	if (sleepers == 0) return;
+
+	std::lock_guard<std::mutex> g(lock);
+	cond.notify_all();
+}
+
+/*	JSONBlockRing::acquire
+ *
+ *		Producer: return the next free block, waiting if every block is in
+ *	use, or NULL if the consumer has gone.
+ */
+
+JSONBlockRing::Block *JSONBlockRing::acquire()
+{
+	size_t n = blocks.size();
+	wait([this,n] { return (head - tail < n) || cancelled; });
+	if (cancelled) return NULL;
+
+	Block *b = &blocks[head % n];
+	b->length = 0;
+	return b;
+}
+
+/*	JSONBlockRing::publish
+ *
+ *		Producer: hand the acquired block to the consumer
+ */
+
+void JSONBlockRing::publish()
+{
+	++head;
+	wake();
+}
+
+/*	JSONBlockRing::close
+ *
+ *		Producer: there are no more blocks
+ */
+
+void JSONBlockRing::close()
+{
+	closed = true;
+	wake();
+}
+
+/*	JSONBlockRing::sync
+ *
+ *		Producer: wait until the consumer has released every block
+ */
+
+void JSONBlockRing::sync()
+{
+	wait([this] { return (tail == head) || cancelled; });
+}
+
+/*	JSONBlockRing::take
+ *
+ *		Consumer: return the next published block, waiting if there is none,
+ *	or NULL once the ring is closed and empty.
+ */
+
+JSONBlockRing::Block *JSONBlockRing::take()
+{
+	wait([this] { return (tail != head) || closed; });
+	if (tail == head) return NULL;
+
+	return &blocks[tail % blocks.size()];
+}
+
+/*	JSONBlockRing::release
+ *
+ *		Consumer: hand the taken block back to the producer
+ */
+
+void JSONBlockRing::release()
+{
+	++tail;
+	wake();
+}
+
+/*	JSONBlockRing::cancel
+ *
+ *		Consumer: no more blocks will be taken
+ */
+
+void JSONBlockRing::cancel()
+{
+	cancelled = true;
+	wake();
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Pipelined Input															*/
+/*																			*/
+/****************************************************************************/
+
+JSONPipelineInput::JSONPipelineInput(int f, size_t blockSize, size_t count) : ring(count,blockSize)
+{
+	fd = f;
+	reading = false;
+	reader = std::thread(&JSONPipelineInput::run,this);
+}
+
+/*	JSONPipelineInput::~JSONPipelineInput
+ *
+ *		Stop the reader. If it is blocked in read(2) we wait for the read to
+ *	finish.
+ */
+
+JSONPipelineInput::~JSONPipelineInput()
+{
+	ring.cancel();
+	reader.join();
+}
+
+/*	JSONPipelineInput::run
+ *
+ *		The reader thread. Each block is filled, unless the lexer has caught
+ *	up and is waiting, in which case whatever has arrived is handed over.
+ */
+
+void JSONPipelineInput::run()
+{
+	JSONBlockRing::Block *b;
+	bool eof = false;
+
+	while (!eof && ((b = ring.acquire()) != NULL)) {
+		while (b->length < b->capacity) {
+			ssize_t len = ::read(fd,b->data + b->length,b->capacity - b->length);
+			if ((len < 0) && (errno == EINTR)) continue;
+			if (len <= 0) {
+				eof = true;
+				break;
+			}
+
+			b->length += len;
+			if (ring.isEmpty()) break;
+		}
+
+		if (b->length > 0) ring.publish();
+	}
+
+	ring.close();
+}
+
+/*	JSONPipelineInput::read
+ *
+ *		Return the block we took last time to the reader, and take the next
+ */
+
+size_t JSONPipelineInput::read(const uint8_t **data)
+{
+	if (reading) ring.release();
+
+	JSONBlockRing::Block *b = ring.take();
+	reading = (b != NULL);
+	if (b == NULL) return 0;
+
+	*data = (const uint8_t *)b->data;
+	return b->length;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Pipelined Writer														*/
+/*																			*/
+/****************************************************************************/
+
+JSONPipelineWriter::JSONPipelineWriter(int f, size_t size, size_t count) : JSONWriter(size), ring(count,size)
+{
+	fd = f;
+	failed = false;
+	writer = std::thread(&JSONPipelineWriter::run,this);
+}
+
+JSONPipelineWriter::~JSONPipelineWriter()
+{
+	flush();
+	ring.close();
+	writer.join();
+}
+
+/*	JSONPipelineWriter::handOff
+ *
+ *		Hand the buffer to the writer thread, and carry on in a free block.
+ *	The buffer is swapped with the block rather than copied.
+ */
+
+void JSONPipelineWriter::handOff()
+{
+	if (ptr == buffer) return;
+
+	size_t len = ptr - buffer;
+	if (stats) stats->output(len);
+
+	JSONBlockRing::Block *b;
+	{
+		JSONStatsPhase phase(stats,JSONPhaseWrite);
+		b = ring.acquire();
+	}
+
+	std::swap(b->data,buffer);
+	std::swap(b->capacity,capacity);
+	b->length = len;
+	ring.publish();
+
+	ptr = buffer;
+	limit = buffer + capacity;
+}
+
+/*	JSONPipelineWriter::overflow
+ *
+ *		Hand off the buffer without waiting for it to be written, and grow
+ *	the new one if a single request is larger than it.
+ */
+
+void JSONPipelineWriter::overflow(size_t len)
+{
+	handOff();
+
+	if (len > capacity) {
+		char *b = (char *)realloc(buffer,len);
+		if (b == NULL) throw std::bad_alloc();
+		buffer = ptr = b;
+		capacity = len;
+		limit = buffer + capacity;
+	}
+}
+
+/*	JSONPipelineWriter::flush
+ *
+ *		Hand off the buffer, and wait until everything has been written
+ */
+
+void JSONPipelineWriter::flush()
+{
+	handOff();
+
+	{
+		JSONStatsPhase phase(stats,JSONPhaseWrite);
+		ring.sync();
+	}
+	if (failed) error = true;
+}
+
+/*	JSONPipelineWriter::run
+ *
+ *		The writer thread. Once a write fails the rest of the output is
+ *	discarded, so the formatter is never held up.
+ */
+
+void JSONPipelineWriter::run()
+{
+	JSONBlockRing::Block *b;
+
+	while ((b = ring.take()) != NULL) {
+		drain(b->data,b->length);
+		ring.release();
+	}
+}
+
+/*	JSONPipelineWriter::drain
+ *
+ *		Runs on the writer thread: write the data to the file descriptor
+ */
+
+void JSONPipelineWriter::drain(const char *data, size_t len)
+{
+	while ((len > 0) && !failed) {
+		ssize_t n = ::write(fd,data,len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			failed = true;
+		} else {
+			data += n;
+			len -= n;
+		}
+	}
+}
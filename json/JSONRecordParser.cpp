@@ -5,6 +5,7 @@
 //  Created by William Woody on 9/10/21.
 //
 
+#include <string.h>
 #include "JSON.h"
 
 /****************************************************************************/
@@ -23,20 +24,100 @@ JSONNode::~JSONNode()
 {
 }
 
+/*	DeleteMembers
+ *
+ *		Containers delete their members directly, which recurses, until
+ *	they are nested DELETE_RECURSE deep. Below that the rest of the tree is
+ *	deleted here, walking it with a stack of our own so that deleting a
+ *	deep document does not overflow the thread's stack. Each container
+ *	inside is emptied before it is deleted, so its destructor has nothing
+ *	left to do.
+ */
+
+#define DELETE_RECURSE		256
+
+static thread_local int GDeleteDepth;
+
+struct DeleteFrame
+{
+	JSONNode	*node;
+	bool		isObject;
+	size_t		index;
+};
+
+static void DeleteMembers(JSONNode *container, bool isObject)
+{
+	std::vector<DeleteFrame> stack;
+	DeleteFrame top = { container, isObject, 0 };
+	stack.push_back(top);
+	
+	for (;;) {
+		DeleteFrame &f = stack.back();
+		JSONNode *node = NULL;
+		
+		if (f.isObject) {
+			JSONObject *obj = static_cast<JSONObject *>(f.node);
+			if (f.index < obj->size()) node = (obj->begin() + f.index++)->second;
+		} else {
+			JSONArray *array = static_cast<JSONArray *>(f.node);
+			if (f.index < array->size()) node = (*array)[f.index++];
+		}
+		
+		if (node == NULL) {
+			/*
+			 *	Finished this container. The one we started with belongs to
+			 *	the caller.
+			 */
+			
+			JSONNode *done = f.node;
+			bool doneObject = f.isObject;
+			stack.pop_back();
+			if (stack.empty()) break;
+			
+			if (doneObject) {
+				static_cast<JSONObject *>(done)->clear();
+			} else {
+				static_cast<JSONArray *>(done)->clear();
+			}
+			delete done;
+			continue;
+		}
+		
+		JSONType type = node->type();
+		if ((type == JSONTypeObject) || (type == JSONTypeArray)) {
+			DeleteFrame child = { node, type == JSONTypeObject, 0 };
+			stack.push_back(child);
+		} else {
+			delete node;
+		}
+	}
+}
+
 /* JSONObject */
 
-JSONObject::JSONObject()
+JSONObject::JSONObject(JSONArena *arena) : members(JSONAllocator<Member>(arena)), index(JSONAllocator<uint32_t>(arena))
 {
 }
 
 JSONObject::~JSONObject()
 {
-	// This runs the map and deletes the contents explicitly
-	std::map<std::string,JSONNode *>::iterator iter;
+	// Arena allocated contents are released with the arena
+	if (members.get_allocator().arena) return;
+	
+	// This runs the members and deletes the contents explicitly
+	if (members.empty()) return;
+	if (GDeleteDepth >= DELETE_RECURSE) {
+		DeleteMembers(this,true);
+		return;
+	}
+	
+	iterator iter;
 	
+	++GDeleteDepth;
 	for (iter = begin(); iter != end(); ++iter) {
 		delete iter->second;
 	}
+	--GDeleteDepth;
 }
 
 JSONType JSONObject::type()
@@ -44,20 +125,146 @@ JSONType JSONObject::type()
 	return JSONTypeObject;
 }
 
+/*	JSONObject::lookup
+ *
+ *		Return the position of the last member with the given key, or -1.
+ *	Small objects are searched from the end; larger ones go through the
+ *	hash index, which is built the first time it is needed.
+ */
+
+long JSONObject::lookup(const JSONKey &key)
+{
+	size_t len = members.size();
+	
+	if (len <= JSONOBJECT_LINEAR) {
+		for (size_t i = len; i-- > 0; ) {
+			const JSONKey &k = members[i].first;
+			if ((k.hash == key.hash) && (k == key)) return (long)i;
+		}
+		return -1;
+	}
+	
+	if (index.empty()) buildIndex(len * 4);
+	
+	size_t mask = index.size() - 1;
+	for (size_t slot = key.hash & mask; index[slot]; slot = (slot + 1) & mask) {
+		const JSONKey &k = members[index[slot] - 1].first;
+		if ((k.hash == key.hash) && (k == key)) return index[slot] - 1;
+	}
+	return -1;
+}
+
+/*	JSONObject::buildIndex
+ *
+ *		(Re)build the hash index with at least the given number of slots.
+ *	Members are indexed in order, so a later duplicate takes over the slot
+ *	of an earlier one.
+ */
+
+void JSONObject::buildIndex(size_t slots)
+{
+	size_t n = 64;
+	while (n < slots) n <<= 1;
+	
+	index.assign(n,0);
+	for (size_t i = 0; i < members.size(); ++i) {
+		indexMember(i);
+	}
+}
+
+/*	JSONObject::indexMember
+ *
+ *		Point the index slot for the member's key at the member
+ */
+
+void JSONObject::indexMember(size_t pos)
+{
+	const JSONKey &key = members[pos].first;
+	size_t mask = index.size() - 1;
+	size_t slot;
+	
+	for (slot = key.hash & mask; index[slot]; slot = (slot + 1) & mask) {
+		const JSONKey &k = members[index[slot] - 1].first;
+		if ((k.hash == key.hash) && (k == key)) break;
+	}
+	index[slot] = (uint32_t)(pos + 1);
+}
+
+/*	JSONObject::find
+ *
+ *		Return the value for the key, or NULL if there is none
+ */
+
+JSONNode *JSONObject::find(std::string_view key)
+{
+	return find(JSONKey(key,JSONKeyTable::hash(key)));
+}
+
+JSONNode *JSONObject::find(const JSONKey &key)
+{
+	long pos = lookup(key);
+	return (pos < 0) ? NULL : members[pos].second;
+}
+
+/*	JSONObject::add
+ *
+ *		Add a member, handling a duplicate key according to the policy
+ */
+
+bool JSONObject::add(const JSONKey &key, JSONNode *node, JSONDuplicates policy)
+{
+	if (policy != JSONDuplicateKeepAll) {
+		long pos = lookup(key);
+		if (pos >= 0) {
+			if (policy == JSONDuplicateFirst) return false;
+			
+			if (members.get_allocator().arena == NULL) delete members[pos].second;
+			members[pos].second = node;
+			return true;
+		}
+	}
+	
+	members.push_back(Member(key,node));
+	
+	/*
+	 *	Keep the index, if we have one, at no more than half full
+	 */
+	
+	if (!index.empty()) {
+		if (members.size() * 2 > index.size()) {
+			buildIndex(index.size() * 2);
+		} else {
+			indexMember(members.size() - 1);
+		}
+	}
+	return true;
+}
+
 /* JSONArray */
 
-JSONArray::JSONArray()
+JSONArray::JSONArray(JSONArena *arena) : vector(JSONAllocator<JSONNode *>(arena))
 {
 }
 
 JSONArray::~JSONArray()
 {
+	// Arena allocated contents are released with the arena
+	if (get_allocator().arena) return;
+	
 	// This runs the array and deletes the contents explicitly
+	if (empty()) return;
+	if (GDeleteDepth >= DELETE_RECURSE) {
+		DeleteMembers(this,false);
+		return;
+	}
+	
+	++GDeleteDepth;
 	size_t i,len = size();
 	for (i = 0; i < len; ++i) {
 		JSONNode *node = (*this)[i];
 		delete node;
 	}
+	--GDeleteDepth;
 }
 
 JSONType JSONArray::type()
@@ -69,14 +276,39 @@ JSONType JSONArray::type()
 
 JSONString::JSONString()
 {
+	owned = false;
 }
 
-JSONString::JSONString(std::string &val) : std::string(val)
+JSONString::JSONString(std::string_view val, JSONArena *arena) : JSONString(val,arena,true)
 {
 }
 
+JSONString::JSONString(std::string_view val, JSONArena *arena, bool copy)
+{
+	owned = false;
+	if (!copy) {
+		std::string_view::operator = (val);
+		return;
+	}
+	
+	char *str;
+	size_t len = val.size();
+	
+	if (arena) {
+		str = (char *)arena->alloc(len + 1,1);
+	} else {
+		str = new char[len + 1];
+		owned = true;
+	}
+	memcpy(str,val.data(),len);
+	str[len] = 0;
+	
+	std::string_view::operator = (std::string_view(str,len));
+}
+
 JSONString::~JSONString()
 {
+	if (owned) delete[] data();
 }
 
 JSONType JSONString::type()
@@ -174,21 +406,86 @@ int64_t JSONNumber::intValue()
 /*																			*/
 /****************************************************************************/
 
+/*	JSONKeyOwner
+ *
+ *		The root container of a document parsed on the heap with the parser's
+ *	own key table. The table is deleted with the document; the members
+ *	deleted after it never look at their keys.
+ */
+
+template <class T> class JSONKeyOwner: public T
+{
+	public:
+						JSONKeyOwner(JSONKeyTable *k) : keys(k)
+							{
+							}
+						~JSONKeyOwner()
+							{
+								delete keys;
+							}
+	
+	private:
+		JSONKeyTable	*keys;
+};
+
 /*	JSONRecordParser::JSONRecordParser
  *
  *		Start up
  */
 
-JSONRecordParser::JSONRecordParser()
+JSONRecordParser::JSONRecordParser(JSONArena *a, JSONKeyTable *k)
 {
+	arena = a;
+	root = NULL;
+	duplicates = JSONDuplicateLast;
+	borrowStrings = false;
+	
+	keys = k;
+	sharedKeys = k;
+	ownKeys = NULL;
 }
 
 JSONRecordParser::~JSONRecordParser()
 {
-	size_t i,len = stack.size();
-	for (i = 0; i < len; ++i) {
-		delete stack[i];
+	clearDropped();
+	delete ownKeys;
+}
+
+/*	JSONRecordParser::startDocument
+ *
+ *		Get ready to parse a new document. Object keys are interned. Without
+ *	a shared table we make one for each document: with an arena the keys
+ *	are copied into it, and otherwise the table is handed to the root
+ *	container (see JSONKeyOwner), so either way the keys last as long as the
+ *	document does rather than as long as we do.
+ */
+
+void JSONRecordParser::startDocument()
+{
+	stack.clear();
+	root = NULL;
+	
+	if (sharedKeys == NULL) {
+		delete ownKeys;
+		ownKeys = new JSONKeyTable(arena);
+		keys = ownKeys;
+	}
+}
+
+/*	JSONRecordParser::clearDropped
+ *
+ *		Delete the values refused as duplicate keys. A refused container
+ *	still receives its contents as they are parsed, so these are only
+ *	deleted once parsing is done.
+ */
+
+void JSONRecordParser::clearDropped()
+{
+	std::vector<JSONNode *>::iterator iter;
+	for (iter = dropped.begin(); iter != dropped.end(); ++iter) {
+		delete *iter;
 	}
+	dropped.clear();
 }
 
 /*	JSONRecordParser::parse
@@ -199,22 +496,53 @@ JSONRecordParser::~JSONRecordParser()
 JSONNode *JSONRecordParser::parse(JSONLexer *lexer)
 {
 	/*
-	 *	Wipe out the old stack.
+	 *	Wipe out the old stack. The stack only refers to containers owned by
+	 *	the previous root.
 	 */
 
-	size_t i,len = stack.size();
-	for (i = 0; i < len; ++i) {
-		delete stack[i];
-	}
-	stack.clear();
-	root = NULL;
+	startDocument();
 	
 	/*
 	 *	Start up the parser
 	 */
 	
-	bool err = JSONParser::parse(lexer,true);
-	if (!err) return NULL;				// On error, give up.
+	return result(BasicJSONParser::parse(lexer,true));
+}
+
+/*	JSONRecordParser::startPush
+ *
+ *		Start parsing pushed input (see BasicJSONParser::feed)
+ */
+
+void JSONRecordParser::startPush()
+{
+	startDocument();
+	BasicJSONParser::startPush();
+}
+
+/*	JSONRecordParser::finish
+ *
+ *		Finish parsing pushed input, and return the document
+ */
+
+JSONNode *JSONRecordParser::finish()
+{
+	return result(BasicJSONParser::finish());
+}
+
+/*	JSONRecordParser::result
+ *
+ *		Return the document once the parse is done, or NULL if it failed
+ */
+
+JSONNode *JSONRecordParser::result(bool success)
+{
+	clearDropped();
+	if (!success) {
+		// On error, give up.
+		if (arena == NULL) delete root;
+		return NULL;
+	}
 	
 	/*
 	 *	We should have one object on the stack. If we don't, something went
@@ -222,13 +550,37 @@ JSONNode *JSONRecordParser::parse(JSONLexer *lexer)
 	 */
 	
 	if (stack.size() != 0) {
-		error("Unbalanced close array and object markers make file invalid");
+		error(JSONErrorUnbalanced);
 		return NULL;
 	}
 	
 	return root;
 }
 
+/*	JSONRecordParser::parseRange
+ *
+ *		Parse part of a large container (see BasicJSONParser::parseRange) into a
+ *	new container of the same type. Sets clean to false if the part did not
+ *	end at a member boundary.
+ */
+
+JSONNode *JSONRecordParser::parseRange(JSONLexer *lexer, bool isObject, bool first, bool last, bool *clean)
+{
+	startDocument();
+	
+	if (isObject) {
+		startObject();
+	} else {
+		startArray();
+	}
+	
+	*clean = BasicJSONParser::parseRange(lexer,isObject,first,last,true);
+	clearDropped();
+	
+	stack.clear();
+	return root;
+}
+
 /****************************************************************************/
 /*																			*/
 /*	JSON Parser																*/
@@ -240,52 +592,59 @@ void JSONRecordParser::addValue(JSONNode *n)
 	if (root == NULL) {
 		root = n;
 	} else if (stack.size() < 1) {
-		error("INTERNAL ERROR: Multiple values without wrapped object");
+		error(JSONErrorInternal);
 	} else {
-		JSONNode *node = stack.back();
-		if (node->type() == JSONTypeObject) {
-			JSONObject *obj = dynamic_cast<JSONObject *>(node);
-			(*obj)[key] = n;
-		} else if (node->type() == JSONTypeArray) {
-			JSONArray *array = dynamic_cast<JSONArray *>(node);
-			array->push_back(n);
+		Frame &f = stack.back();
+		if (f.object) {
+			if (!f.object->add(key,n,duplicates) && (arena == NULL)) {
+				dropped.push_back(n);
+			}
 		} else {
-			error("INTERNAL ERROR: Wrapped object not on stack");
+			f.array->push_back(n);
 		}
 	}
 }
 
 void JSONRecordParser::null()
 {
-	addValue(new JSONNull);
+	addValue(new (arena) JSONNull);
 }
 
 void JSONRecordParser::boolean(bool val)
 {
-	addValue(new JSONNumber(val));
+	addValue(new (arena) JSONNumber(val));
 }
 
 void JSONRecordParser::integer(int64_t val)
 {
-	addValue(new JSONNumber(val));
+	addValue(new (arena) JSONNumber(val));
 }
 
 void JSONRecordParser::real(double val)
 {
-	addValue(new JSONNumber(val));
+	addValue(new (arena) JSONNumber(val));
 }
 
-void JSONRecordParser::string(std::string &val)
+void JSONRecordParser::string(std::string_view val)
 {
-	addValue(new JSONString(val));
+	addValue(new (arena) JSONString(val,arena,!(borrowStrings && isBorrowed())));
 }
 
 void JSONRecordParser::startArray()
 {
-	JSONArray *newArray = new JSONArray;
+	JSONArray *newArray;
+	
+	if ((root == NULL) && (ownKeys != NULL) && (arena == NULL)) {
+		newArray = new JSONKeyOwner<JSONArray>(ownKeys);
+		ownKeys = NULL;
+	} else {
+		newArray = new (arena) JSONArray(arena);
+	}
 	
 	addValue(newArray);				// Add empty array to the container
-	stack.push_back(newArray);
+	
+	Frame f = { NULL, newArray };
+	stack.push_back(f);
 }
 
 void JSONRecordParser::endArray()
@@ -295,10 +654,19 @@ void JSONRecordParser::endArray()
 
 void JSONRecordParser::startObject()
 {
-	JSONObject *newObject = new JSONObject;
+	JSONObject *newObject;
+	
+	if ((root == NULL) && (ownKeys != NULL) && (arena == NULL)) {
+		newObject = new JSONKeyOwner<JSONObject>(ownKeys);
+		ownKeys = NULL;
+	} else {
+		newObject = new (arena) JSONObject(arena);
+	}
 	
 	addValue(newObject);
-	stack.push_back(newObject);
+	
+	Frame f = { newObject, NULL };
+	stack.push_back(f);
 }
 
 void JSONRecordParser::endObject()
@@ -306,8 +674,17 @@ void JSONRecordParser::endObject()
 	stack.pop_back();
 }
 
-void JSONRecordParser::objectKey(std::string &value)
+void JSONRecordParser::objectKey(std::string_view value)
 {
-	key = value;
+	/*
+	 *	A borrowed key is already stored for as long as the document, so
+	 *	there is nothing to gain from interning it.
+	 */
+	
+	if (borrowStrings && isBorrowed()) {
+		key = JSONKey(value,JSONKeyTable::hash(value));
+	} else {
+		key = keys->intern(value);
+	}
 }
 
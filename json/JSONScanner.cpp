@@ -0,0 +1,355 @@
+//
+//  JSONScanner.cpp
+//  prettyjson
+//
+
+#include <string.h>
+#include "JSON.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__)
+#define JSON_X86	1
+#include <immintrin.h>
+#endif
+
+/****************************************************************************/
+/*																			*/
+/*	Scalar Kernel															*/
+/*																			*/
+/****************************************************************************/
+
+/*	ClassifyScalar
+ *
+ *		Classify a 64 byte block one byte at a time. This is the reference
+ *	implementation which the vector kernels must agree with.
+ */
+
+static void ClassifyScalar(const uint8_t *p, JSONBlockMasks *m)
+{
+	uint64_t ws = 0, st = 0, qt = 0, bs = 0, nl = 0;
+
+	for (int i = 0; i < 64; ++i) {
+		uint8_t c = p[i];
+		uint64_t bit = 1ULL << i;
+
+		if ((c == ' ') || ((c >= '\t') && (c <= '\r'))) ws |= bit;
+		if ((c == '{') || (c == '}') || (c == '[') || (c == ']') || (c == ':') || (c == ',')) st |= bit;
+		if (c == '"') qt |= bit;
+		if (c == '\\') bs |= bit;
+		if (c == '\n') nl |= bit;
+	}
+
+	m->whitespace = ws;
+	m->structural = st;
+	m->quote = qt;
+	m->backslash = bs;
+	m->newline = nl;
+}
+
+/*
+ *	Bytes which end a run of plain string text: quotes, backslashes,
+ *	control characters and everything outside of ASCII
+ */
+
+static struct PlainTable
+{
+	uint8_t			plain[256];
+
+	constexpr PlainTable() : plain()
+		{
+			for (int i = 0; i < 256; ++i) {
+				plain[i] = (i >= 0x20) && (i < 0x80) && (i != '"') && (i != '\\');
+			}
+		}
+} const GPlain;
+
+/*	PlainScalar
+ *
+ *		Length of the plain run at the start of p, a byte at a time
+ */
+
+static size_t PlainScalar(const uint8_t *p, size_t len)
+{
+	size_t i = 0;
+
+	while ((i < len) && GPlain.plain[p[i]]) ++i;
+	return i;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	SSE2 and AVX2 Kernels													*/
+/*																			*/
+/****************************************************************************/
+
+#ifdef JSON_X86
+
+/*	ClassifySSE2
+ *
+ *		Classify 64 bytes as four 16 byte lanes. Whitespace is ' ' or the
+ *	range '\t' through '\r', matching isspace() in the "C" locale.
+ */
+
+__attribute__((target("sse2")))
+static void ClassifySSE2(const uint8_t *p, JSONBlockMasks *m)
+{
+	const __m128i space = _mm_set1_epi8(' ');
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i four = _mm_set1_epi8(4);
+	const __m128i lbrace = _mm_set1_epi8('{');
+	const __m128i rbrace = _mm_set1_epi8('}');
+	const __m128i lbracket = _mm_set1_epi8('[');
+	const __m128i rbracket = _mm_set1_epi8(']');
+	const __m128i colon = _mm_set1_epi8(':');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i newline = _mm_set1_epi8('\n');
+
+	uint64_t ws = 0, st = 0, qt = 0, bs = 0, nl = 0;
+
+	for (int i = 0; i < 4; ++i) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i * 16));
+
+		__m128i ctl = _mm_sub_epi8(v,tab);
+		__m128i w = _mm_or_si128(_mm_cmpeq_epi8(v,space),
+					_mm_cmpeq_epi8(_mm_min_epu8(ctl,four),ctl));
+
+		__m128i s = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v,lbrace),_mm_cmpeq_epi8(v,rbrace)),
+					_mm_or_si128(
+						_mm_or_si128(_mm_cmpeq_epi8(v,lbracket),_mm_cmpeq_epi8(v,rbracket)),
+						_mm_or_si128(_mm_cmpeq_epi8(v,colon),_mm_cmpeq_epi8(v,comma))));
+
+		int shift = i * 16;
+		ws |= (uint64_t)(uint16_t)_mm_movemask_epi8(w) << shift;
+		st |= (uint64_t)(uint16_t)_mm_movemask_epi8(s) << shift;
+		qt |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,quote)) << shift;
+		bs |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,backslash)) << shift;
+		nl |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v,newline)) << shift;
+	}
+
+	m->whitespace = ws;
+	m->structural = st;
+	m->quote = qt;
+	m->backslash = bs;
+	m->newline = nl;
+}
+
+/*	ClassifyAVX2
+ *
+ *		Classify 64 bytes as two 32 byte lanes.
+ */
+
+__attribute__((target("avx2")))
+static void ClassifyAVX2(const uint8_t *p, JSONBlockMasks *m)
+{
+	const __m256i space = _mm256_set1_epi8(' ');
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i four = _mm256_set1_epi8(4);
+	const __m256i lbrace = _mm256_set1_epi8('{');
+	const __m256i rbrace = _mm256_set1_epi8('}');
+	const __m256i lbracket = _mm256_set1_epi8('[');
+	const __m256i rbracket = _mm256_set1_epi8(']');
+	const __m256i colon = _mm256_set1_epi8(':');
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i newline = _mm256_set1_epi8('\n');
+
+	uint64_t ws = 0, st = 0, qt = 0, bs = 0, nl = 0;
+
+	for (int i = 0; i < 2; ++i) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i * 32));
+
+		__m256i ctl = _mm256_sub_epi8(v,tab);
+		__m256i w = _mm256_or_si256(_mm256_cmpeq_epi8(v,space),
+					_mm256_cmpeq_epi8(_mm256_min_epu8(ctl,four),ctl));
+
+		__m256i s = _mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(v,lbrace),_mm256_cmpeq_epi8(v,rbrace)),
+					_mm256_or_si256(
+						_mm256_or_si256(_mm256_cmpeq_epi8(v,lbracket),_mm256_cmpeq_epi8(v,rbracket)),
+						_mm256_or_si256(_mm256_cmpeq_epi8(v,colon),_mm256_cmpeq_epi8(v,comma))));
+
+		int shift = i * 32;
+		ws |= (uint64_t)(uint32_t)_mm256_movemask_epi8(w) << shift;
+		st |= (uint64_t)(uint32_t)_mm256_movemask_epi8(s) << shift;
+		qt |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,quote)) << shift;
+		bs |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,backslash)) << shift;
+		nl |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v,newline)) << shift;
+	}
+
+	m->whitespace = ws;
+	m->structural = st;
+	m->quote = qt;
+	m->backslash = bs;
+	m->newline = nl;
+}
+
+/*	PlainSSE2
+ *
+ *		Find the end of a plain run 16 bytes at a time. Control characters
+ *	are the bytes for which max(v,0x1F) is 0x1F; bytes outside of ASCII
+ *	have their top bit set already, which is what movemask collects.
+ */
+
+__attribute__((target("sse2")))
+static size_t PlainSSE2(const uint8_t *p, size_t len)
+{
+	const __m128i quote = _mm_set1_epi8('"');
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i control = _mm_set1_epi8(0x1F);
+	size_t i = 0;
+
+	for (; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)(p + i));
+		__m128i stop = _mm_or_si128(
+					_mm_or_si128(_mm_cmpeq_epi8(v,quote),_mm_cmpeq_epi8(v,backslash)),
+					_mm_or_si128(_mm_cmpeq_epi8(_mm_max_epu8(v,control),control),v));
+
+		unsigned mask = (unsigned)_mm_movemask_epi8(stop);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	return i + PlainScalar(p + i,len - i);
+}
+
+/*	PlainAVX2
+ *
+ *		Find the end of a plain run 32 bytes at a time
+ */
+
+__attribute__((target("avx2")))
+static size_t PlainAVX2(const uint8_t *p, size_t len)
+{
+	const __m256i quote = _mm256_set1_epi8('"');
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i control = _mm256_set1_epi8(0x1F);
+	size_t i = 0;
+
+	for (; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)(p + i));
+		__m256i stop = _mm256_or_si256(
+					_mm256_or_si256(_mm256_cmpeq_epi8(v,quote),_mm256_cmpeq_epi8(v,backslash)),
+					_mm256_or_si256(_mm256_cmpeq_epi8(_mm256_max_epu8(v,control),control),v));
+
+		unsigned mask = (unsigned)_mm256_movemask_epi8(stop);
+		if (mask) return i + __builtin_ctz(mask);
+	}
+	if (i + 16 <= len) return i + PlainSSE2(p + i,len - i);
+	return i + PlainScalar(p + i,len - i);
+}
+
+#endif
+
+/****************************************************************************/
+/*																			*/
+/*	Dispatch																*/
+/*																			*/
+/****************************************************************************/
+
+/*	SelectKernel
+ *
+ *		Pick the best kernel this processor supports
+ */
+
+static JSONScanKernel SelectKernel()
+{
+#ifdef JSON_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return JSONScanAVX2;
+	if (__builtin_cpu_supports("sse2")) return JSONScanSSE2;
+#endif
+	return JSONScanScalar;
+}
+
+static std::atomic<JSONScanKernel> GKernel(SelectKernel());
+
+/*	JSONScanner::kernel
+ *
+ *		Return the kernel currently in use
+ */
+
+JSONScanKernel JSONScanner::kernel()
+{
+	return GKernel.load(std::memory_order_relaxed);
+}
+
+/*	JSONScanner::setKernel
+ *
+ *		Force a specific kernel; used for testing and benchmarking. Requests
+ *	for a kernel this processor cannot run are ignored. Returns the kernel
+ *	that will be used.
+ */
+
+JSONScanKernel JSONScanner::setKernel(JSONScanKernel k)
+{
+	JSONScanKernel best = SelectKernel();
+
+	if (k == JSONScanAuto) {
+		k = best;
+	} else if (k > best) {
+		return kernel();
+	}
+	GKernel.store(k,std::memory_order_relaxed);
+	return k;
+}
+
+/*	JSONScanner::classify
+ *
+ *		Classify exactly 64 bytes at p
+ */
+
+void JSONScanner::classify(const uint8_t *p, JSONBlockMasks *m)
+{
+	switch (kernel()) {
+#ifdef JSON_X86
+		case JSONScanAVX2:
+			ClassifyAVX2(p,m);
+			break;
+		case JSONScanSSE2:
+			ClassifySSE2(p,m);
+			break;
+#endif
+		default:
+			ClassifyScalar(p,m);
+			break;
+	}
+}
+
+/*	JSONScanner::classify
+ *
+ *		Classify up to 64 bytes at p. Short blocks are padded with spaces, so
+ *	the bits past the end of the data are whitespace and never anything else.
+ */
+
+void JSONScanner::classify(const uint8_t *p, size_t len, JSONBlockMasks *m)
+{
+	if (len >= 64) {
+		classify(p,m);
+	} else {
+		uint8_t tmp[64];
+		memcpy(tmp,p,len);
+		memset(tmp + len,' ',64 - len);
+		classify(tmp,m);
+	}
+}
+
+/*	JSONScanner::plain
+ *
+ *		Return the number of bytes at p, up to len, which are printable
+ *	ASCII and can be written in a JSON string as they are.
+ */
+
+size_t JSONScanner::plain(const uint8_t *p, size_t len)
+{
+	switch (kernel()) {
+#ifdef JSON_X86
+		case JSONScanAVX2:
+			return PlainAVX2(p,len);
+		case JSONScanSSE2:
+			return PlainSSE2(p,len);
+#endif
+		default:
+			return PlainScalar(p,len);
+	}
+}
@@ -0,0 +1,529 @@
+//
+//  JSONSelect.cpp
+//  prettyjson
+//
+
+#include <unordered_map>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Structures														*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONSelector::Level
+ *
+ *		An object on the path whose repeated keys are being resolved: the
+ *	keys seen so far and, with JSONDuplicateLast, the matches found under
+ *	each, in the order the keys first occurred.
+ */
+
+struct JSONSelector::Level
+{
+	struct Slot {
+		std::string		text;
+		size_t			count;
+	};
+
+	std::vector<Slot>	slots;
+	std::unordered_map<std::string,size_t> index;
+	size_t				current;		/* slot of the member being read */
+};
+
+/****************************************************************************/
+/*																			*/
+/*	Selector																*/
+/*																			*/
+/****************************************************************************/
+
+JSONSelector::JSONSelector(JSONWriter *w)
+{
+	out = w;
+	hasPending = false;
+	matchDepth = 0;
+	match = NULL;
+	matches = 0;
+	minify = false;
+	duplicates = JSONDuplicateLast;
+	levelCount = 0;
+}
+
+JSONSelector::~JSONSelector()
+{
+	for (size_t i = 0; i < levels.size(); ++i) {
+		delete levels[i];
+	}
+}
+
+/*	JSONSelector::setPointer
+ *
+ *		Set the JSON Pointer to select. The empty pointer selects the whole
+ *	document; otherwise each reference token follows a '/', with ~1 standing
+ *	for '/' and ~0 for '~'. Returns false if the pointer is malformed.
+ */
+
+bool JSONSelector::setPointer(std::string_view str)
+{
+	pointer.clear();
+	if (str.empty()) return true;
+	if (str[0] != '/') return false;
+
+	size_t pos = 1;
+	for (;;) {
+		size_t slash = str.find('/',pos);
+		std::string_view raw = str.substr(pos,(slash == std::string_view::npos) ? std::string_view::npos : slash - pos);
+
+		Token t;
+		for (size_t i = 0; i < raw.size(); ++i) {
+			if (raw[i] != '~') {
+				t.text.push_back(raw[i]);
+			} else if ((i + 1 < raw.size()) && (raw[i + 1] == '0')) {
+				t.text.push_back('~');
+				++i;
+			} else if ((i + 1 < raw.size()) && (raw[i + 1] == '1')) {
+				t.text.push_back('/');
+				++i;
+			} else {
+				return false;
+			}
+		}
+
+		/*
+		 *	An array index is "0" or digits without a leading zero
+		 */
+
+		t.wildcard = (raw == "*");
+		t.index = SIZE_MAX;
+		if (!t.text.empty() && (t.text.size() < 20) && ((t.text[0] != '0') || (t.text.size() == 1))) {
+			size_t n = 0;
+			size_t i;
+			for (i = 0; i < t.text.size(); ++i) {
+				char c = t.text[i];
+				if ((c < '0') || (c > '9')) break;
+				n = n * 10 + (c - '0');
+			}
+			if (i == t.text.size()) t.index = n;
+		}
+		pointer.push_back(t);
+
+		if (slash == std::string_view::npos) break;
+		pos = slash + 1;
+	}
+	return true;
+}
+
+/*	JSONSelector::select
+ *
+ *		Parse the input and write the matches. Returns false if the document
+ *	could not be parsed, though matches found before the failure have been
+ *	written.
+ */
+
+bool JSONSelector::select(JSONLexer *lexer)
+{
+	stack.clear();
+	hasPending = false;
+	matchDepth = 0;
+	match = NULL;
+	matches = 0;
+	levelCount = 0;
+	scratch.setRawUTF8(out->isRawUTF8());
+
+	bool ok = parse(lexer,true);
+
+	/*
+	 *	Objects left open if parsing stopped early still hold matches
+	 */
+
+	while (levelCount) endLevel();
+	return ok;
+}
+
+/*	JSONSelector::select
+ *
+ *		Write the matches in a snapshot. Returns false if the snapshot is not
+ *	open.
+ */
+
+bool JSONSelector::select(JSONSnapshot *snapshot)
+{
+	matches = 0;
+	if (!snapshot->isValid()) return false;
+
+	selectTape(snapshot,snapshot->root(),0);
+	return true;
+}
+
+/*	JSONSelector::selectTape
+ *
+ *		Follow the pointer from the value at the given depth
+ */
+
+void JSONSelector::selectTape(JSONSnapshot *snapshot, JSONTapeCursor c, size_t depth)
+{
+	if (depth == pointer.size()) {
+		write(c);
+		return;
+	}
+
+	const Token &t = pointer[depth];
+	JSONTapeTag tag = c.tag();
+
+	if (tag == JSONTapeStartObject) {
+		if (!t.wildcard) {
+			JSONTapeCursor value = snapshot->find(c,t.text);
+			if (value.isValid()) selectTape(snapshot,value,depth + 1);
+			return;
+		}
+		for (JSONTapeCursor k = c.first(); !k.isEnd(); ) {
+			JSONTapeCursor value = k.next();
+			selectTape(snapshot,value,depth + 1);
+			k = value.next();
+		}
+
+	} else if (tag == JSONTapeStartArray) {
+		if (!t.wildcard) {
+			if (t.index == SIZE_MAX) return;
+			JSONTapeCursor value = c[t.index];
+			if (value.isValid()) selectTape(snapshot,value,depth + 1);
+			return;
+		}
+		for (JSONTapeCursor value = c.first(); !value.isEnd(); value = value.next()) {
+			selectTape(snapshot,value,depth + 1);
+		}
+	}
+}
+
+/*	JSONSelector::select
+ *
+ *		Write the matches in an on-demand document. Returns false if the
+ *	document has no value.
+ */
+
+bool JSONSelector::select(JSONLazyDocument *doc)
+{
+	matches = 0;
+
+	JSONLazyValue root = doc->root();
+	if (!root.isValid()) return false;
+
+	selectLazy(root,0);
+	return true;
+}
+
+/*	JSONSelector::selectLazy
+ *
+ *		Follow the pointer from the value at the given depth. Indexing an
+ *	object by position gives its values, so a wildcard needs no keys.
+ */
+
+void JSONSelector::selectLazy(JSONLazyValue v, size_t depth)
+{
+	if (depth == pointer.size()) {
+		JSONNode *node = v.node();
+		if (node) write(node);
+		return;
+	}
+
+	const Token &t = pointer[depth];
+	JSONType type = v.type();
+
+	if ((type != JSONTypeObject) && (type != JSONTypeArray)) return;
+
+	if (t.wildcard) {
+		size_t size = v.size();
+		for (size_t i = 0; i < size; ++i) {
+			selectLazy(v[i],depth + 1);
+		}
+	} else if (type == JSONTypeObject) {
+		JSONLazyValue value = v[std::string_view(t.text)];
+		if (value.isValid()) selectLazy(value,depth + 1);
+	} else if (t.index != SIZE_MAX) {
+		JSONLazyValue value = v[t.index];
+		if (value.isValid()) selectLazy(value,depth + 1);
+	}
+}
+
+/*	JSONSelector::visit
+ *
+ *		Decide what to do with the value about to start, and count it as a
+ *	member of its container. A value matches the pointer so far if its
+ *	container does and its key or index matches the token for its depth.
+ */
+
+JSONSelector::Visit JSONSelector::visit()
+{
+	if (matchDepth) return VisitInside;
+	if (stack.empty()) return pointer.empty() ? VisitMatch : VisitPath;
+
+	Frame &f = stack.back();
+	size_t index = f.count++;
+	size_t depth = stack.size();
+
+	if (!f.onPath || (depth > pointer.size())) return VisitSkip;
+
+	const Token &t = pointer[depth - 1];
+	if (!t.wildcard) {
+		if (f.isObject) {
+			if (key != t.text) return VisitSkip;
+		} else {
+			if (index != t.index) return VisitSkip;
+		}
+	}
+	if (f.keyed && !visitKey()) return VisitSkip;
+
+	return (depth == pointer.size()) ? VisitMatch : VisitPath;
+}
+
+/*	JSONSelector::visitKey
+ *
+ *		A member of the innermost keyed object is on the path. Returns false
+ *	if it is to be skipped as a repeated key; otherwise matches under it go
+ *	to the slot for its key, and a repeated key drops what the earlier
+ *	occurrence matched.
+ */
+
+bool JSONSelector::visitKey()
+{
+	Level *l = levels[levelCount - 1];
+	auto r = l->index.emplace(key,l->slots.size());
+
+	if (r.second) {
+		Level::Slot s = { std::string(), 0 };
+		l->slots.push_back(s);
+	} else if (duplicates == JSONDuplicateFirst) {
+		return false;
+	} else {
+		Level::Slot &s = l->slots[r.first->second];
+		matches -= s.count;
+		s.text.clear();
+		s.count = 0;
+	}
+	l->current = r.first->second;
+	return true;
+}
+
+/*	JSONSelector::startLevel, endLevel
+ *
+ *		Start resolving the keys of an object on the path, and when it ends
+ *	pass on the matches it held, in order
+ */
+
+void JSONSelector::startLevel()
+{
+	if (levelCount == levels.size()) levels.push_back(new Level);
+
+	Level *l = levels[levelCount++];
+	l->slots.clear();
+	l->index.clear();
+}
+
+void JSONSelector::endLevel()
+{
+	Level *l = levels[--levelCount];
+
+	for (size_t i = 0; i < l->slots.size(); ++i) {
+		const Level::Slot &s = l->slots[i];
+		if (s.count) emit(s.text,s.count);
+	}
+	l->slots.clear();
+	l->index.clear();
+}
+
+/*	JSONSelector::emit
+ *
+ *		Write matches, or hold them in the slot of the innermost object
+ *	whose keys are still being resolved
+ */
+
+void JSONSelector::emit(std::string_view text, size_t count)
+{
+	if ((duplicates == JSONDuplicateLast) && levelCount) {
+		Level *l = levels[levelCount - 1];
+		Level::Slot &s = l->slots[l->current];
+		s.text.append(text);
+		s.count += count;
+	} else {
+		out->write(text.data(),text.size());
+	}
+}
+
+/*	JSONSelector::value
+ *
+ *		Handle a scalar. The node is only built if it is wanted.
+ */
+
+void JSONSelector::value(JSONNode *node)
+{
+	if (matchDepth) {
+		Frame &f = stack.back();
+		if (f.isObject) {
+			static_cast<JSONObject *>(f.node)->add(keys.intern(key),node,duplicates);
+		} else {
+			static_cast<JSONArray *>(f.node)->push_back(node);
+		}
+	} else {
+		write(node);
+	}
+}
+
+/*	JSONSelector::write
+ *
+ *		Write a match, and release everything built for it
+ */
+
+void JSONSelector::write(JSONNode *node)
+{
+	JSONWriter *w = out;
+
+	++matches;
+	if ((duplicates == JSONDuplicateLast) && levelCount) {
+		scratch.clear();
+		w = &scratch;
+	}
+	if (minify) {
+		JSONMinify(node,w);
+	} else {
+		JSONFormat(node,w);
+	}
+	w->put('\n');
+	if (w == &scratch) emit(scratch.str(),1);
+
+	arena.reset();
+	if (keys.bytesUsed() > 16*1024*1024) keys.clear();
+}
+
+void JSONSelector::write(JSONTapeCursor c)
+{
+	++matches;
+	if (minify) {
+		JSONMinify(c,out);
+	} else {
+		JSONFormat(c,out);
+	}
+	out->put('\n');
+}
+
+/*	JSONSelector::skipContainer
+ *
+ *		Skip any container which is not on the way to a match. The decision
+ *	is kept for the startArray() or startObject() which follows.
+ */
+
+bool JSONSelector::skipContainer()
+{
+	pending = visit();
+	hasPending = (pending != VisitSkip);
+	return !hasPending;
+}
+
+/*	JSONSelector::startContainer
+ *
+ *		Push a container. Pushed input is never skipped, so a container may
+ *	arrive without skipContainer() having been asked, and may be off the
+ *	path.
+ */
+
+void JSONSelector::startContainer(bool isObject)
+{
+	Visit v = hasPending ? pending : visit();
+	hasPending = false;
+
+	JSONNode *node = NULL;
+	if ((v == VisitInside) || (v == VisitMatch)) {
+		if (isObject) {
+			node = new (&arena) JSONObject(&arena);
+		} else {
+			node = new (&arena) JSONArray(&arena);
+		}
+		if (v == VisitInside) {
+			value(node);
+		} else {
+			match = node;
+		}
+	}
+
+	/*
+	 *	An object on the path resolves its repeated keys
+	 */
+
+	bool keyed = (v == VisitPath) && isObject && (duplicates != JSONDuplicateKeepAll);
+	if (keyed) startLevel();
+
+	Frame f = { isObject, v != VisitSkip, 0, node, keyed };
+	stack.push_back(f);
+	if (v == VisitMatch) matchDepth = stack.size();
+}
+
+void JSONSelector::endContainer()
+{
+	if (matchDepth == stack.size()) {
+		matchDepth = 0;
+		write(match);
+		match = NULL;
+	}
+	if (stack.back().keyed) endLevel();
+	stack.pop_back();
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Interface																*/
+/*																			*/
+/****************************************************************************/
+
+void JSONSelector::null()
+{
+	Visit v = visit();
+	if ((v == VisitMatch) || (v == VisitInside)) value(new (&arena) JSONNull);
+}
+
+void JSONSelector::boolean(bool val)
+{
+	Visit v = visit();
+	if ((v == VisitMatch) || (v == VisitInside)) value(new (&arena) JSONNumber(val));
+}
+
+void JSONSelector::integer(int64_t val)
+{
+	Visit v = visit();
+	if ((v == VisitMatch) || (v == VisitInside)) value(new (&arena) JSONNumber(val));
+}
+
+void JSONSelector::real(double val)
+{
+	Visit v = visit();
+	if ((v == VisitMatch) || (v == VisitInside)) value(new (&arena) JSONNumber(val));
+}
+
+void JSONSelector::string(std::string_view val)
+{
+	Visit v = visit();
+	if ((v == VisitMatch) || (v == VisitInside)) value(new (&arena) JSONString(val,&arena,!isBorrowed()));
+}
+
+void JSONSelector::startArray()
+{
+	startContainer(false);
+}
+
+void JSONSelector::endArray()
+{
+	endContainer();
+}
+
+void JSONSelector::startObject()
+{
+	startContainer(true);
+}
+
+void JSONSelector::endObject()
+{
+	endContainer();
+}
+
+void JSONSelector::objectKey(std::string_view val)
+{
+	key.assign(val.data(),val.size());
+}
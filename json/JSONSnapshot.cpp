@@ -0,0 +1,564 @@
+//
+//  JSONSnapshot.cpp
+//  prettyjson
+//
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <unordered_map>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Internal Structures														*/
+/*																			*/
+/****************************************************************************/
+
+#define SNAPSHOT_MAGIC		"PJSNAPSH"
+#define SNAPSHOT_VERSION	1
+#define SNAPSHOT_BYTEORDER	0x0102030405060708ULL
+
+/*
+ *	Objects with fewer members than this are not indexed; scanning them is
+ *	as quick as searching them.
+ */
+
+#define SNAPSHOT_INDEXMIN	16
+
+/*	JSONSnapshot::Header
+ *
+ *		The start of the file. Each section starts on an 8 byte boundary.
+ */
+
+struct JSONSnapshot::Header
+{
+	char				magic[8];
+	uint64_t			byteOrder;
+	uint32_t			version;
+	uint32_t			flags;			/* reserved, 0 */
+	
+	uint64_t			tapeOffset;
+	uint64_t			tapeCount;		/* entries */
+	uint64_t			stringsOffset;
+	uint64_t			stringsLength;	/* bytes */
+	uint64_t			objectsOffset;
+	uint64_t			objectCount;
+	uint64_t			keysOffset;
+	uint64_t			keyCount;
+};
+
+/*	JSONSnapshot::Object, JSONSnapshot::Key
+ *
+ *		The key index. Each indexed object has a run of keys sorted by the
+ *	key string, with only the last of any duplicate key kept, as with
+ *	JSONObject. Objects are sorted by the tape index of their start.
+ */
+
+struct JSONSnapshot::Object
+{
+	uint64_t			tape;			/* index of the start entry */
+	uint64_t			first;			/* of the object's keys */
+	uint64_t			count;
+};
+
+struct JSONSnapshot::Key
+{
+	uint64_t			string;			/* offset in the string pool */
+	uint64_t			value;			/* tape index of the value */
+};
+
+/*	JSONSnapshot::Builder
+ *
+ *		Builds the tape, string pool and key index from a DOM
+ */
+
+struct JSONSnapshot::Builder
+{
+	struct Frame {
+		JSONNode		*node;
+		bool			isObject;
+		bool			indexed;
+		size_t			index;			/* of the next member */
+		size_t			start;			/* tape index of the start entry */
+		std::vector<Key> members;		/* for the key index */
+	};
+	
+	JSONTape			tape;
+	std::unordered_map<std::string_view, uint64_t> pool;	/* keys stored so far */
+	bool				keyIndex;
+	std::vector<Object>	objects;
+	std::vector<Key>	keys;
+	
+	void				add(JSONNode *node);
+	uint64_t			string(std::string_view str);
+	uint64_t			key(std::string_view str);
+	void				index(size_t start, std::vector<Key> &members);
+	std::string_view	keyAt(const Key &k);
+};
+
+/*	StringAt
+ *
+ *		The string at the offset in a string pool
+ */
+
+static std::string_view StringAt(const uint8_t *strings, uint64_t offset)
+{
+	uint32_t len;
+	memcpy(&len,strings + offset,sizeof(len));
+	return std::string_view((const char *)strings + offset + sizeof(len),len);
+}
+
+/*	Inside
+ *
+ *		True if count items of the given size at offset fit in the file, and
+ *	the offset is aligned.
+ */
+
+static bool Inside(uint64_t offset, uint64_t count, size_t size, size_t length)
+{
+	if ((offset & 7) || (offset > length)) return false;
+	return count <= (length - offset) / size;
+}
+
+/*	ValidString
+ *
+ *		True if the string at the offset, with its length, fits in the pool
+ */
+
+static bool ValidString(const uint8_t *strings, size_t length, uint64_t offset)
+{
+	uint32_t len;
+
+	if ((offset > length) || (length - offset < sizeof(len))) return false;
+	memcpy(&len,strings + offset,sizeof(len));
+	return len <= length - offset - sizeof(len);
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Builder																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONSnapshot::Builder::add
+ *
+ *		Append the node to the tape, in the same layout as JSONTapeParser.
+ *	The open containers are kept on a stack of our own rather than by
+ *	recursing, so a deep document does not overflow the thread's stack.
+ */
+
+void JSONSnapshot::Builder::add(JSONNode *node)
+{
+	std::vector<uint64_t> &t = tape.tape;
+	std::vector<Frame> stack;
+
+	for (;;) {
+		if (!stack.empty()) {
+			Frame &f = stack.back();
+
+			if (f.isObject) {
+				JSONObject *obj = static_cast<JSONObject *>(f.node);
+				if (f.index == obj->size()) {
+					t[f.start] |= t.size();
+					t.push_back(((uint64_t)JSONTapeEndObject << 56) | f.start);
+					if (f.indexed) index(f.start,f.members);
+					stack.pop_back();
+					if (stack.empty()) break;
+					continue;
+				}
+
+				JSONObject::Member &m = *(obj->begin() + f.index++);
+				uint64_t k = key(m.first);
+				t.push_back(((uint64_t)JSONTapeString << 56) | k);
+				if (f.indexed) {
+					Key e = { k, t.size() };
+					f.members.push_back(e);
+				}
+				node = m.second;
+			} else {
+				JSONArray *array = static_cast<JSONArray *>(f.node);
+				if (f.index == array->size()) {
+					t[f.start] |= t.size();
+					t.push_back(((uint64_t)JSONTapeEndArray << 56) | f.start);
+					stack.pop_back();
+					if (stack.empty()) break;
+					continue;
+				}
+				node = (*array)[f.index++];
+			}
+		}
+
+		JSONType type = node->type();
+
+		if ((type == JSONTypeObject) || (type == JSONTypeArray)) {
+			Frame f;
+			f.node = node;
+			f.isObject = (type == JSONTypeObject);
+			f.indexed = f.isObject && keyIndex && (static_cast<JSONObject *>(node)->size() >= SNAPSHOT_INDEXMIN);
+			f.index = 0;
+			f.start = t.size();
+			t.push_back((uint64_t)(f.isObject ? JSONTapeStartObject : JSONTapeStartArray) << 56);
+			stack.push_back(std::move(f));
+			continue;
+		}
+
+		if (type == JSONTypeString) {
+			t.push_back(((uint64_t)JSONTapeString << 56) | string(*static_cast<JSONString *>(node)));
+		} else if (type == JSONTypeNumber) {
+			JSONNumber *n = static_cast<JSONNumber *>(node);
+			if (n->isIntegerValue()) {
+				t.push_back((uint64_t)JSONTapeInteger << 56);
+				t.push_back((uint64_t)n->intValue());
+			} else {
+				double d = n->realValue();
+				uint64_t bits;
+				memcpy(&bits,&d,sizeof(bits));
+				t.push_back((uint64_t)JSONTapeReal << 56);
+				t.push_back(bits);
+			}
+		} else if (type == JSONTypeBoolean) {
+			JSONNumber *n = static_cast<JSONNumber *>(node);
+			t.push_back((uint64_t)(n->boolValue() ? JSONTapeTrue : JSONTapeFalse) << 56);
+		} else {
+			t.push_back((uint64_t)JSONTapeNull << 56);
+		}
+
+		if (stack.empty()) break;
+	}
+}
+
+/*	JSONSnapshot::Builder::string
+ *
+ *		Append a string to the pool, and return its offset
+ */
+
+uint64_t JSONSnapshot::Builder::string(std::string_view str)
+{
+	std::vector<uint8_t> &s = tape.strings;
+	size_t offset = s.size();
+	uint32_t len = (uint32_t)str.size();
+
+	s.resize(offset + sizeof(len) + len + 1);
+	memcpy(s.data() + offset,&len,sizeof(len));
+	memcpy(s.data() + offset + sizeof(len),str.data(),len);
+	s[offset + sizeof(len) + len] = 0;
+
+	return offset;
+}
+
+/*	JSONSnapshot::Builder::key
+ *
+ *		Return the offset of the key in the pool, storing it the first time
+ *	it is seen. The DOM outlives the builder, so its keys can be used as
+ *	the map's keys.
+ */
+
+uint64_t JSONSnapshot::Builder::key(std::string_view str)
+{
+	auto iter = pool.find(str);
+	if (iter != pool.end()) return iter->second;
+
+	uint64_t offset = string(str);
+	pool.emplace(str,offset);
+	return offset;
+}
+
+/*	JSONSnapshot::Builder::index
+ *
+ *		Sort the members of an object by key, keep the last of each
+ *	duplicate, and add them to the key index.
+ */
+
+void JSONSnapshot::Builder::index(size_t start, std::vector<Key> &members)
+{
+	std::stable_sort(members.begin(),members.end(),[this](const Key &a, const Key &b) {
+		return keyAt(a) < keyAt(b);
+	});
+
+	Object obj = { start, keys.size(), 0 };
+	for (size_t i = 0; i < members.size(); ++i) {
+		if ((i + 1 < members.size()) && (members[i].string == members[i + 1].string)) continue;
+		keys.push_back(members[i]);
+	}
+	obj.count = keys.size() - obj.first;
+	objects.push_back(obj);
+}
+
+std::string_view JSONSnapshot::Builder::keyAt(const Key &k)
+{
+	return StringAt(tape.strings.data(),k.string);
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Snapshot																*/
+/*																			*/
+/****************************************************************************/
+
+JSONSnapshot::JSONSnapshot()
+{
+	map = NULL;
+	mapLength = 0;
+	tape = NULL;
+	tapeCount = 0;
+	strings = NULL;
+	stringsLength = 0;
+	objects = NULL;
+	objectCount = 0;
+	keys = NULL;
+	keyCount = 0;
+}
+
+JSONSnapshot::~JSONSnapshot()
+{
+	close();
+}
+
+/*	JSONSnapshot::write
+ *
+ *		Write the DOM as a snapshot, with a key index if asked. Returns false
+ *	if the file could not be written, in which case any existing file at
+ *	the path is left alone.
+ */
+
+bool JSONSnapshot::write(JSONNode *node, const char *path, bool keyIndex)
+{
+	static const char GZero[8] = { 0 };
+
+	Builder b;
+	b.keyIndex = keyIndex;
+	b.add(node);
+	std::sort(b.objects.begin(),b.objects.end(),[](const Object &x, const Object &y) {
+		return x.tape < y.tape;
+	});
+
+	Header h;
+	memset(&h,0,sizeof(h));
+	memcpy(h.magic,SNAPSHOT_MAGIC,sizeof(h.magic));
+	h.byteOrder = SNAPSHOT_BYTEORDER;
+	h.version = SNAPSHOT_VERSION;
+	h.tapeOffset = sizeof(Header);
+	h.tapeCount = b.tape.tape.size();
+	h.stringsOffset = h.tapeOffset + h.tapeCount * sizeof(uint64_t);
+	h.stringsLength = b.tape.strings.size();
+	h.objectsOffset = (h.stringsOffset + h.stringsLength + 7) & ~(uint64_t)7;
+	h.objectCount = b.objects.size();
+	h.keysOffset = h.objectsOffset + h.objectCount * sizeof(Object);
+	h.keyCount = b.keys.size();
+
+	std::string tmp = std::string(path) + "." + std::to_string(getpid()) + ".tmp";
+	bool ok;
+	{
+		JSONFileWriter out(tmp.c_str());
+		if (!out.isValid()) return false;
+
+		out.write((const char *)&h,sizeof(h));
+		out.write((const char *)b.tape.tape.data(),h.tapeCount * sizeof(uint64_t));
+		out.write((const char *)b.tape.strings.data(),h.stringsLength);
+		out.write(GZero,h.objectsOffset - (h.stringsOffset + h.stringsLength));
+		if (h.objectCount) {					/* there may be no key index */
+			out.write((const char *)b.objects.data(),h.objectCount * sizeof(Object));
+			out.write((const char *)b.keys.data(),h.keyCount * sizeof(Key));
+		}
+		out.flush();
+		ok = !out.failed();
+	}
+
+	if (ok) ok = (rename(tmp.c_str(),path) == 0);
+	if (!ok) unlink(tmp.c_str());
+	return ok;
+}
+
+/*	JSONSnapshot::open
+ *
+ *		Map a snapshot, and check it can be read without going outside the
+ *	file (see validate()). Returns false if this is not a snapshot we can
+ *	read.
+ */
+
+bool JSONSnapshot::open(int fd)
+{
+	struct stat st;
+
+	close();
+	if (fstat(fd,&st) || !S_ISREG(st.st_mode) || ((size_t)st.st_size < sizeof(Header))) return false;
+
+	mapLength = (size_t)st.st_size;
+	map = mmap(NULL,mapLength,PROT_READ,MAP_SHARED,fd,0);
+	if (map == MAP_FAILED) {
+		map = NULL;
+		return false;
+	}
+
+	const Header *h = (const Header *)map;
+	const uint8_t *base = (const uint8_t *)map;
+	if (memcmp(h->magic,SNAPSHOT_MAGIC,sizeof(h->magic)) ||
+			(h->byteOrder != SNAPSHOT_BYTEORDER) ||
+			(h->version != SNAPSHOT_VERSION) ||
+			(h->tapeCount == 0) ||
+			!Inside(h->tapeOffset,h->tapeCount,sizeof(uint64_t),mapLength) ||
+			!Inside(h->stringsOffset,h->stringsLength,1,mapLength) ||
+			!Inside(h->objectsOffset,h->objectCount,sizeof(Object),mapLength) ||
+			!Inside(h->keysOffset,h->keyCount,sizeof(Key),mapLength)) {
+		close();
+		return false;
+	}
+
+	tapeCount = h->tapeCount;
+	strings = base + h->stringsOffset;
+	stringsLength = h->stringsLength;
+	objects = (const Object *)(base + h->objectsOffset);
+	objectCount = h->objectCount;
+	keys = (const Key *)(base + h->keysOffset);
+	keyCount = h->keyCount;
+	tape = (const uint64_t *)(base + h->tapeOffset);
+
+	if (!validate()) {
+		close();
+		return false;
+	}
+	return true;
+}
+
+/*	JSONSnapshot::validate
+ *
+ *		Cursors trust the tape: they follow the jump in each container entry
+ *	and read strings at the offsets given. So the whole tape is checked once
+ *	when the file is opened. It must hold one value, every string must lie
+ *	in the pool, object keys must be strings, and each start entry must jump
+ *	to the end entry of the same kind which closes it and points back. Each
+ *	indexed object and key must refer to an object and a value on the tape,
+ *	with the keys in order. This reads the whole file, but is linear.
+ */
+
+bool JSONSnapshot::validate()
+{
+	struct Open {
+		size_t			start;
+		bool			isObject;
+		size_t			count;			/* keys and values so far */
+	};
+
+	std::vector<Open> stack;
+	std::vector<bool> isValue(tapeCount,false);
+	size_t i = 0;
+
+	do {
+		if (i >= tapeCount) return false;
+
+		JSONTapeTag tag = (JSONTapeTag)(tape[i] >> 56);
+		uint64_t payload = tape[i] & JSONTAPE_PAYLOAD;
+
+		if ((tag == JSONTapeEndObject) || (tag == JSONTapeEndArray)) {
+			if (stack.empty()) return false;
+
+			const Open &o = stack.back();
+			if ((o.isObject != (tag == JSONTapeEndObject)) || (o.isObject && (o.count & 1))) return false;
+			if ((payload != o.start) || ((tape[o.start] & JSONTAPE_PAYLOAD) != i)) return false;
+			stack.pop_back();
+			++i;
+			continue;
+		}
+
+		bool isKey = !stack.empty() && stack.back().isObject && !(stack.back().count & 1);
+		if (isKey && (tag != JSONTapeString)) return false;
+		if (!isKey) isValue[i] = true;
+		if (!stack.empty()) ++stack.back().count;
+
+		if ((tag == JSONTapeStartObject) || (tag == JSONTapeStartArray)) {
+			if ((payload <= i) || (payload >= tapeCount)) return false;
+			Open o = { i, tag == JSONTapeStartObject, 0 };
+			stack.push_back(o);
+			++i;
+		} else if (tag == JSONTapeString) {
+			if (!ValidString(strings,stringsLength,payload)) return false;
+			++i;
+		} else if ((tag == JSONTapeInteger) || (tag == JSONTapeReal)) {
+			i += 2;						/* and the value */
+		} else if ((tag == JSONTapeNull) || (tag == JSONTapeTrue) || (tag == JSONTapeFalse)) {
+			++i;
+		} else {
+			return false;
+		}
+	} while (!stack.empty());
+
+	if (i != tapeCount) return false;
+
+	/*
+	 *	The key index
+	 */
+
+	for (size_t n = 0; n < objectCount; ++n) {
+		const Object &o = objects[n];
+
+		if ((o.tape >= tapeCount) || !isValue[o.tape] || ((tape[o.tape] >> 56) != JSONTapeStartObject)) return false;
+		if (n && (o.tape <= objects[n - 1].tape)) return false;
+		if ((o.first > keyCount) || (o.count > keyCount - o.first)) return false;
+
+		uint64_t end = tape[o.tape] & JSONTAPE_PAYLOAD;
+		for (uint64_t j = o.first; j < o.first + o.count; ++j) {
+			const Key &k = keys[j];
+			if (!ValidString(strings,stringsLength,k.string)) return false;
+			if ((k.value <= o.tape) || (k.value >= end) || !isValue[k.value]) return false;
+			if ((j > o.first) && !(keyAt(keys[j - 1]) < keyAt(k))) return false;
+		}
+	}
+	return true;
+}
+
+/*	JSONSnapshot::close
+ *
+ *		Unmap the snapshot. Cursors into it are no longer valid.
+ */
+
+void JSONSnapshot::close()
+{
+	if (map) munmap(map,mapLength);
+	map = NULL;
+	mapLength = 0;
+	tape = NULL;
+	tapeCount = 0;
+	strings = NULL;
+	stringsLength = 0;
+	objects = NULL;
+	objectCount = 0;
+	keys = NULL;
+	keyCount = 0;
+}
+
+/*	JSONSnapshot::find
+ *
+ *		Return the value for the object key, or an invalid cursor. Indexed
+ *	objects are searched; the rest are scanned. Either way the last of any
+ *	duplicate key wins.
+ */
+
+JSONTapeCursor JSONSnapshot::find(JSONTapeCursor object, std::string_view key)
+{
+	if ((objectCount > 0) && (object.tag() == JSONTapeStartObject)) {
+		size_t i = object.getIndex();
+		const Object *o = std::lower_bound(objects,objects + objectCount,i,[](const Object &x, size_t index) {
+			return x.tape < index;
+		});
+
+		if ((o != objects + objectCount) && (o->tape == i)) {
+			const Key *b = keys + o->first;
+			const Key *e = b + o->count;
+			const Key *k = std::lower_bound(b,e,key,[this](const Key &x, std::string_view str) {
+				return keyAt(x) < str;
+			});
+
+			if ((k != e) && (keyAt(*k) == key)) return JSONTapeCursor(tape,strings,k->value);
+			return JSONTapeCursor();
+		}
+	}
+	return object.find(key);
+}
+
+std::string_view JSONSnapshot::keyAt(const Key &k)
+{
+	return StringAt(strings,k.string);
+}
@@ -0,0 +1,247 @@
+//
+//  JSONStats.cpp
+//  prettyjson
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <chrono>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Names																	*/
+/*																			*/
+/****************************************************************************/
+
+static const char *GPhaseNames[JSONPhaseCount] = {
+	"other", "read", "parse", "format", "write", "free"
+};
+
+static const char *GTypeNames[JSONTypeNull + 1] = {
+	"objects", "arrays", "strings", "numbers", "booleans", "nulls"
+};
+
+/****************************************************************************/
+/*																			*/
+/*	Clocks																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	WallTime
+ *
+ *		Seconds on a monotonic clock
+ */
+
+static double WallTime()
+{
+	std::chrono::duration<double> t = std::chrono::steady_clock::now().time_since_epoch();
+	return t.count();
+}
+
+/*	CPUTime
+ *
+ *		CPU seconds used by the process, on all threads
+ */
+
+static double CPUTime()
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_PROCESS_CPUTIME_ID,&ts)) return 0;
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Statistics																*/
+/*																			*/
+/****************************************************************************/
+
+std::atomic<bool> JSONStats::countAllocations(false);
+std::atomic<uint64_t> JSONStats::allocations(0);
+std::atomic<uint64_t> JSONStats::allocated(0);
+std::atomic<uint64_t> JSONStats::releases(0);
+
+/*	JSONStats::JSONStats
+ *
+ *		Statistics. Time starts now, in the other phase.
+ */
+
+JSONStats::JSONStats()
+{
+	current = JSONPhaseOther;
+	clear();
+}
+
+/*	JSONStats::clear
+ *
+ *		Zero the counts and times
+ */
+
+void JSONStats::clear()
+{
+	bytesIn = bytesOut = tokens = 0;
+	memset(nodes,0,sizeof(nodes));
+	maxDepth = 0;
+	memset(wall,0,sizeof(wall));
+	memset(cpu,0,sizeof(cpu));
+
+	lastWall = WallTime();
+	lastCPU = CPUTime();
+}
+
+/*	JSONStats::charge
+ *
+ *		Charge the time since the last change of phase to the current phase
+ */
+
+void JSONStats::charge()
+{
+	double w = WallTime();
+	double c = CPUTime();
+
+	wall[current] += w - lastWall;
+	cpu[current] += c - lastCPU;
+	lastWall = w;
+	lastCPU = c;
+}
+
+/*	JSONStats::enter
+ *
+ *		Start a phase, which runs until the matching leave()
+ */
+
+void JSONStats::enter(JSONPhase phase)
+{
+	charge();
+	phases.push_back(current);
+	current = phase;
+}
+
+void JSONStats::leave()
+{
+	charge();
+	current = phases.back();
+	phases.pop_back();
+}
+
+/*	JSONStats::merge
+ *
+ *		Add the counts from a worker
+ */
+
+void JSONStats::merge(const JSONStats &s)
+{
+	bytesIn += s.bytesIn;
+	bytesOut += s.bytesOut;
+	tokens += s.tokens;
+	for (int i = 0; i <= JSONTypeNull; ++i) nodes[i] += s.nodes[i];
+	depth(s.maxDepth);
+}
+
+/*	JSONStats::peakRSS
+ *
+ *		Peak resident set size of the process in bytes
+ */
+
+uint64_t JSONStats::peakRSS()
+{
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF,&ru)) return 0;
+#ifdef __APPLE__
+	return (uint64_t)ru.ru_maxrss;
+#else
+	return (uint64_t)ru.ru_maxrss * 1024;
+#endif
+}
+
+/*	JSONStats::report
+ *
+ *		Write the statistics, either as comments in the style of our other
+ *	diagnostics or as a JSON object. Diagnostics are counted by code if
+ *	errors is given.
+ */
+
+void JSONStats::report(JSONWriter *out, const JSONDiagnostics *errors, bool asJSON)
+{
+	double totalWall = 0;
+	double totalCPU = 0;
+
+	charge();
+	for (int i = 0; i < JSONPhaseCount; ++i) {
+		totalWall += wall[i];
+		totalCPU += cpu[i];
+	}
+
+	uint64_t nodeCount = 0;
+	for (int i = 0; i <= JSONTypeNull; ++i) nodeCount += nodes[i];
+
+	double rate = (totalWall > 0) ? bytesIn / totalWall / 1e6 : 0;
+	uint64_t rss = peakRSS();
+	bool counting = countAllocations.load(std::memory_order_relaxed);
+
+	if (!asJSON) {
+		out->print("# stats: %10s %10s\n","wall ms","cpu ms");
+		for (int i = 0; i < JSONPhaseCount; ++i) {
+			out->print("#   %-8s %10.3f %10.3f\n",GPhaseNames[i],wall[i] * 1e3,cpu[i] * 1e3);
+		}
+		out->print("#   %-8s %10.3f %10.3f\n","total",totalWall * 1e3,totalCPU * 1e3);
+		out->print("# input: %llu bytes, %llu tokens, %.1f MB/s\n",(unsigned long long)bytesIn,(unsigned long long)tokens,rate);
+		out->print("# output: %llu bytes\n",(unsigned long long)bytesOut);
+		out->print("# nodes: %llu",(unsigned long long)nodeCount);
+		for (int i = 0; i <= JSONTypeNull; ++i) {
+			out->print("%s %llu %s",i ? "," : " (",(unsigned long long)nodes[i],GTypeNames[i]);
+		}
+		out->print("), max depth %zu\n",maxDepth);
+		if (counting) {
+			out->print("# allocations: %llu (%llu bytes), %llu freed\n",
+					(unsigned long long)allocations.load(),(unsigned long long)allocated.load(),(unsigned long long)releases.load());
+		}
+		if (errors) {
+			for (int i = 0; i < JSONErrorCodeCount; ++i) {
+				JSONErrorCode code = (JSONErrorCode)i;
+				size_t n = errors->getCount(code);
+				if (n) out->print("# %s: %zu %s\n",(code < JSONErrorUnexpectedEOF) ? "warnings" : "errors",n,JSONError::summary(code));
+			}
+		}
+		out->print("# peak RSS: %llu KB\n",(unsigned long long)(rss / 1024));
+		return;
+	}
+
+	out->write("{\n\t\"phases\": {");
+	for (int i = 0; i < JSONPhaseCount; ++i) {
+		out->print("%s\n\t\t\"%s\": { \"wall_ms\": %.3f, \"cpu_ms\": %.3f }",i ? "," : "",GPhaseNames[i],wall[i] * 1e3,cpu[i] * 1e3);
+	}
+	out->print("\n\t},\n\t\"wall_ms\": %.3f,\n\t\"cpu_ms\": %.3f,\n",totalWall * 1e3,totalCPU * 1e3);
+	out->print("\t\"bytes_in\": %llu,\n\t\"bytes_out\": %llu,\n\t\"tokens\": %llu,\n\t\"mb_per_s\": %.1f,\n",
+			(unsigned long long)bytesIn,(unsigned long long)bytesOut,(unsigned long long)tokens,rate);
+	out->write("\t\"nodes\": {");
+	for (int i = 0; i <= JSONTypeNull; ++i) {
+		out->print("%s \"%s\": %llu",i ? "," : "",GTypeNames[i],(unsigned long long)nodes[i]);
+	}
+	out->print(" },\n\t\"max_depth\": %zu,\n",maxDepth);
+	if (counting) {
+		out->print("\t\"allocations\": { \"count\": %llu, \"bytes\": %llu, \"freed\": %llu },\n",
+				(unsigned long long)allocations.load(),(unsigned long long)allocated.load(),(unsigned long long)releases.load());
+	}
+	if (errors) {
+		bool first = true;
+		out->write("\t\"diagnostics\": {");
+		for (int i = 0; i < JSONErrorCodeCount; ++i) {
+			JSONErrorCode code = (JSONErrorCode)i;
+			size_t n = errors->getCount(code);
+			if (n == 0) continue;
+
+			out->write(first ? "\n\t\t" : ",\n\t\t");
+			out->string(JSONError::summary(code));
+			out->print(": %zu",n);
+			first = false;
+		}
+		out->write(first ? "},\n" : "\n\t},\n");
+	}
+	out->print("\t\"peak_rss\": %llu\n}\n",(unsigned long long)rss);
+}
@@ -0,0 +1,346 @@
+//
+//  JSONTape.cpp
+//  prettyjson
+//
+
+#include <string.h>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Tape Cursor																*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONTapeCursor::type
+ *
+ *		Map the tape tag to a JSON type
+ */
+
+JSONType JSONTapeCursor::type()
+{
+	switch (tag()) {
+		case JSONTapeStartObject:
+			return JSONTypeObject;
+		case JSONTapeStartArray:
+			return JSONTypeArray;
+		case JSONTapeString:
+			return JSONTypeString;
+		case JSONTapeInteger:
+		case JSONTapeReal:
+			return JSONTypeNumber;
+		case JSONTapeTrue:
+		case JSONTapeFalse:
+			return JSONTypeBoolean;
+		default:
+			return JSONTypeNull;
+	}
+}
+
+/*	JSONTapeCursor::intValue, realValue, boolValue
+ *
+ *		Numeric values, converting as JSONNumber does
+ */
+
+int64_t JSONTapeCursor::intValue()
+{
+	JSONTapeTag t = tag();
+	if (t == JSONTapeInteger) return (int64_t)tape[index + 1];
+	if (t == JSONTapeReal) return (int64_t)realValue();
+	return (t == JSONTapeTrue) ? 1 : 0;
+}
+
+double JSONTapeCursor::realValue()
+{
+	JSONTapeTag t = tag();
+	if (t == JSONTapeReal) {
+		double d;
+		memcpy(&d,tape + index + 1,sizeof(d));
+		return d;
+	}
+	if (t == JSONTapeInteger) return (double)(int64_t)tape[index + 1];
+	return (t == JSONTapeTrue) ? 1 : 0;
+}
+
+bool JSONTapeCursor::boolValue()
+{
+	JSONTapeTag t = tag();
+	if (t == JSONTapeInteger) return tape[index + 1] != 0;
+	if (t == JSONTapeReal) return realValue() != 0;
+	return t == JSONTapeTrue;
+}
+
+/*	JSONTapeCursor::stringValue
+ *
+ *		The string, or an empty string if this is not a string
+ */
+
+std::string_view JSONTapeCursor::stringValue()
+{
+	if (tag() != JSONTapeString) return std::string_view();
+
+	const uint8_t *s = strings + (tape[index] & JSONTAPE_PAYLOAD);
+	uint32_t len;
+	memcpy(&len,s,sizeof(len));
+	return std::string_view((const char *)s + sizeof(len),len);
+}
+
+/*	JSONTapeCursor::next
+ *
+ *		Step past this value. Containers are skipped in a single step using
+ *	the index of their end.
+ */
+
+JSONTapeCursor JSONTapeCursor::next()
+{
+	switch (tag()) {
+		case JSONTapeInteger:
+		case JSONTapeReal:
+			return JSONTapeCursor(tape,strings,index + 2);
+		case JSONTapeStartObject:
+		case JSONTapeStartArray:
+			return JSONTapeCursor(tape,strings,(tape[index] & JSONTAPE_PAYLOAD) + 1);
+		default:
+			return JSONTapeCursor(tape,strings,index + 1);
+	}
+}
+
+/*	JSONTapeCursor::size
+ *
+ *		Number of elements in an array, or members in an object
+ */
+
+size_t JSONTapeCursor::size()
+{
+	JSONTapeTag t = tag();
+	if ((t != JSONTapeStartObject) && (t != JSONTapeStartArray)) return 0;
+
+	size_t ct = 0;
+	for (JSONTapeCursor c = first(); !c.isEnd(); c = c.next()) ++ct;
+	return (t == JSONTapeStartObject) ? ct / 2 : ct;
+}
+
+/*	JSONTapeCursor::operator []
+ *
+ *		Return the indexed array element, or an invalid cursor
+ */
+
+JSONTapeCursor JSONTapeCursor::operator [] (size_t i)
+{
+	if (tag() != JSONTapeStartArray) return JSONTapeCursor();
+
+	for (JSONTapeCursor c = first(); !c.isEnd(); c = c.next()) {
+		if (i-- == 0) return c;
+	}
+	return JSONTapeCursor();
+}
+
+/*	JSONTapeCursor::find
+ *
+ *		Return the value for the object key, or an invalid cursor. If the key
+ *	appears more than once, the last value wins, as with JSONObject.
+ */
+
+JSONTapeCursor JSONTapeCursor::find(std::string_view key)
+{
+	JSONTapeCursor ret;
+
+	if (tag() != JSONTapeStartObject) return ret;
+
+	for (JSONTapeCursor c = first(); !c.isEnd(); c = c.next()) {
+		JSONTapeCursor value = c.next();
+		if (c.stringValue() == key) ret = value;
+		c = value;
+	}
+	return ret;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Tape																	*/
+/*																			*/
+/****************************************************************************/
+
+JSONTape::JSONTape()
+{
+}
+
+JSONTape::~JSONTape()
+{
+}
+
+/*	JSONTape::clear
+ *
+ *		Empty the tape, keeping the storage for reuse
+ */
+
+void JSONTape::clear()
+{
+	tape.clear();
+	strings.clear();
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Tape Parser																*/
+/*																			*/
+/****************************************************************************/
+
+JSONTapeParser::JSONTapeParser()
+{
+	tape = NULL;
+}
+
+JSONTapeParser::~JSONTapeParser()
+{
+}
+
+/*	JSONTapeParser::parse
+ *
+ *		Parse into the tape. Returns false if the document could not be
+ *	parsed; the tape is cleared first.
+ */
+
+bool JSONTapeParser::parse(JSONLexer *lexer, JSONTape *t)
+{
+	tape = t;
+	tape->clear();
+	stack.clear();
+
+	bool ok = BasicJSONParser::parse(lexer,true);
+
+	tape = NULL;
+	return ok;
+}
+
+/*	JSONTapeParser::addValue
+ *
+ *		Note a value is about to be appended, matching any pending key
+ */
+
+void JSONTapeParser::addValue()
+{
+	if (!stack.empty()) stack.back().key = 0;
+}
+
+/*	JSONTapeParser::appendString
+ *
+ *		Append a string to the string buffer and the tape
+ */
+
+void JSONTapeParser::appendString(JSONTapeTag tag, std::string_view value)
+{
+	std::vector<uint8_t> &s = tape->strings;
+	size_t offset = s.size();
+	uint32_t len = (uint32_t)value.size();
+
+	s.resize(offset + sizeof(len) + len + 1);
+	memcpy(s.data() + offset,&len,sizeof(len));
+	memcpy(s.data() + offset + sizeof(len),value.data(),len);
+	s[offset + sizeof(len) + len] = 0;
+
+	tape->tape.push_back(((uint64_t)tag << 56) | offset);
+}
+
+/*	JSONTapeParser::dropKey
+ *
+ *		Remove a key with no value. It is the last entry on the tape and the
+ *	last string, so both are cut back to where it starts.
+ */
+
+void JSONTapeParser::dropKey(Frame &f)
+{
+	tape->strings.resize(tape->tape[f.key] & JSONTAPE_PAYLOAD);
+	tape->tape.resize(f.key);
+	f.key = 0;
+}
+
+void JSONTapeParser::null()
+{
+	addValue();
+	tape->tape.push_back((uint64_t)JSONTapeNull << 56);
+}
+
+void JSONTapeParser::boolean(bool value)
+{
+	addValue();
+	tape->tape.push_back((uint64_t)(value ? JSONTapeTrue : JSONTapeFalse) << 56);
+}
+
+void JSONTapeParser::integer(int64_t value)
+{
+	addValue();
+	tape->tape.push_back((uint64_t)JSONTapeInteger << 56);
+	tape->tape.push_back((uint64_t)value);
+}
+
+void JSONTapeParser::real(double value)
+{
+	uint64_t bits;
+	memcpy(&bits,&value,sizeof(bits));
+
+	addValue();
+	tape->tape.push_back((uint64_t)JSONTapeReal << 56);
+	tape->tape.push_back(bits);
+}
+
+void JSONTapeParser::string(std::string_view value)
+{
+	addValue();
+	appendString(JSONTapeString,value);
+}
+
+void JSONTapeParser::startArray()
+{
+	addValue();
+
+	Frame f = { tape->tape.size(), 0 };
+	stack.push_back(f);
+	tape->tape.push_back((uint64_t)JSONTapeStartArray << 56);
+}
+
+void JSONTapeParser::endArray()
+{
+	size_t start = stack.back().start;
+	size_t end = tape->tape.size();
+	stack.pop_back();
+
+	tape->tape[start] |= end;
+	tape->tape.push_back(((uint64_t)JSONTapeEndArray << 56) | start);
+}
+
+void JSONTapeParser::startObject()
+{
+	addValue();
+
+	Frame f = { tape->tape.size(), 0 };
+	stack.push_back(f);
+	tape->tape.push_back((uint64_t)JSONTapeStartObject << 56);
+}
+
+void JSONTapeParser::endObject()
+{
+	/*
+	 *	A key with no value (because the value could not be parsed) is
+	 *	dropped, as the record parser does.
+	 */
+
+	Frame &f = stack.back();
+	if (f.key) dropKey(f);
+
+	size_t start = f.start;
+	size_t end = tape->tape.size();
+	stack.pop_back();
+
+	tape->tape[start] |= end;
+	tape->tape.push_back(((uint64_t)JSONTapeEndObject << 56) | start);
+}
+
+void JSONTapeParser::objectKey(std::string_view value)
+{
+	Frame &f = stack.back();
+	if (f.key) dropKey(f);
+
+	f.key = tape->tape.size();
+	appendString(JSONTapeString,value);
+}
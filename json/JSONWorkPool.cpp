@@ -0,0 +1,176 @@
+//
+//  JSONWorkPool.cpp
+//  prettyjson
+//
+
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Work Pool																*/
+/*																			*/
+/****************************************************************************/
+
+/*
+ *	Index of the worker running on this thread, or -1, and the pool it
+ *	belongs to. A task from one pool may use another, so the index is only
+ *	meaningful to its own pool.
+ */
+
+static thread_local int GWorker = -1;
+static thread_local JSONWorkPool *GPool = NULL;
+
+/*	JSONWorkPool::JSONWorkPool
+ *
+ *		Start the worker threads. If threads is 0, we start one worker per
+ *	hardware thread.
+ */
+
+JSONWorkPool::JSONWorkPool(int n)
+{
+	if (n <= 0) n = (int)std::thread::hardware_concurrency();
+	if (n <= 0) n = 1;
+
+	queued = 0;
+	pending = 0;
+	next = 0;
+	stop = false;
+
+	for (int i = 0; i < n; ++i) {
+		queues.push_back(new Queue);
+	}
+	for (int i = 0; i < n; ++i) {
+		threads.push_back(std::thread(&JSONWorkPool::run,this,i));
+	}
+}
+
+/*	JSONWorkPool::~JSONWorkPool
+ *
+ *		Finish outstanding work and shut down the workers
+ */
+
+JSONWorkPool::~JSONWorkPool()
+{
+	wait();
+
+	{
+		std::lock_guard<std::mutex> g(lock);
+		stop = true;
+	}
+	wake.notify_all();
+
+	for (size_t i = 0; i < threads.size(); ++i) {
+		threads[i].join();
+	}
+	for (size_t i = 0; i < queues.size(); ++i) {
+		delete queues[i];
+	}
+}
+
+/*	JSONWorkPool::worker
+ *
+ *		Return the index of the calling worker thread, or -1 if the caller
+ *	is not one of our workers. Used to find per-worker state.
+ */
+
+int JSONWorkPool::worker()
+{
+	return (GPool == this) ? GWorker : -1;
+}
+
+/*	JSONWorkPool::submit
+ *
+ *		Queue a task
+ */
+
+void JSONWorkPool::submit(std::function<void()> task)
+{
+	size_t index;
+
+	++pending;
+
+	{
+		std::lock_guard<std::mutex> g(lock);
+		index = (GPool == this) ? (size_t)GWorker : next++ % queues.size();
+	}
+
+	Queue *q = queues[index];
+	{
+		std::lock_guard<std::mutex> g(q->lock);
+		q->tasks.push_back(task);
+	}
+
+	{
+		std::lock_guard<std::mutex> g(lock);
+		++queued;
+	}
+	wake.notify_one();
+}
+
+/*	JSONWorkPool::wait
+ *
+ *		Wait until every submitted task has finished
+ */
+
+void JSONWorkPool::wait()
+{
+	std::unique_lock<std::mutex> lk(lock);
+	idle.wait(lk,[this] { return pending == 0; });
+}
+
+/*	JSONWorkPool::take
+ *
+ *		Take a task from the back of our own queue, or steal one from the
+ *	front of another worker's queue.
+ */
+
+bool JSONWorkPool::take(int index, std::function<void()> &task)
+{
+	size_t n = queues.size();
+
+	for (size_t i = 0; i < n; ++i) {
+		Queue *q = queues[(index + i) % n];
+		std::lock_guard<std::mutex> g(q->lock);
+		if (q->tasks.empty()) continue;
+
+		if (i == 0) {
+			task = std::move(q->tasks.back());
+			q->tasks.pop_back();
+		} else {
+			task = std::move(q->tasks.front());
+			q->tasks.pop_front();
+		}
+		--queued;
+		return true;
+	}
+	return false;
+}
+
+/*	JSONWorkPool::run
+ *
+ *		Worker thread
+ */
+
+void JSONWorkPool::run(int index)
+{
+	std::function<void()> task;
+
+	GWorker = index;
+	GPool = this;
+	for (;;) {
+		if (take(index,task)) {
+			task();
+			task = nullptr;
+
+			if (--pending == 0) {
+				std::lock_guard<std::mutex> g(lock);
+				idle.notify_all();
+			}
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lk(lock);
+		wake.wait(lk,[this] { return stop || (queued > 0); });
+		if (stop && (queued == 0)) break;
+	}
+}
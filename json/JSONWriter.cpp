@@ -0,0 +1,552 @@
+//
+//  JSONWriter.cpp
+//  prettyjson
+//
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <new>
+#include "JSON.h"
+
+/****************************************************************************/
+/*																			*/
+/*	Writer																	*/
+/*																			*/
+/****************************************************************************/
+
+/*	JSONWriter::JSONWriter
+ *
+ *		Allocate the output buffer
+ */
+
+JSONWriter::JSONWriter(size_t size)
+{
+	capacity = size;
+	buffer = (char *)malloc(capacity);
+	if (buffer == NULL) throw std::bad_alloc();
+	ptr = buffer;
+	limit = buffer + capacity;
+	error = false;
+	rawUTF8 = false;
+	stats = NULL;
+}
+
+JSONWriter::~JSONWriter()
+{
+	free(buffer);
+}
+
+/*	JSONWriter::flush
+ *
+ *		Hand the buffered output to the sink
+ */
+
+void JSONWriter::flush()
+{
+	if (ptr > buffer) drain(buffer,ptr - buffer);
+	ptr = buffer;
+}
+
+/*	JSONWriter::overflow
+ *
+ *		Called when the buffer cannot hold len more bytes. We drain the
+ *	buffer, and grow it if a single request is larger than the buffer.
+ */
+
+void JSONWriter::overflow(size_t len)
+{
+	flush();
+
+	if (len > capacity) {
+		char *b = (char *)realloc(buffer,len);
+		if (b == NULL) throw std::bad_alloc();
+		buffer = ptr = b;
+		capacity = len;
+		limit = buffer + capacity;
+	}
+}
+
+/*	JSONWriter::writeLarge
+ *
+ *		Write data that does not fit in the remaining buffer space
+ */
+
+void JSONWriter::writeLarge(const char *data, size_t len)
+{
+	while (len > 0) {
+		size_t avail = limit - ptr;
+		if (avail == 0) {
+			overflow(1);
+			avail = limit - ptr;
+		}
+		if (avail > len) avail = len;
+
+		memcpy(ptr,data,avail);
+		ptr += avail;
+		data += avail;
+		len -= avail;
+	}
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Formatting Primitives													*/
+/*																			*/
+/****************************************************************************/
+
+/*
+ *	Newline followed by a run of spaces; indentation is written as a slice
+ *	of this rather than two spaces at a time.
+ */
+
+#define INDENTRUN	256
+
+static struct IndentRun
+{
+	char			run[INDENTRUN + 1];
+
+	constexpr IndentRun() : run()
+		{
+			run[0] = '\n';
+			for (int i = 1; i <= INDENTRUN; ++i) run[i] = ' ';
+		}
+} const GIndent;
+
+/*	JSONWriter::indent
+ *
+ *		Write the indentation for the given depth. As in the original
+ *	formatter, each level is two spaces, and depth 0 is already indented.
+ */
+
+void JSONWriter::indent(int depth)
+{
+	size_t len = (depth < -1) ? 0 : (size_t)(depth + 1) * 2;
+
+	while (len > INDENTRUN) {
+		write(GIndent.run + 1,INDENTRUN);
+		len -= INDENTRUN;
+	}
+	write(GIndent.run + 1,len);
+}
+
+/*	JSONWriter::newline
+ *
+ *		Write a newline followed by the indentation for the given depth
+ */
+
+void JSONWriter::newline(int depth)
+{
+	size_t len = (depth < -1) ? 0 : (size_t)(depth + 1) * 2;
+
+	if (len <= INDENTRUN) {
+		write(GIndent.run,len + 1);
+	} else {
+		put('\n');
+		indent(depth);
+	}
+}
+
+/*
+ *	Printable ASCII, which is copied through without escaping
+ */
+
+static struct EscapeTable
+{
+	uint8_t			plain[256];
+
+	constexpr EscapeTable() : plain()
+		{
+			for (int i = 0; i < 256; ++i) {
+				plain[i] = (i >= 0x20) && (i < 0x80) && (i != '"') && (i != '\\');
+			}
+		}
+} const GEscape;
+
+/*	DecodeUTF8
+ *
+ *		Decode the UTF-8 sequence at p. Returns its length, or 0 if it is not
+ *	valid. Surrogates are accepted, since the lexer stores \uXXXX escapes of
+ *	them this way.
+ */
+
+static int DecodeUTF8(const uint8_t *p, const uint8_t *e, uint32_t *val)
+{
+	uint8_t c = *p;
+	uint8_t lo = 0x80;
+	uint8_t hi = 0xBF;
+	uint32_t v;
+	int len;
+
+	if (c < 0x80) {
+		*val = c;
+		return 1;
+	} else if ((c >= 0xC2) && (c <= 0xDF)) {
+		v = c & 0x1F;
+		len = 2;
+	} else if ((c >= 0xE0) && (c <= 0xEF)) {
+		v = c & 0x0F;
+		len = 3;
+		if (c == 0xE0) lo = 0xA0;
+	} else if ((c >= 0xF0) && (c <= 0xF4)) {
+		v = c & 0x07;
+		len = 4;
+		if (c == 0xF0) lo = 0x90;
+		if (c == 0xF4) hi = 0x8F;
+	} else {
+		return 0;
+	}
+
+	if ((e - p < len) || (p[1] < lo) || (p[1] > hi)) return 0;
+	for (int i = 1; i < len; ++i) {
+		if ((p[i] & 0xC0) != 0x80) return 0;
+		v = (v << 6) | (p[i] & 0x3F);
+	}
+
+	*val = v;
+	return len;
+}
+
+/*	PlainUTF8
+ *
+ *		Return the end of the run of valid UTF-8 outside of ASCII at p,
+ *	which can be written as it is. Surrogates end the run.
+ */
+
+static const uint8_t *PlainUTF8(const uint8_t *p, const uint8_t *e)
+{
+	uint32_t val;
+	int len;
+
+	while ((p < e) && (*p >= 0x80)) {
+		len = DecodeUTF8(p,e,&val);
+		if ((len == 0) || ((val >= 0xD800) && (val <= 0xDFFF))) break;
+		p += len;
+	}
+	return p;
+}
+
+/*	Escape
+ *
+ *		Write the escape for the character at p to w, and return the end of
+ *	the character. Characters outside of the Basic Multilingual Plane are
+ *	written as a surrogate pair, and bytes which are not valid UTF-8 as
+ *	U+FFFD. A high and low surrogate stored separately (see DecodeUTF8)
+ *	are combined into one character.
+ */
+
+static const uint8_t *Escape(const uint8_t *p, const uint8_t *e, bool raw, char *&w)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint32_t val;
+	int len;
+
+	switch (*p) {
+		case '"':	*w++ = '\\'; *w++ = '"';	return p + 1;
+		case '\\':	*w++ = '\\'; *w++ = '\\';	return p + 1;
+		case '\b':	*w++ = '\\'; *w++ = 'b';	return p + 1;
+		case '\f':	*w++ = '\\'; *w++ = 'f';	return p + 1;
+		case '\n':	*w++ = '\\'; *w++ = 'n';	return p + 1;
+		case '\r':	*w++ = '\\'; *w++ = 'r';	return p + 1;
+		case '\t':	*w++ = '\\'; *w++ = 't';	return p + 1;
+	}
+
+	len = DecodeUTF8(p,e,&val);
+	if (len == 0) {
+		val = 0xFFFD;
+		len = 1;
+	} else if ((val >= 0xD800) && (val <= 0xDBFF)) {
+		uint32_t lo;
+		if ((DecodeUTF8(p + 3,e,&lo) == 3) && (lo >= 0xDC00) && (lo <= 0xDFFF)) {
+			val = 0x10000 + ((val - 0xD800) << 10) + (lo - 0xDC00);
+			len = 6;
+		}
+	}
+
+	/*
+	 *	Other UTF-8 is copied by the caller when raw, so only a combined
+	 *	surrogate pair is written as UTF-8 here.
+	 */
+
+	if (raw && (val >= 0x10000) && (len == 6)) {
+		*w++ = (char)(0xF0 | (val >> 18));
+		*w++ = (char)(0x80 | (0x3F & (val >> 12)));
+		*w++ = (char)(0x80 | (0x3F & (val >> 6)));
+		*w++ = (char)(0x80 | (0x3F & val));
+		return p + len;
+	}
+
+	if (val >= 0x10000) {
+		uint32_t v = val - 0x10000;
+		uint32_t hs = 0xD800 | (v >> 10);
+		*w++ = '\\';
+		*w++ = 'u';
+		*w++ = hex[0x0F & (hs >> 12)];
+		*w++ = hex[0x0F & (hs >> 8)];
+		*w++ = hex[0x0F & (hs >> 4)];
+		*w++ = hex[0x0F & hs];
+		val = 0xDC00 | (v & 0x3FF);
+	}
+
+	*w++ = '\\';
+	*w++ = 'u';
+	*w++ = hex[0x0F & (val >> 12)];
+	*w++ = hex[0x0F & (val >> 8)];
+	*w++ = hex[0x0F & (val >> 4)];
+	*w++ = hex[0x0F & val];
+	return p + len;
+}
+
+/*	JSONWriter::string
+ *
+ *		Write the string in quotes, escaping it as needed. The scanner finds
+ *	runs of printable ASCII a vector at a time, and they are copied in bulk.
+ *	Other characters are written as \uXXXX escapes, unless raw UTF-8 is on,
+ *	in which case runs of valid UTF-8 are copied in bulk too.
+ */
+
+void JSONWriter::string(std::string_view str)
+{
+	const uint8_t *p = (const uint8_t *)str.data();
+	const uint8_t *e = p + str.size();
+
+	put('"');
+	while (p < e) {
+		/*
+		 *	Keys and short strings are scanned here; the vector scanner
+		 *	only pays for itself on longer runs.
+		 */
+
+		const uint8_t *run = p;
+		if (e - p >= 32) {
+			p += JSONScanner::plain(p,e - p);
+		} else {
+			while ((p < e) && GEscape.plain[*p]) ++p;
+		}
+		write((const char *)run,p - run);
+		if (p >= e) break;
+
+		if (rawUTF8 && (*p >= 0x80)) {
+			const uint8_t *q = PlainUTF8(p,e);
+			if (q > p) {
+				write((const char *)p,q - p);
+				p = q;
+				continue;
+			}
+		}
+
+		/*
+		 *	Escape the character, and any which follow it outside of
+		 *	ASCII, without going back to the scanner for each.
+		 */
+
+		do {
+			char *w = reserve(12);
+			p = Escape(p,e,rawUTF8,w);
+			commit(w);
+		} while ((p < e) && (*p >= 0x80) && !rawUTF8);
+	}
+	put('"');
+}
+
+/*	JSONWriter::integer
+ *
+ *		Write an integer value
+ */
+
+void JSONWriter::integer(int64_t value)
+{
+	commit(JSONWriteInteger(reserve(32),value));
+}
+
+/*	JSONWriter::real
+ *
+ *		Write a real value, using the shortest text that reads back as the
+ *	same value.
+ */
+
+void JSONWriter::real(double value)
+{
+	commit(JSONWriteReal(reserve(32),value));
+}
+
+/*	JSONWriter::print
+ *
+ *		printf-style formatted output
+ */
+
+void JSONWriter::print(const char *fmt, ...)
+{
+	va_list args;
+	size_t avail = limit - ptr;
+
+	va_start(args,fmt);
+	int len = vsnprintf(ptr,avail,fmt,args);
+	va_end(args);
+	if (len < 0) return;
+
+	if ((size_t)len >= avail) {
+		char *w = reserve(len + 1);
+		va_start(args,fmt);
+		vsnprintf(w,len + 1,fmt,args);
+		va_end(args);
+	}
+	ptr += len;
+}
+
+/****************************************************************************/
+/*																			*/
+/*	File Descriptor Writer													*/
+/*																			*/
+/****************************************************************************/
+
+JSONFdWriter::JSONFdWriter(int f, size_t size) : JSONWriter(size)
+{
+	fd = f;
+}
+
+JSONFdWriter::~JSONFdWriter()
+{
+	flush();
+}
+
+/*	JSONFdWriter::drain
+ *
+ *		Write the data to the file descriptor
+ */
+
+void JSONFdWriter::drain(const char *data, size_t len)
+{
+	JSONStatsPhase phase(stats,JSONPhaseWrite);
+	if (stats) stats->output(len);
+
+	while ((len > 0) && !error) {
+		ssize_t n = ::write(fd,data,len);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			error = true;
+		} else {
+			data += n;
+			len -= n;
+		}
+	}
+}
+
+/*	JSONFdWriter::writeLarge
+ *
+ *		Large writes are sent along with the buffered data using writev,
+ *	without being copied into the buffer.
+ */
+
+void JSONFdWriter::writeLarge(const char *data, size_t len)
+{
+	if (len < capacity / 2) {
+		JSONWriter::writeLarge(data,len);
+		return;
+	}
+
+	JSONStatsPhase phase(stats,JSONPhaseWrite);
+	if (stats) stats->output((ptr - buffer) + len);
+
+	struct iovec iov[2];
+	iov[0].iov_base = buffer;
+	iov[0].iov_len = ptr - buffer;
+	iov[1].iov_base = (void *)data;
+	iov[1].iov_len = len;
+	ptr = buffer;
+
+	int start = 0;
+	while ((start < 2) && !error) {
+		ssize_t n = ::writev(fd,iov + start,2 - start);
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			error = true;
+			break;
+		}
+
+		size_t left = (size_t)n;
+		while ((start < 2) && (left >= iov[start].iov_len)) {
+			left -= iov[start].iov_len;
+			++start;
+		}
+		if (start < 2) {
+			iov[start].iov_base = (char *)iov[start].iov_base + left;
+			iov[start].iov_len -= left;
+		}
+	}
+}
+
+/****************************************************************************/
+/*																			*/
+/*	File Writer																*/
+/*																			*/
+/****************************************************************************/
+
+JSONFileWriter::JSONFileWriter(const char *path, size_t size) : JSONFdWriter(-1,size)
+{
+	fd = open(path,O_WRONLY | O_CREAT | O_TRUNC,0644);
+	if (fd < 0) error = true;
+}
+
+JSONFileWriter::~JSONFileWriter()
+{
+	flush();
+	if (fd >= 0) close(fd);
+}
+
+/****************************************************************************/
+/*																			*/
+/*	Memory Writer															*/
+/*																			*/
+/****************************************************************************/
+
+JSONMemoryWriter::JSONMemoryWriter(size_t size) : JSONWriter(size)
+{
+}
+
+JSONMemoryWriter::~JSONMemoryWriter()
+{
+}
+
+/*	JSONMemoryWriter::flush
+ *
+ *		Nothing to do; the output stays in the buffer
+ */
+
+void JSONMemoryWriter::flush()
+{
+}
+
+/*	JSONMemoryWriter::overflow
+ *
+ *		Grow the buffer so it can hold at least len more bytes
+ */
+
+void JSONMemoryWriter::overflow(size_t len)
+{
+	size_t used = ptr - buffer;
+	size_t size = capacity * 2;
+	if (size < used + len) size = used + len;
+
+	char *b = (char *)realloc(buffer,size);
+	if (b == NULL) throw std::bad_alloc();
+
+	buffer = b;
+	ptr = b + used;
+	capacity = size;
+	limit = buffer + capacity;
+}
+
+void JSONMemoryWriter::writeLarge(const char *data, size_t len)
+{
+	overflow(len);
+	memcpy(ptr,data,len);
+	ptr += len;
+}
+
+void JSONMemoryWriter::drain(const char *, size_t)
+{
+}
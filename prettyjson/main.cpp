@@ -6,147 +6,230 @@
 //
 
 #include <iostream>
+#include <memory>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "JSON.h"
 
+/****************************************************************************/
+/*																			*/
+/*	Allocation Counting														*/
+/*																			*/
+/****************************************************************************/
+
+/*	operator new
+ *
+ *		Heap allocations are counted for --stats. Until counting is turned
+ *	on this costs a test per allocation. Every form of new and delete is
+ *	replaced, so that each allocation is released by the matching form.
+ */
+
+static void *Allocate(size_t size, size_t align)
+{
+	void *p;
+	
+	JSONStats::allocation(size);
+	if (align <= alignof(max_align_t)) {
+		p = malloc(size ? size : 1);
+	} else if (posix_memalign(&p,align,size ? size : 1)) {
+		p = NULL;
+	}
+	return p;
+}
+
+static void Release(void *p)
+{
+	if (p) JSONStats::release();
+	free(p);
+}
+
+void *operator new(size_t size)
+{
+	void *p = Allocate(size,0);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	void *p = Allocate(size,0);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t size, std::align_val_t align)
+{
+	void *p = Allocate(size,(size_t)align);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size, std::align_val_t align)
+{
+	void *p = Allocate(size,(size_t)align);
+	if (p == NULL) throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept
+{
+	return Allocate(size,0);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept
+{
+	return Allocate(size,0);
+}
+
+void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+	return Allocate(size,(size_t)align);
+}
+
+void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept
+{
+	return Allocate(size,(size_t)align);
+}
+
+void operator delete(void *p) noexcept						{ Release(p); }
+void operator delete[](void *p) noexcept					{ Release(p); }
+void operator delete(void *p, size_t) noexcept				{ Release(p); }
+void operator delete[](void *p, size_t) noexcept			{ Release(p); }
+void operator delete(void *p, std::align_val_t) noexcept	{ Release(p); }
+void operator delete[](void *p, std::align_val_t) noexcept	{ Release(p); }
+void operator delete(void *p, size_t, std::align_val_t) noexcept	{ Release(p); }
+void operator delete[](void *p, size_t, std::align_val_t) noexcept	{ Release(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept		{ Release(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept	{ Release(p); }
+void operator delete(void *p, std::align_val_t, const std::nothrow_t &) noexcept	{ Release(p); }
+void operator delete[](void *p, std::align_val_t, const std::nothrow_t &) noexcept	{ Release(p); }
+
 /****************************************************************************/
 /*																			*/
 /*	Print Contents															*/
 /*																			*/
 /****************************************************************************/
 
-/*	JSONEscapeString
+/*	PrintDropped
  *
- *		Determine if the string needs to be escaped to put into a JSON string
+ *		Print how many of each kind of error were counted but not kept
  */
 
-static std::string JSONEscapeString(const std::string &str)
-{
-	const uint8_t *s = (const uint8_t *)str.c_str();
-	const uint8_t *ptr;
-	std::string ret;
-	
-	ptr = s;
-	while (*ptr) {
-		if (*ptr == '"') {
-			ret.append("\\\"");
-		} else if (*ptr == '\\') {
-			ret.append("\\\\");
-		} else if (*ptr == '\b') {
-			ret.append("\\b");
-		} else if (*ptr == '\f') {
-			ret.append("\\f");
-		} else if (*ptr == '\n') {
-			ret.append("\\n");
-		} else if (*ptr == '\r') {
-			ret.append("\\r");
-		} else if (*ptr == '\t') {
-			ret.append("\\t");
-		} else if (*ptr >= 0x80) {
-			uint16_t val;
-			
-			if (*ptr <= 0xE0) {
-				val = 0x1F & *ptr;
-				val = (val << 6) | (0x3F & *++ptr);
-			} else {
-				val = 0x0F & *ptr;
-				val = (val << 6) | (0x3F & *++ptr);
-				val = (val << 6) | (0x3F & *++ptr);
-			}
-			
-			char buffer[32];
-			sprintf(buffer,"\\u%04X",val);
-			ret.append(buffer);
-		} else {
-			ret.push_back(*ptr);
+static void PrintDropped(JSONDiagnostics &errors, JSONWriter &out)
+{
+	for (int i = 0; i < JSONErrorCodeCount; ++i) {
+		JSONErrorCode code = (JSONErrorCode)i;
+		size_t n = errors.getDropped(code);
+		if (n) {
+			out.print("# %zu more: %s\n",n,JSONError::summary(code));
 		}
-		
-		ptr++;
 	}
-	
-	return ret;
 }
 
-static void JSONPrintString(const std::string &str)
+/*	PrintErrors
+ *
+ *		Print the errors found by the parser as comments
+ */
+
+static void PrintErrors(JSONDiagnostics &errors, JSONWriter &out)
 {
-	std::string f = JSONEscapeString(str);
-	printf("\"%s\"",f.c_str());
+	char msg[512];
+	
+	JSONDiagnostics::iterator iter;
+	for (iter = errors.begin(); iter != errors.end(); ++iter) {
+		iter->render(msg,sizeof(msg));
+		out.print("# line %ld: %s %s\n",iter->getLine(),iter->isWarning() ? "W" : "E",msg);
+	}
+	PrintDropped(errors,out);
 }
 
-static void JSONIndent(int depth)
+/*	PrintStats
+ *
+ *		Print the statistics for the run to stderr, if they were asked for
+ */
+
+static void PrintStats(JSONStats *stats, const JSONDiagnostics &errors, bool asJSON)
 {
-	for (int i = 0; i <= depth; ++i) printf("  ");
+	if (stats == NULL) return;
+	
+	JSONFdWriter err(2);
+	stats->report(&err,&errors,asJSON);
 }
 
-static void JSONFormat(JSONNode *node, int depth = 0, bool sameLine = false)
+/*	PushInput
+ *
+ *		Read the input in small blocks and push them to the parser, as a
+ *	server would as a request body arrives.
+ */
+
+template <class Parser> static void PushInput(Parser &parser, int fd, size_t size)
 {
-	if (node->type() == JSONTypeObject) {
-		JSONObject *obj = dynamic_cast<JSONObject *>(node);
-		printf("{ ");
-		bool first = true;
-		std::map<std::string, JSONNode *>::iterator iter;
-		for (iter = obj->begin(); iter != obj->end(); iter++) {
-			if (first) {
-				first = false;
-				if (sameLine) {
-					printf("\n");
-					JSONIndent(depth);
-				}
-			} else {
-				printf(", \n");
-				JSONIndent(depth);
-			}
-			
-			JSONPrintString(iter->first);
-			printf(": ");
-			JSONFormat(iter->second, depth+1, true);
-		}
-		printf("\n");
-		JSONIndent(depth-1);
-		printf("}");
-		
-	} else if (node->type() == JSONTypeArray) {
-		JSONArray *array = dynamic_cast<JSONArray *>(node);
-		printf("[ ");
-		bool first = true;
-		std::vector<JSONNode *>::iterator iter;
-		for (iter = array->begin(); iter != array->end(); iter++) {
-			if (first) {
-				first = false;
-				if (sameLine) {
-					printf("\n");
-					JSONIndent(depth);
-				}
-			} else {
-				printf(", \n");
-				JSONIndent(depth);
-			}
-			
-			JSONFormat(*iter, depth+1, true);
-		}
-		printf("\n");
-		JSONIndent(depth-1);
-		printf("]");
-	
-	} else if (node->type() == JSONTypeString) {
-		JSONString *s = dynamic_cast<JSONString *>(node);
-		JSONPrintString(*s);
-	} else if (node->type() == JSONTypeNumber) {
-		char buffer[64];
-		JSONNumber *n = dynamic_cast<JSONNumber *>(node);
-		if (n->isIntegerValue()) {
-			sprintf(buffer,"%lld",n->intValue());
-		} else {
-			sprintf(buffer,"%f",n->realValue());
-		}
-		printf("%s",buffer);
-	} else if (node->type() == JSONTypeBoolean) {
-		JSONNumber *n = dynamic_cast<JSONNumber *>(node);
-		printf(n->boolValue() ? "true" : "false");
-	} else {
-		printf("null");
+	std::vector<char> buffer(size);
+	ssize_t len;
+	
+	while ((len = read(fd,buffer.data(),size)) > 0) {
+		if (!parser.feed(buffer.data(),len)) break;
 	}
 }
 
+/*	OpenInput, OpenOutput
+ *
+ *		With --pipeline the input is read on a reader thread and the output
+ *	written on a writer thread, so waiting for storage overlaps with parsing
+ *	and formatting.
+ */
+
+static JSONInput *OpenInput(int fd, bool pipeline)
+{
+	if (pipeline) return new JSONPipelineInput(fd);
+	return JSONOpenInput(fd);
+}
+
+static JSONWriter *OpenOutput(int fd, bool pipeline)
+{
+	if (pipeline) return new JSONPipelineWriter(fd);
+	return new JSONFdWriter(fd);
+}
+
+/*	Usage
+ *
+ *		Print the options and exit; to stderr with a failure status when the
+ *	command line could not be understood.
+ */
+
+static void Usage(FILE *to, int status)
+{
+	fprintf(to,
+		"usage: prettyjson [options] [file]\n"
+		"       prettyjson --batch [options] [path ...]\n"
+		"\n"
+		"  --stream, --tape, --arena,    choose how the input is parsed\n"
+		"  --huge-pages, --parallel\n"
+		"  --ndjson                      one document per line\n"
+		"  --pipeline                    read and write on separate threads\n"
+		"  --push N                      feed the parser N bytes at a time\n"
+		"  --minify                      write without whitespace\n"
+		"  --utf8                        write non-ASCII text unescaped\n"
+		"  --duplicates first|last|all   how repeated keys are resolved\n"
+		"  --select PATH                 write only the value at a JSON pointer\n"
+		"  --lazy                        find it by reading only the containers\n"
+		"                                on the path\n"
+		"  --snapshot                    the input is a saved snapshot\n"
+		"  --save-snapshot FILE          save the document as a snapshot\n"
+		"  --key-index                   add a key index to the snapshot\n"
+		"  --batch                       check or format many files\n"
+		"  --in-place, --out-dir DIR     where --batch writes its output\n"
+		"  --threads N, -j N             threads for --batch and --parallel\n"
+		"  --max-depth N, --max-string N, --max-tokens N, --max-bytes N\n"
+		"                                limits on the input, 0 for none\n"
+		"  --max-diagnostics N           stop after N diagnostics\n"
+		"  --stats, --stats-json         report timings on stderr\n"
+		"  --help                        print this message\n");
+	exit(status);
+}
+
 /****************************************************************************/
 /*																			*/
 /*	Run parser																*/
@@ -155,30 +238,564 @@ static void JSONFormat(JSONNode *node, int depth = 0, bool sameLine = false)
 
 int main(int argc, const char * argv[])
 {
+	JSONStats runStats;
+	JSONStats *stats = NULL;
+	bool statsJSON = false;
 	FILE *f;
 	bool isStdin = true;
+	const char *path = NULL;
+	std::vector<const char *> paths;
+	const char *outDir = NULL;
+	bool useBatch = false;
+	bool inPlace = false;
+	const char *selectPath = NULL;
+	const char *snapshotPath = NULL;
+	bool useSnapshot = false;
+	bool keyIndex = false;
+	bool useArena = false;
+	bool hugePages = false;
+	bool useTape = false;
+	bool useStream = false;
+	bool useLines = false;
+	bool useParallel = false;
+	bool useLazy = false;
+	bool usePipeline = false;
+	bool minify = false;
+	bool rawUTF8 = false;
+	int threads = 0;
+	size_t pushSize = 0;
+	size_t maxDiagnostics = 0;
+	JSONDuplicates duplicates = JSONDuplicateLast;
+	
+	JSONLimits limits;
+	
+	for (int i = 1; i < argc; ++i) {
+		if (!strcmp(argv[i],"--arena")) {
+			useArena = true;
+		} else if (!strcmp(argv[i],"--stream")) {
+			useStream = true;
+		} else if (!strcmp(argv[i],"--tape")) {
+			useTape = true;
+		} else if (!strcmp(argv[i],"--ndjson")) {
+			useLines = true;
+		} else if (!strcmp(argv[i],"--parallel")) {
+			useParallel = true;
+		} else if (!strcmp(argv[i],"--lazy")) {
+			useLazy = true;
+		} else if (!strcmp(argv[i],"--pipeline")) {
+			usePipeline = true;
+		} else if (!strcmp(argv[i],"--batch")) {
+			useBatch = true;
+		} else if (!strcmp(argv[i],"--in-place")) {
+			inPlace = true;
+		} else if (!strcmp(argv[i],"--out-dir") && (i + 1 < argc)) {
+			outDir = argv[++i];
+		} else if (!strcmp(argv[i],"--snapshot")) {
+			useSnapshot = true;
+		} else if (!strcmp(argv[i],"--save-snapshot") && (i + 1 < argc)) {
+			snapshotPath = argv[++i];
+		} else if (!strcmp(argv[i],"--key-index")) {
+			keyIndex = true;
+		} else if (!strcmp(argv[i],"--select") && (i + 1 < argc)) {
+			selectPath = argv[++i];
+		} else if (!strcmp(argv[i],"--minify")) {
+			minify = true;
+		} else if (!strcmp(argv[i],"--utf8")) {
+			rawUTF8 = true;
+		} else if (!strcmp(argv[i],"--duplicates") && (i + 1 < argc)) {
+			++i;
+			if (!strcmp(argv[i],"first")) {
+				duplicates = JSONDuplicateFirst;
+			} else if (!strcmp(argv[i],"all")) {
+				duplicates = JSONDuplicateKeepAll;
+			} else if (!strcmp(argv[i],"last")) {
+				duplicates = JSONDuplicateLast;
+			} else {
+				fprintf(stderr,"prettyjson: --duplicates must be first, last or all, not %s\n",argv[i]);
+				exit(1);
+			}
+		} else if (!strcmp(argv[i],"--max-depth") && (i + 1 < argc)) {
+			limits.maxDepth = strtoull(argv[++i],NULL,10);
+		} else if (!strcmp(argv[i],"--max-string") && (i + 1 < argc)) {
+			limits.maxStringLength = strtoull(argv[++i],NULL,10);
+		} else if (!strcmp(argv[i],"--max-tokens") && (i + 1 < argc)) {
+			limits.maxTokens = strtoull(argv[++i],NULL,10);
+		} else if (!strcmp(argv[i],"--max-bytes") && (i + 1 < argc)) {
+			limits.maxBytes = strtoull(argv[++i],NULL,10);
+		} else if (!strcmp(argv[i],"--max-diagnostics") && (i + 1 < argc)) {
+			maxDiagnostics = strtoull(argv[++i],NULL,10);
+		} else if (!strcmp(argv[i],"--push") && (i + 1 < argc)) {
+			pushSize = strtoull(argv[++i],NULL,10);
+		} else if ((!strcmp(argv[i],"--threads") || !strcmp(argv[i],"-j")) && (i + 1 < argc)) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i],"--huge-pages")) {
+			useArena = true;
+			hugePages = true;
+		} else if (!strcmp(argv[i],"--stats")) {
+			stats = &runStats;
+		} else if (!strcmp(argv[i],"--stats-json")) {
+			stats = &runStats;
+			statsJSON = true;
+		} else if (!strcmp(argv[i],"--help") || !strcmp(argv[i],"-h")) {
+			Usage(stdout,0);
+		} else if (argv[i][0] == '-') {
+			fprintf(stderr,"prettyjson: unknown option or missing value: %s\n",argv[i]);
+			Usage(stderr,1);
+		} else {
+			path = argv[i];
+			paths.push_back(argv[i]);
+		}
+	}
+	
+	/*
+	 *	With --stats (or --stats-json) the time spent in each phase, the
+	 *	input and output, the nodes parsed and the heap allocations made are
+	 *	reported on stderr at the end.
+	 */
+	
+	if (stats) JSONStats::setCountAllocations(true);
+	
+	if (!useBatch && (paths.size() > 1)) {
+		fprintf(stderr,"prettyjson: only one file may be given without --batch\n");
+		Usage(stderr,1);
+	}
+	
+	/*
+	 *	With --batch every path is processed, with directories searched for
+	 *	.json files, or the paths are read from stdin one per line if none
+	 *	are given. Files are formatted in place with --in-place, or into the
+	 *	same relative paths under a directory with --out-dir DIR; otherwise
+	 *	they are only checked. A file which would be written where an
+	 *	earlier one was is skipped as a duplicate. A JSON report of the files
+	 *	which needed repair or failed is written to stdout.
+	 */
+	
+	if (useBatch) {
+		JSONWorkPool pool(threads);
+		JSONBatch batch(&pool);
+		
+		if (inPlace) {
+			batch.setOutput(JSONBatchInPlace);
+		} else if (outDir) {
+			batch.setOutput(JSONBatchMirror,outDir);
+		}
+		batch.setMinify(minify);
+		batch.setRawUTF8(rawUTF8);
+		batch.setDuplicates(duplicates);
+		batch.setLimits(limits);
+		batch.setStats(stats);
+		
+		{
+			JSONStatsPhase phase(stats,JSONPhaseParse);
+			if (paths.empty()) {
+				char *line = NULL;
+				size_t cap = 0;
+				ssize_t len;
+				while ((len = getline(&line,&cap,stdin)) > 0) {
+					while ((len > 0) && ((line[len - 1] == '\n') || (line[len - 1] == '\r'))) line[--len] = 0;
+					if (len > 0) batch.add(line);
+				}
+				free(line);
+			} else {
+				for (size_t i = 0; i < paths.size(); ++i) batch.add(paths[i]);
+			}
+			batch.finish();
+		}
+		
+		JSONFdWriter out(1);
+		batch.report(&out);
+		out.flush();
+		PrintStats(stats,JSONDiagnostics(),statsJSON);
+		return 0;
+	}
 	
-	if (argc > 1) {
-		f = fopen(argv[1],"rb");
+	if (path) {
+		f = fopen(path,"rb");
 		if (f == NULL) {
-			printf("Unable to open file\n");
+			fprintf(stderr,"Unable to open file %s\n",path);
 			exit(1);
 		}
 		isStdin = false;
 	} else {
 		f = stdin;
 	}
-	JSONLexer lexer(f);
-	JSONRecordParser parser;
-	JSONNode *node = parser.parse(&lexer);
+	
+	/*
+	 *	With --snapshot the input is a snapshot written by --save-snapshot.
+	 *	It is mapped and formatted, or selected from with --select, in place.
+	 */
+	
+	if (useSnapshot) {
+		JSONSnapshot snapshot;
+		JSONDiagnostics none;
+		
+		if (stats) stats->enter(JSONPhaseRead);
+		bool ok = snapshot.open(fileno(f));
+		if (stats) stats->leave();
+		if (!ok) {
+			fprintf(stderr,"Invalid snapshot\n");
+			exit(1);
+		}
+		
+		std::unique_ptr<JSONWriter> output(OpenOutput(1,usePipeline));
+		JSONWriter &out = *output;
+		out.setStats(stats);
+		out.setRawUTF8(rawUTF8);
+		
+		if (selectPath) {
+			JSONSelector selector(&out);
+			if (!selector.setPointer(selectPath)) {
+				fprintf(stderr,"Invalid JSON Pointer: %s\n",selectPath);
+				exit(1);
+			}
+			selector.setMinify(minify);
+			
+			JSONStatsPhase phase(stats,JSONPhaseFormat);
+			selector.select(&snapshot);
+		} else {
+			JSONStatsPhase phase(stats,JSONPhaseFormat);
+			if (minify) {
+				JSONMinify(snapshot.root(),&out);
+			} else {
+				JSONFormat(snapshot.root(),&out);
+			}
+			out.put('\n');
+		}
+		out.flush();
+		PrintStats(stats,none,statsJSON);
+		
+		if (!isStdin) fclose(f);
+		return 0;
+	}
+	
+	/*
+	 *	With --ndjson each line is a separate record. Records are parsed in
+	 *	parallel and written in input order; diagnostics go to stderr so they
+	 *	do not break up the output.
+	 */
+	
+	if (useLines) {
+		JSONWorkPool pool(threads);
+		JSONLines lines(&pool);
+		std::unique_ptr<JSONInput> input(OpenInput(fileno(f),usePipeline));
+		std::unique_ptr<JSONWriter> output(OpenOutput(1,usePipeline));
+		JSONWriter &out = *output;
+		out.setRawUTF8(rawUTF8);
+		JSONFdWriter err(2);
+		
+		lines.setMinify(minify);
+		lines.setDuplicates(duplicates);
+		lines.setLimits(limits);
+		lines.setStats(stats);
+		lines.errors.setLimit(maxDiagnostics);
+		out.setStats(stats);
+		{
+			JSONStatsPhase phase(stats,JSONPhaseParse);
+			lines.process(input.get(),&out);
+		}
+		out.flush();
+		
+		char msg[512];
+		JSONDiagnostics::iterator iter;
+		for (iter = lines.errors.begin(); iter != lines.errors.end(); ++iter) {
+			iter->render(msg,sizeof(msg));
+			err.print("# record %ld line %ld: %s %s\n",iter->getRecord(),iter->getLine(),iter->isWarning() ? "W" : "E",msg);
+		}
+		PrintDropped(lines.errors,err);
+		err.flush();
+		PrintStats(stats,lines.errors,statsJSON);
+		
+		if (!isStdin) fclose(f);
+		return 0;
+	}
+	
+	/*
+	 *	With --parallel a single large array or object is split between its
+	 *	members and parsed on all cores. This needs the whole document in
+	 *	memory, so it only applies to files we can map. The DOM is formatted
+	 *	on all cores too, for any input.
+	 */
+	
+	if (useParallel) {
+		if (stats) stats->enter(JSONPhaseRead);
+		JSONMappedInput input(fileno(f));
+		if (stats) stats->leave();
+		const uint8_t *data;
+		size_t length;
+		
+		if (input.isValid() && ((length = input.read(&data)) > 0)) {
+			JSONWorkPool pool(threads);
+			JSONParallelParser parser(&pool);
+			std::unique_ptr<JSONWriter> output(OpenOutput(1,usePipeline));
+			JSONWriter &out = *output;
+			out.setRawUTF8(rawUTF8);
+			
+			parser.setDuplicates(duplicates);
+			parser.setBorrowStrings(true);
+			parser.setLimits(limits);
+			parser.setStats(stats);
+			parser.setMinify(minify);
+			parser.errors.setLimit(maxDiagnostics);
+			out.setStats(stats);
+			
+			if (useStream) {
+				bool ok;
+				{
+					JSONStatsPhase phase(stats,JSONPhaseParse);
+					ok = parser.format(data,length,&out);
+				}
+				if (ok || parser.wroteOutput()) {
+					out.put('\n');
+				}
+				PrintErrors(parser.errors,out);
+			} else {
+				JSONNode *node;
+				{
+					JSONStatsPhase phase(stats,JSONPhaseParse);
+					node = parser.parse(data,length);
+				}
+				PrintErrors(parser.errors,out);
+				
+				if (node != NULL) {
+					JSONStatsPhase phase(stats,JSONPhaseFormat);
+					JSONParallelFormatter formatter(&pool);
+					formatter.setMinify(minify);
+					formatter.format(node,&out);
+					out.put('\n');
+				}
+			}
+			out.flush();
+			PrintStats(stats,parser.errors,statsJSON);
+			
+			if (!isStdin) fclose(f);
+			return 0;
+		}
+	}
+	
+	/*
+	 *	With --lazy the values --select asks for (or the whole document) are
+	 *	looked up in a JSONLazyDocument over the mapped file, which reads only
+	 *	the containers on the path. Repeated keys are resolved as
+	 *	--duplicates last does, and nothing is diagnosed.
+	 */
+	
+	if (useLazy) {
+		if (duplicates != JSONDuplicateLast) {
+			fprintf(stderr,"prettyjson: --lazy only keeps the last of repeated keys\n");
+			exit(1);
+		}
+		
+		if (stats) stats->enter(JSONPhaseRead);
+		JSONMappedInput input(fileno(f));
+		if (stats) stats->leave();
+		const uint8_t *data;
+		size_t length;
+		
+		if (input.isValid() && ((length = input.read(&data)) > 0)) {
+			std::unique_ptr<JSONWriter> output(OpenOutput(1,usePipeline));
+			JSONWriter &out = *output;
+			out.setRawUTF8(rawUTF8);
+			out.setStats(stats);
+			
+			JSONSelector selector(&out);
+			if (!selector.setPointer(selectPath ? selectPath : "")) {
+				fprintf(stderr,"Invalid JSON Pointer: %s\n",selectPath);
+				exit(1);
+			}
+			selector.setMinify(minify);
+			{
+				JSONStatsPhase phase(stats,JSONPhaseParse);
+				JSONLazyDocument doc(data,length);
+				selector.select(&doc);
+			}
+			out.flush();
+			PrintStats(stats,JSONDiagnostics(),statsJSON);
+			
+			if (!isStdin) fclose(f);
+			return 0;
+		}
+	}
+	
+	/*
+	 *	With --arena the whole document is allocated from one arena, which
+	 *	is reported on stderr so workers can be sized.
+	 */
+	
+	JSONArena arena(4*1024*1024,hugePages);
+	
+	/*
+	 *	Opening the input maps it and starts the kernel reading ahead, so
+	 *	it counts as reading. With --pipeline the input is read ahead on a
+	 *	reader thread and the output written behind on a writer thread
+	 *	instead; --push reads the input itself, so it is never read ahead.
+	 */
+	
+	if (stats) stats->enter(JSONPhaseRead);
+	std::unique_ptr<JSONInput> input(OpenInput(fileno(f),usePipeline && !pushSize));
+	JSONLexer lexer(input.get());
+	std::unique_ptr<JSONWriter> output(OpenOutput(1,usePipeline));
+	JSONWriter &out = *output;
+	out.setStats(stats);
+	
+	/*
+	 *	With --utf8 strings are written as UTF-8, rather than as ASCII with
+	 *	everything else escaped.
+	 */
+	
+	out.setRawUTF8(rawUTF8);
+	if (stats) stats->leave();
+	
+	/*
+	 *	With --select POINTER only the values matching the JSON Pointer are
+	 *	written, each on lines of its own; a * in the pointer matches any key
+	 *	or index. Containers off the path are skipped without being parsed.
+	 *	Diagnostics go to stderr so the output can be piped on.
+	 */
+	
+	if (selectPath) {
+		JSONSelector selector(&out);
+		JSONFdWriter err(2);
+		
+		if (!selector.setPointer(selectPath)) {
+			fprintf(stderr,"Invalid JSON Pointer: %s\n",selectPath);
+			exit(1);
+		}
+		selector.setMinify(minify);
+		selector.setDuplicates(duplicates);
+		selector.setLimits(limits);
+		selector.setStats(stats);
+		selector.errors.setLimit(maxDiagnostics);
+		{
+			JSONStatsPhase phase(stats,JSONPhaseParse);
+			selector.select(&lexer);
+		}
+		out.flush();
+		PrintErrors(selector.errors,err);
+		err.flush();
+		PrintStats(stats,selector.errors,statsJSON);
+		
+		if (!isStdin) fclose(f);
+		return 0;
+	}
+	
+	/*
+	 *	With --stream the document is formatted as it is parsed, without a
+	 *	DOM. Output starts immediately, so any errors are listed at the end.
+	 *	With --push N the input is pushed to the formatter N bytes at a time
+	 *	rather than read by the lexer.
+	 */
+	
+	if (useStream) {
+		JSONStreamFormatter formatter(&out);
+		bool ok;
+		
+		formatter.setMinify(minify);
+		formatter.setLimits(limits);
+		formatter.setStats(stats);
+		formatter.errors.setLimit(maxDiagnostics);
+		if (pushSize) {
+			PushInput(formatter,fileno(f),pushSize);
+			ok = formatter.finish();
+		} else {
+			ok = formatter.format(&lexer);
+		}
+		if (ok || formatter.wroteOutput()) {
+			out.put('\n');
+		}
+		PrintErrors(formatter.errors,out);
+		out.flush();
+		PrintStats(stats,formatter.errors,statsJSON);
+		
+		if (!isStdin) fclose(f);
+		return 0;
+	}
+	
+	/*
+	 *	With --tape the document is parsed into the compact tape DOM and
+	 *	formatted with a linear walk. Keys appear in input order.
+	 */
+	
+	if (useTape) {
+		JSONTape tape;
+		JSONTapeParser tparser;
+		tparser.setLimits(limits);
+		tparser.setStats(stats);
+		tparser.errors.setLimit(maxDiagnostics);
+		bool ok = tparser.parse(&lexer,&tape);
+		PrintErrors(tparser.errors,out);
+		
+		if (ok) {
+			JSONStatsPhase phase(stats,JSONPhaseFormat);
+			if (minify) {
+				JSONMinify(tape.root(),&out);
+			} else {
+				JSONFormat(tape.root(),&out);
+			}
+			out.put('\n');
+		}
+		out.flush();
+		PrintStats(stats,tparser.errors,statsJSON);
+		
+		if (!isStdin) fclose(f);
+		return 0;
+	}
+	
+	/*
+	 *	Strings are borrowed from the input when it is mapped; the lexer
+	 *	outlives the document.
+	 */
+	
+	JSONRecordParser parser(useArena ? &arena : NULL);
+	parser.setDuplicates(duplicates);
+	parser.setBorrowStrings(true);
+	parser.setLimits(limits);
+	parser.setStats(stats);
+	parser.errors.setLimit(maxDiagnostics);
+	
+	/*
+	 *	With --push N the input is pushed to the parser N bytes at a time
+	 *	rather than read by the lexer.
+	 */
+	
+	JSONNode *node;
+	if (pushSize) {
+		PushInput(parser,fileno(f),pushSize);
+		node = parser.finish();
+	} else {
+		node = parser.parse(&lexer);
+	}
 	
 	/*
 	 *	Dump the errors at the top
 	 */
 	
-	std::vector<JSONError>::iterator iter;
-	for (iter = parser.errors.begin(); iter != parser.errors.end(); ++iter) {
-		printf("# line %ld: %s %s\n",iter->getLine(),iter->isWarning() ? "W" : "E",iter->getError().c_str());
+	PrintErrors(parser.errors,out);
+	
+	/*
+	 *	With --save-snapshot PATH the repaired document is saved as a
+	 *	snapshot instead of being written out; --key-index adds an index of
+	 *	the keys of large objects.
+	 */
+	
+	if (snapshotPath) {
+		bool ok;
+		{
+			JSONStatsPhase phase(stats,JSONPhaseWrite);
+			ok = (node != NULL) && JSONSnapshot::write(node,snapshotPath,keyIndex);
+		}
+		if (node != NULL) {
+			JSONStatsPhase phase(stats,JSONPhaseFree);
+			if (!useArena) delete node;
+		}
+		out.flush();
+		PrintStats(stats,parser.errors,statsJSON);
+		if (!ok) {
+			fprintf(stderr,"Unable to write snapshot\n");
+			exit(1);
+		}
+		
+		if (!isStdin) fclose(f);
+		return 0;
 	}
 	
 	/*
@@ -186,8 +803,30 @@ int main(int argc, const char * argv[])
 	 */
 	 
 	if (node != NULL) {
-		JSONFormat(node);
-		printf("\n");
+		{
+			JSONStatsPhase phase(stats,JSONPhaseFormat);
+			if (useParallel) {
+				JSONWorkPool pool(threads);
+				JSONParallelFormatter formatter(&pool);
+				formatter.setMinify(minify);
+				formatter.format(node,&out);
+			} else if (minify) {
+				JSONMinify(node,&out);
+			} else {
+				JSONFormat(node,&out);
+			}
+			out.put('\n');
+		}
+		
+		JSONStatsPhase phase(stats,JSONPhaseFree);
+		if (!useArena) delete node;
+	}
+	
+	out.flush();
+	PrintStats(stats,parser.errors,statsJSON);
+	
+	if (useArena) {
+		fprintf(stderr,"# arena: %zu bytes used, %zu bytes reserved\n",arena.bytesUsed(),arena.bytesReserved());
 	}
 	
 	if (!isStdin) {